@@ -0,0 +1,537 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Throughput benchmarks of the training and inference paths. Sweeps model shapes
+// (width, depth, activation), batch sizes, optimizers and thread counts and prints
+// one JSON document with the timing statistics and derived rates of every run.
+//
+// usage: ann_bench.out [-q] [-w warmup] [-r reps] [-o file]
+//   -q  quick sweep (a few small configurations)
+//   -w  untimed runs before the timed ones (default 2)
+//   -r  timed runs; the rates use the median (default 7)
+//   -o  writes the JSON to file instead of stdout
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "nn.h"
+#include "nn_par.h"
+#include "rnd.h"
+#include "log.h"
+
+#define BENCH_MAX_REPS 100
+// work per timed run, in multiply-adds, for sizing the data sets
+#define BENCH_RUN_MACS 2.0e8
+#define BENCH_MIN_DATA 256
+#define BENCH_MAX_DATA 65536
+#define BENCH_OUTPUT_SIZE 16
+// models averaged by the merge benchmark
+#define BENCH_MERGE_REPLICAS 8
+
+typedef struct bench_opts
+{
+    bool quick;
+    int warmup;
+    int reps;
+    FILE *out;
+} bench_opts;
+
+typedef struct bench_stats
+{
+    double min, median, mean, stddev; // seconds per run
+} bench_stats;
+
+typedef void (*bench_func)(void *ctx);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int cmp_dbl(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bench_stats bench_time(const bench_opts *opts, bench_func func, void *ctx)
+{
+    double t[BENCH_MAX_REPS];
+    for (int i = 0; i < opts->warmup; i++)
+        func(ctx);
+    for (int i = 0; i < opts->reps; i++)
+    {
+        double t0 = now();
+        func(ctx);
+        t[i] = now() - t0;
+    }
+    bench_stats st = {0};
+    for (int i = 0; i < opts->reps; i++)
+        st.mean += t[i];
+    st.mean /= opts->reps;
+    for (int i = 0; i < opts->reps; i++)
+        st.stddev += (t[i] - st.mean) * (t[i] - st.mean);
+    st.stddev = (opts->reps > 1) ? sqrt(st.stddev / (opts->reps - 1)) : 0;
+    qsort(t, opts->reps, sizeof(double), cmp_dbl);
+    st.min = t[0];
+    st.median = (opts->reps % 2) ? t[opts->reps / 2] : (t[opts->reps / 2 - 1] + t[opts->reps / 2]) / 2;
+    return st;
+}
+
+// ---- benchmarked operations ----
+
+typedef struct bench_ctx
+{
+    nn_model *model;
+    nn_optim *optim;
+    data_points *x;
+    data_points *trg;
+    IND_TYP nbr_data;
+    IND_TYP batch_size;
+    int nbr_threads;
+    vec inp, out;
+    IND_TYP *ind;
+    FLT_TYP *buf;
+    uint8_t *bytes;
+    const nn_model *const *replica;
+    int nbr_replicas;
+    nn_model *merged;
+    nn_dist *dist;
+} bench_ctx;
+
+static void run_apply(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    for (IND_TYP i = 0; i < c->nbr_data; i++)
+    {
+        data_points_copy_at(c->x, vec_at(&c->inp, 0), i, NULL);
+        nn_model_apply(c->model, &c->inp, &c->out, false);
+    }
+}
+
+// forward, backward and optimizer step over one epoch of mini-batches
+static void run_train(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_model_train_params params = nn_model_train_params_DEFAULT;
+    params.nbr_threads = c->nbr_threads;
+    nn_model_train_with(c->model, c->x, slice_NONE, c->trg, slice_NONE, NULL, slice_NONE,
+                        c->batch_size, 1, false, c->optim, nn_loss_MSE, &params);
+}
+
+static void run_optim(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_optim_update_model(c->optim, c->model);
+}
+
+static void run_eval(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_model_eval_par(c->model, c->x, slice_NONE, c->trg, slice_NONE, NULL, slice_NONE,
+                      nn_loss_MSE, false, c->nbr_threads);
+}
+
+static void run_serialize(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_model_serialize(c->model, c->bytes);
+}
+
+static void run_merge(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_model_merge(c->merged, c->replica, NULL, c->nbr_replicas, c->nbr_threads);
+}
+
+static void run_allreduce(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    nn_dist_allreduce(c->dist, c->buf, c->nbr_data);
+}
+
+// the shuffled rows of one epoch, batch by batch, as training gathers them
+static void run_gather(void *arg)
+{
+    bench_ctx *c = (bench_ctx *)arg;
+    IND_TYP width = c->x->width;
+    for (IND_TYP i = 0; i < c->nbr_data; i += c->batch_size)
+        for (IND_TYP r = 0; r < c->batch_size && i + r < c->nbr_data; r++)
+            data_points_copy_at(c->x, c->buf + r * width, c->ind[i + r], NULL);
+}
+
+// ---- JSON output ----
+
+typedef struct bench_result
+{
+    const char *bench;
+    const char *activ; // NULL: no model (width, depth and activ n/a)
+    IND_TYP width;
+    int depth;
+    IND_TYP batch_size; // 0: n/a
+    const char *optim;  // NULL: n/a
+    int nbr_threads;    // 0: n/a
+    const char *transport; // NULL: n/a
+    int nbr_ranks;         // 0: n/a
+    IND_TYP nbr_values;    // 0: n/a
+    IND_TYP nbr_samples;
+    double flop;  // per run; 0: n/a
+    double bytes; // per run; 0: n/a
+    bench_stats st;
+} bench_result;
+
+static void print_result(const bench_opts *opts, const bench_result *r, bool first)
+{
+    FILE *f = opts->out;
+    fprintf(f, "%s\n    {\"bench\": \"%s\"", (first) ? "" : ",", r->bench);
+    if (r->activ)
+        fprintf(f, ", \"width\": %ld, \"depth\": %d, \"activ\": \"%s\"", (long)r->width, r->depth, r->activ);
+    if (r->batch_size > 0)
+        fprintf(f, ", \"batch_size\": %ld", (long)r->batch_size);
+    if (r->optim)
+        fprintf(f, ", \"optim\": \"%s\"", r->optim);
+    if (r->nbr_threads > 0)
+        fprintf(f, ", \"threads\": %d", r->nbr_threads);
+    if (r->transport)
+        fprintf(f, ", \"transport\": \"%s\", \"ranks\": %d, \"values\": %ld", r->transport, r->nbr_ranks,
+                (long)r->nbr_values);
+    fprintf(f, ",\n     \"time_s\": {\"min\": %.9g, \"median\": %.9g, \"mean\": %.9g, \"stddev\": %.9g}",
+            r->st.min, r->st.median, r->st.mean, r->st.stddev);
+    double t = r->st.median;
+    if (r->nbr_samples > 0)
+        fprintf(f, ",\n     \"samples\": %ld, \"samples_per_sec\": %.6g", (long)r->nbr_samples, r->nbr_samples / t);
+    if (r->flop > 0)
+        fprintf(f, ", \"gflops\": %.6g", r->flop / t * 1e-9);
+    if (r->bytes > 0)
+        fprintf(f, ", \"bytes_per_sec\": %.6g", r->bytes / t);
+    fprintf(f, "}");
+}
+
+static void print_meta(const bench_opts *opts)
+{
+    FILE *f = opts->out;
+    fprintf(f, "{\n  \"meta\": {\"compiler\": \"%s\", \"flt_size\": %zu, \"ind_size\": %zu, \"ndebug\": %s,\n",
+#if defined(__VERSION__)
+            __VERSION__,
+#else
+            "unknown",
+#endif
+            sizeof(FLT_TYP), sizeof(IND_TYP),
+#ifdef NDEBUG
+            "true"
+#else
+            "false"
+#endif
+    );
+    fprintf(f, "           \"cores\": %d, \"warmup\": %d, \"reps\": %d, \"time\": %ld, \"quick\": %s},\n",
+            nn_par_nbr_cores(), opts->warmup, opts->reps, (long)time(NULL), (opts->quick) ? "true" : "false");
+    fprintf(f, "  \"results\": [");
+}
+
+// ---- sweep ----
+
+static const struct
+{
+    const char *name;
+    const nn_activ *activ;
+} activs[] = {{"relu", &nn_activ_RELU}, {"tanh", &nn_activ_TANH}};
+
+static const struct
+{
+    const char *name;
+    const nn_optim_class *cls;
+    int nbr_streams; // parameter-sized arrays read + written per step
+} optims[] = {{"sgd", &nn_optim_cls_SGD, 3}, {"adam", &nn_optim_cls_ADAM, 7}};
+
+#define ARR_LEN(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static void bench_shape(const bench_opts *opts, IND_TYP width, int depth, int act, bool *first)
+{
+    static const IND_TYP batch_full[] = {16, 128};
+    static const IND_TYP batch_quick[] = {32};
+    const IND_TYP *batches = (opts->quick) ? batch_quick : batch_full;
+    int nbr_batches = (opts->quick) ? ARR_LEN(batch_quick) : ARR_LEN(batch_full);
+    int thrd_set[2] = {1, nn_par_nbr_cores()};
+    int nbr_thrd_set = (thrd_set[1] > 1) ? 2 : 1;
+
+    nn_model model = nn_model_NULL;
+    nn_model_construct(&model, depth + 1, width);
+    for (int l = 0; l <= depth; l++)
+    {
+        nn_layer lay = {.out_sz = (l < depth) ? width : BENCH_OUTPUT_SIZE, .dropout = 0,
+                        .activ = (l < depth) ? *activs[act].activ : nn_activ_ID};
+        nn_model_append(&model, &lay);
+    }
+    nn_model_init_uniform_rnd(&model, 0.1, 0);
+    nn_model_pack(&model);
+
+    double macs = 0;
+    for (int l = 0; l < model.nbr_layers; l++)
+        macs += (double)model.weight[l].d1 * model.weight[l].d2;
+    IND_TYP nbr_data = (IND_TYP)(BENCH_RUN_MACS / (3 * macs));
+    nbr_data = (nbr_data < BENCH_MIN_DATA) ? BENCH_MIN_DATA : (nbr_data > BENCH_MAX_DATA) ? BENCH_MAX_DATA : nbr_data;
+
+    data_points x, trg;
+    data_points_construct(&x, width, nbr_data);
+    data_points_construct(&trg, BENCH_OUTPUT_SIZE, nbr_data);
+    x.nbr_points = trg.nbr_points = nbr_data;
+    for (IND_TYP i = 0; i < nbr_data; i++)
+    {
+        for (IND_TYP j = 0; j < width; j++)
+            data_points_ptr_at(&x, i)[j] = UNIF_FLT_RND_GEN() - 0.5f;
+        for (IND_TYP j = 0; j < BENCH_OUTPUT_SIZE; j++)
+            data_points_ptr_at(&trg, i)[j] = UNIF_FLT_RND_GEN();
+    }
+
+    bench_ctx c = {.model = &model, .x = &x, .trg = &trg, .nbr_data = nbr_data};
+    bench_result r = {.width = width, .depth = depth, .activ = activs[act].name};
+    size_t param_bytes = nn_model_nbr_param(&model) * sizeof(FLT_TYP);
+
+    // single sample inference
+    vec_construct(&c.inp, width);
+    vec_construct(&c.out, BENCH_OUTPUT_SIZE);
+    r.bench = "apply";
+    r.nbr_samples = nbr_data;
+    r.flop = 2 * macs * nbr_data;
+    r.st = bench_time(opts, run_apply, &c);
+    print_result(opts, &r, *first);
+    *first = false;
+    vec_destruct(&c.inp);
+    vec_destruct(&c.out);
+
+    // batched inference + loss
+    r.bench = "eval";
+    for (int k = 0; k < nbr_thrd_set; k++)
+    {
+        c.nbr_threads = r.nbr_threads = thrd_set[k];
+        r.st = bench_time(opts, run_eval, &c);
+        print_result(opts, &r, false);
+    }
+    r.nbr_threads = 0;
+
+    // training step (gather, forward, backward, update) and update alone
+    for (int o = 0; o < ARR_LEN(optims); o++)
+    {
+        nn_optim optim;
+        nn_optim_construct(&optim, optims[o].cls, &model);
+        if (optims[o].cls == &nn_optim_cls_SGD)
+        {
+            nn_optim_cls_SGD_params sgd_p = {.learning_rate = 0.0001f};
+            nn_optim_set_params(&optim, &sgd_p);
+        }
+        c.optim = &optim;
+        r.optim = optims[o].name;
+
+        r.bench = "optim_update";
+        r.nbr_samples = 0;
+        r.flop = 0;
+        r.bytes = (double)optims[o].nbr_streams * param_bytes;
+        r.st = bench_time(opts, run_optim, &c);
+        print_result(opts, &r, false);
+
+        r.bench = "train";
+        r.nbr_samples = nbr_data;
+        r.flop = 6 * macs * nbr_data;
+        r.bytes = 0;
+        for (int b = 0; b < nbr_batches; b++)
+        {
+            c.batch_size = r.batch_size = batches[b];
+            for (int k = 0; k < nbr_thrd_set; k++)
+            {
+                c.nbr_threads = r.nbr_threads = thrd_set[k];
+                r.st = bench_time(opts, run_train, &c);
+                print_result(opts, &r, false);
+            }
+        }
+        r.batch_size = 0;
+        r.nbr_threads = 0;
+        nn_optim_destruct(&optim);
+    }
+    r.optim = NULL;
+
+    r.bench = "serialize";
+    r.nbr_samples = 0;
+    r.flop = 0;
+    r.bytes = (double)nn_model_serial_size(&model);
+    c.bytes = (uint8_t *)malloc(nn_model_serial_size(&model));
+    assert(c.bytes);
+    r.st = bench_time(opts, run_serialize, &c);
+    print_result(opts, &r, false);
+
+    // weighted average of replicas (copies of the model) into another copy; bytes streamed
+    nn_model replica[BENCH_MERGE_REPLICAS + 1];
+    const nn_model *replica_ptr[BENCH_MERGE_REPLICAS];
+    for (int k = 0; k <= BENCH_MERGE_REPLICAS; k++)
+    {
+        replica[k] = nn_model_NULL;
+        nn_model_deserialize(replica + k, c.bytes);
+        if (k < BENCH_MERGE_REPLICAS)
+            replica_ptr[k] = replica + k;
+    }
+    c.replica = replica_ptr;
+    c.nbr_replicas = BENCH_MERGE_REPLICAS;
+    c.merged = replica + BENCH_MERGE_REPLICAS;
+    r.bench = "merge";
+    r.bytes = (double)(BENCH_MERGE_REPLICAS + 1) * param_bytes;
+    for (int k = 0; k < nbr_thrd_set; k++)
+    {
+        c.nbr_threads = r.nbr_threads = thrd_set[k];
+        r.st = bench_time(opts, run_merge, &c);
+        print_result(opts, &r, false);
+    }
+    r.nbr_threads = 0;
+    for (int k = 0; k <= BENCH_MERGE_REPLICAS; k++)
+        nn_model_destruct(replica + k);
+    free(c.bytes);
+
+    // mini-batch row gather in shuffled order; bytes copied
+    r.bench = "gather";
+    r.nbr_samples = nbr_data;
+    r.bytes = (double)nbr_data * width * sizeof(FLT_TYP);
+    c.ind = (IND_TYP *)malloc(nbr_data * sizeof(IND_TYP));
+    assert(c.ind);
+    for (IND_TYP i = 0; i < nbr_data; i++)
+        c.ind[i] = i;
+    rnd_shuffle_ind(c.ind, nbr_data, UINT_RND_GEN);
+    for (int b = 0; b < nbr_batches; b++)
+    {
+        c.batch_size = r.batch_size = batches[b];
+        c.buf = (FLT_TYP *)malloc(c.batch_size * width * sizeof(FLT_TYP));
+        assert(c.buf);
+        r.st = bench_time(opts, run_gather, &c);
+        print_result(opts, &r, false);
+        free(c.buf);
+    }
+    free(c.ind);
+
+    data_points_destruct(&x);
+    data_points_destruct(&trg);
+    nn_model_destruct(&model);
+}
+
+typedef struct bench_dist
+{
+    const bench_opts *opts;
+    enum nn_dist_transport transport;
+    char name[64];
+    int nbr_ranks;
+    IND_TYP nbr_values;
+    bool first;
+    bool printed; // by rank 0, which runs in the calling process
+} bench_dist;
+
+// every rank times the same calls, rank 0 reports
+static int bench_allreduce_rank(int rank, void *arg)
+{
+    bench_dist *bd = (bench_dist *)arg;
+    nn_dist dist = nn_dist_NULL;
+    if (!nn_dist_open(&dist, bd->transport, bd->name, rank, bd->nbr_ranks))
+        return -1;
+    bench_ctx c = {.dist = &dist, .nbr_data = bd->nbr_values};
+    c.buf = (FLT_TYP *)malloc(c.nbr_data * sizeof(FLT_TYP));
+    assert(c.buf);
+    for (IND_TYP j = 0; j < c.nbr_data; j++)
+        c.buf[j] = 0;
+    bench_stats st = bench_time(bd->opts, run_allreduce, &c);
+    int ret = (dist.failed) ? -1 : 0;
+    if (rank == 0 && ret == 0)
+    {
+        static const char *const transport_str[] = {"shm", "socket"};
+        bench_result r = {.bench = "allreduce", .transport = transport_str[bd->transport],
+                          .nbr_ranks = bd->nbr_ranks, .nbr_values = bd->nbr_values,
+                          .bytes = (double)bd->nbr_values * sizeof(FLT_TYP), .st = st};
+        print_result(bd->opts, &r, bd->first);
+        bd->printed = true;
+    }
+    free(c.buf);
+    nn_dist_close(&dist);
+    return ret;
+}
+
+// gradient allreduce of nn_dist over forked ranks, per transport, rank count and buffer
+// size; bytes of the buffer reduced. Forks, so before any thread is started.
+static void bench_allreduce(const bench_opts *opts, bool *first)
+{
+    static const IND_TYP values_full[] = {1 << 12, 1 << 16, 1 << 20};
+    static const IND_TYP values_quick[] = {1 << 16};
+    const IND_TYP *values = (opts->quick) ? values_quick : values_full;
+    int nbr_values = (opts->quick) ? ARR_LEN(values_quick) : ARR_LEN(values_full);
+    int rank_set[2] = {2, nn_par_nbr_cores()};
+    int nbr_rank_set = (rank_set[1] > 2) ? 2 : 1;
+
+    for (int tr = NN_DIST_SHM; tr <= NN_DIST_SOCKET; tr++)
+        for (int k = 0; k < nbr_rank_set; k++)
+            for (int v = 0; v < nbr_values; v++)
+            {
+                bench_dist bd = {.opts = opts, .transport = (enum nn_dist_transport)tr, .nbr_ranks = rank_set[k],
+                                 .nbr_values = values[v], .first = *first};
+                snprintf(bd.name, sizeof(bd.name), (tr == NN_DIST_SHM) ? "ann_bench_%d" : "/tmp/ann_bench_%d_sock",
+                         (int)getpid());
+                if (nn_dist_fork(bd.nbr_ranks, bench_allreduce_rank, &bd) != 0)
+                    fprintf(stderr, "allreduce on %d ranks failed\n", bd.nbr_ranks);
+                *first = *first && !bd.printed;
+            }
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {.quick = false, .warmup = 2, .reps = 7, .out = stdout};
+    const char *out_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-q"))
+            opts.quick = true;
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            opts.warmup = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            opts.reps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [-q] [-w warmup] [-r reps] [-o file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (opts.reps < 1 || opts.reps > BENCH_MAX_REPS || opts.warmup < 0)
+    {
+        fprintf(stderr, "%s: reps must be in [1, %d] and warmup >= 0\n", argv[0], BENCH_MAX_REPS);
+        return 2;
+    }
+    if (out_path && !(opts.out = fopen(out_path, "w")))
+    {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], out_path);
+        return 1;
+    }
+    log_set_level(LOG_WRN);
+
+    static const IND_TYP width_full[] = {32, 128, 512};
+    static const int depth_full[] = {2, 4};
+    static const IND_TYP width_quick[] = {64};
+    static const int depth_quick[] = {2};
+    const IND_TYP *widths = (opts.quick) ? width_quick : width_full;
+    const int *depths = (opts.quick) ? depth_quick : depth_full;
+    int nbr_widths = (opts.quick) ? ARR_LEN(width_quick) : ARR_LEN(width_full);
+    int nbr_depths = (opts.quick) ? ARR_LEN(depth_quick) : ARR_LEN(depth_full);
+    int nbr_activs = (opts.quick) ? 1 : ARR_LEN(activs);
+
+    print_meta(&opts);
+    bool first = true;
+    bench_allreduce(&opts, &first);
+    for (int w = 0; w < nbr_widths; w++)
+        for (int d = 0; d < nbr_depths; d++)
+            for (int a = 0; a < nbr_activs; a++)
+                bench_shape(&opts, widths[w], depths[d], a, &first);
+    fprintf(opts.out, "\n  ]\n}\n");
+
+    if (opts.out != stdout)
+        fclose(opts.out);
+    return 0;
+}
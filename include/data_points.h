@@ -1,8 +1,11 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "nn_config.h"
 #include "lin_alg.h"
 #include "payload.h"
+#include "nn_mmap.h"
 
 /**
  * Struct to represent a collection of data points (rows).
@@ -15,6 +18,7 @@ typedef struct data_points
     IND_TYP capacity;   // capacity of nbr_points which can be dynamically changed
     IND_TYP nbr_points; // number of data points stored (nbr_points <= capacity)
     IND_TYP init_capacity;
+    nn_mapping map;     // file mapping the payload lives in (data_points_mmap)
 } data_points;
 
 /**
@@ -25,8 +29,9 @@ typedef struct data_points
  * - width: 0
  * - capacity: 0
  * - nbr_points: 0
+ * - map: nn_mapping_NULL
  */
-#define data_points_NULL ((const data_points){.payload = payload_NULL, .width = 0, .capacity = 0, .nbr_points = 0, .init_capacity = 0})
+#define data_points_NULL ((const data_points){.payload = payload_NULL, .width = 0, .capacity = 0, .nbr_points = 0, .init_capacity = 0, .map = nn_mapping_NULL})
 
 /**
  * The default initial capacity allocated when constructing a new data_points object.
@@ -47,6 +52,46 @@ typedef struct data_points
  */
 data_points *data_points_construct(data_points *dtpts, IND_TYP width, IND_TYP init_capacity);
 
+/**
+ * Constructs a read-only data_points object on a dataset file (see data_points_save).
+ *
+ * The file is mapped read-only: the rows stay in the OS page cache and are read in on
+ * first access, so files larger than RAM can be used. The object works with
+ * data_points_at, data_points_copy_at, nn_model_train and nn_model_eval; appending,
+ * shuffling and clearing are refused.
+ *
+ * @param dtpts Pointer to the data_points object to initialize.
+ * @param file_path The dataset file.
+ * @param advice The expected access pattern (NN_MAP_SEQUENTIAL, NN_MAP_RANDOM, ...).
+ * @return Pointer to the initialized data_points object, NULL (logged) if the file can't be used.
+ */
+data_points *data_points_mmap(data_points *dtpts, const char *file_path, enum nn_mapping_advice advice);
+
+/**
+ * Checks if the data points live in a file mapping (data_points_mmap).
+ */
+bool data_points_is_mapped(const data_points *dtpts);
+
+/**
+ * Hints the OS at the coming access pattern of a mapped data_points object; a no-op otherwise.
+ *
+ * nn_model_train and nn_model_eval set it themselves: random for shuffled training,
+ * sequential otherwise.
+ */
+void data_points_advise(const data_points *dtpts, enum nn_mapping_advice advice);
+
+/**
+ * Writes the data points to a dataset file.
+ *
+ * The format is a 64 byte header (magic, version, sizeof(FLT_TYP), byte order, width
+ * and nbr_points) followed by the nbr_points rows, row-major.
+ *
+ * @param dtpts The data_points object to write.
+ * @param file_path The file to (over)write.
+ * @return 0 on success, -1 (logged) otherwise.
+ */
+int data_points_save(const data_points *dtpts, const char *file_path);
+
 /**
  * Frees the memory allocated for the given data_points object.
  *
@@ -96,9 +141,52 @@ vec *data_points_at_rnd(data_points *dtpts, vec *data, const slice *dt_sly);
 
 // vec *data_points_column_at(data_points *dtpts, vec *clm, IND_TYP j);
 
+/**
+ * Copies a data point (row), or the sliced part of it, into a contiguous array.
+ *
+ * Unlike data_points_at, no view on the payload is created; this is meant for
+ * gathering rows into batch buffers.
+ *
+ * @param dtpts The data points object.
+ * @param dst The destination array; it must have room for dt_sly->len (or width) values.
+ * @param i The index of the data point to copy.
+ * @param dt_sly The (regulated) slice indicating which part of the data point to copy; NULL for all.
+ * @return A pointer to dst.
+ */
+FLT_TYP *data_points_copy_at(const data_points *dtpts, FLT_TYP *dst, IND_TYP i, const slice *dt_sly);
+
+// largest staging buffer (bytes) of data_points_permute; larger permutations run in place
+#ifndef DATA_POINTS_PERMUTE_MAX_STAGE
+#define DATA_POINTS_PERMUTE_MAX_STAGE SIZE_MAX
+#endif
+// fewest rows worth a thread of their own in data_points_permute
+#define DATA_POINTS_PERMUTE_MIN_ROWS 4096
+
+// sets the largest staging buffer (bytes) of data_points_permute, initially
+// DATA_POINTS_PERMUTE_MAX_STAGE (0: always in place); returns the former one
+size_t data_points_set_permute_max_stage(size_t max_stage);
+
+/**
+ * Reorders the data points under i_sly: the k-th of them is afterwards the perm[k]-th one from before.
+ *
+ * The rows are gathered in parallel (with whole-row copies, prefetching a few rows ahead)
+ * into a staging buffer which is then copied back sequentially. If the buffer can't be
+ * allocated (or is larger than the limit of data_points_set_permute_max_stage), the cycles
+ * of perm are followed in place with one row of extra memory instead.
+ *
+ * @param dtpts The data_points object; not a mapping.
+ * @param i_sly The slice of the data points to reorder.
+ * @param perm A permutation of 0 .. i_sly.len - 1 (after regulation).
+ * @param nbr_threads The nbr of gathering threads; <= 0 means one per core.
+ * @return A pointer to dtpts.
+ */
+data_points *data_points_permute(data_points *dtpts, slice i_sly, const IND_TYP *perm, int nbr_threads);
+
 /**
  * Shuffles the data points in the given data_points object.
  *
+ * The random permutation is drawn first, then applied with data_points_permute.
+ *
  * @param dtpts The data_points object containing the data points to shuffle.
  * @param i_sly The slice indicating which part of the data points to shuffle.
  * @return A pointer to the shuffled data_points object.
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "data_points.h"
+
+/**
+ * Parameters of data_points_load_csv.
+ */
+typedef struct data_points_csv_params
+{
+    char delim;      // field separator, e.g. ',' or '\t'; 0 guesses it from the first row
+    bool header;     // the first line is a header and is skipped
+    slice x_sly;     // columns of the features; slice_NONE for all
+    slice trg_sly;   // columns of the targets (if data_trg is given); slice_NONE for all
+    int nbr_threads; // parsing threads; <= 0 means one per core
+} data_points_csv_params;
+
+#define data_points_csv_params_DEFAULT ((const data_points_csv_params){.delim = 0, .header = false, .x_sly = slice_NONE, .trg_sly = slice_NONE, .nbr_threads = 0})
+
+/**
+ * Loads a numeric CSV/TSV file into data points.
+ *
+ * The file is mapped and split into byte ranges at line ends. Threads first count the rows
+ * of their range, then parse them straight into data_x (and data_trg), which are constructed
+ * with exactly the nbr of rows. Every line holds the same nbr of fields; empty lines are
+ * skipped and quoted fields are not supported. Columns taken by neither slice are skipped
+ * without being parsed.
+ *
+ * @param data_x The features; must be data_points_NULL.
+ * @param data_trg The targets; must be data_points_NULL, or NULL for no targets.
+ * @param file_path The text file.
+ * @param params The parameters; NULL for data_points_csv_params_DEFAULT.
+ * @return The nbr of rows loaded, -1 (logged, data_x and data_trg left NULL) on error.
+ */
+IND_TYP data_points_load_csv(data_points *data_x, data_points *data_trg, const char *file_path,
+                             const data_points_csv_params *params);
+
+/**
+ * Parses a decimal float (as strtod, without hex floats) from [p, end).
+ *
+ * @param p Start of the text.
+ * @param end End of the text; the text needs no terminating 0.
+ * @param val Output value.
+ * @return A pointer to the first character after the number, NULL if there is no number at p.
+ */
+const char *data_points_parse_flt(const char *p, const char *end, double *val);
@@ -2,6 +2,13 @@
 #define NN_H_INCLUDED 1
 
 #include "nn_model.h"
+#include "nn_infer_ctx.h"
+#include "nn_qmodel.h"
+#include "nn_hmodel.h"
+#include "nn_export.h"
+#include "nn_early_stop.h"
+#include "nn_checkpoint.h"
+#include "nn_dist.h"
 
 #include "nn_optim_cls_SGD.h"
 #include "nn_optim_cls_ADAM.h"
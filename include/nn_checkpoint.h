@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "nn_config.h"
+#include "nn_model.h"
+#include "nn_optim.h"
+
+// Training checkpoints: the model (nn_model_file_serialize), the optimizer's params and state
+// (nn_optim_serialize), the nbr of epochs done and the training seed, so that training
+// resumes where it was stopped with nn_model_train_params.first_epoch and .seed.
+// A checkpoint file is written to a temporary file renamed over the file once complete.
+//
+// nn_checkpoint writes the snapshots on a background thread: a snapshot is serialized into
+// one of two buffers while the other one may be written, so training only waits for the
+// serialization. If snapshots come faster than they are written, only the latest one waiting
+// is written.
+
+typedef struct nn_checkpoint_state
+{
+    int epoch;     // nbr of epochs done; the first_epoch to resume with
+    uint64_t seed; // the training seed (nn_model_train_params.seed)
+} nn_checkpoint_state;
+
+typedef struct nn_checkpoint
+{
+    char *file_path;
+    uint8_t *buf[2];
+    size_t size[2], capacity[2];
+    int pending; // slot of the snapshot waiting to be written; -1: none
+    int writing; // slot being written; -1: none
+    long nbr_snapshots, nbr_written, nbr_dropped;
+    int status; // of the last write: 0 or -1
+    bool stop;
+    mtx_t mtx;
+    cnd_t cnd;
+    thrd_t thrd;
+} nn_checkpoint;
+
+// Starts the writer thread; returns NULL (logged) if it can't be started.
+nn_checkpoint *nn_checkpoint_start(nn_checkpoint *ck, const char *file_path);
+// serializes the training state for the writer; does not wait for the writes
+void nn_checkpoint_snapshot(nn_checkpoint *ck, const nn_model *model, const nn_optim *optimizer,
+                            const nn_checkpoint_state *state);
+// waits until all snapshots are written; returns the status of the last write
+int nn_checkpoint_flush(nn_checkpoint *ck);
+// flushes, stops the writer and frees the buffers; returns the status of the last write
+int nn_checkpoint_stop(nn_checkpoint *ck);
+
+// writes a checkpoint file right away; returns 0 on success, -1 (logged) otherwise
+int nn_checkpoint_save(const char *file_path, const nn_model *model, const nn_optim *optimizer,
+                       const nn_checkpoint_state *state);
+// Constructs model (NULL model; packed) and optimizer (of optim_class, on model) from a
+// checkpoint file and fills in state; the model part is checked like a model file
+// (nn_model_load). Returns 0 on success, -1 (logged; model stays NULL, optimizer is not
+// constructed) if the file can't be read, is damaged or does not fit optim_class.
+int nn_checkpoint_load(const char *file_path, nn_model *model, nn_optim *optimizer,
+                       const nn_optim_class *optim_class, nn_checkpoint_state *state);
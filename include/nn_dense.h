@@ -0,0 +1,56 @@
+#pragma once
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "nn_activ.h"
+
+// Dense layer kernels on contiguous row-major batches.
+// A batch holds nbr_rows rows (samples); w is out_sz x inp_sz and b has out_sz elements.
+// Dropout masks are bitsets with one row per sample: unit u of row r is kept iff
+// bit u of mask[r * NN_DENSE_MASK_WORDS(width) ...] is set.
+
+#define NN_DENSE_MASK_WORDS(width) (((width) + 63) / 64)
+
+// whether unit u of the mask row is kept
+static inline bool nn_dense_mask_bit(const uint64_t *mask_row, IND_TYP u)
+{
+    return (mask_row[u >> 6] >> (u & 63)) & 1;
+}
+
+// s[nbr_rows x out_sz] = a[nbr_rows x inp_sz] . w^T + b
+void nn_dense_forward(FLT_TYP *s, const FLT_TYP *a, IND_TYP nbr_rows,
+                      const FLT_TYP *w, const FLT_TYP *b,
+                      IND_TYP out_sz, IND_TYP inp_sz);
+
+// activations the fused kernels apply themselves
+static inline bool nn_dense_is_fusable(enum nn_activ_enum act)
+{
+    return act == ACTIV_ID || act == ACTIV_SIGMOID || act == ACTIV_TANH || act == ACTIV_RELU;
+}
+
+// s = a_in . w^T + b and a = activ(s) in one pass, the bias, activation and the dropout
+// mask on a being applied while the dot products are in registers;
+// s may be NULL when it is not needed, mask NULL for no dropout
+void nn_dense_forward_act(FLT_TYP *s, FLT_TYP *a, const FLT_TYP *a_in, IND_TYP nbr_rows,
+                          const FLT_TYP *w, const FLT_TYP *b,
+                          IND_TYP out_sz, IND_TYP inp_sz, enum nn_activ_enum act,
+                          const uint64_t *mask);
+
+// a = activ(s) element-wise over n values; a may be s
+void nn_dense_activate(FLT_TYP *a, const FLT_TYP *s, IND_TYP n, enum nn_activ_enum act);
+
+// dlt = activ'(s, a) * err (* mask) element-wise in one pass over nbr_rows x width values
+void nn_dense_delta(FLT_TYP *dlt, const FLT_TYP *err, const FLT_TYP *s, const FLT_TYP *a,
+                    IND_TYP nbr_rows, IND_TYP width, enum nn_activ_enum act, const uint64_t *mask);
+
+// d_w[out_sz x inp_sz] += alpha * dlt^T . a ; d_b[out_sz] += column sums of dlt[nbr_rows x out_sz]
+void nn_dense_backward_param(FLT_TYP *d_w, FLT_TYP *d_b,
+                             const FLT_TYP *dlt, const FLT_TYP *a, IND_TYP nbr_rows,
+                             FLT_TYP alpha, IND_TYP out_sz, IND_TYP inp_sz);
+
+// e[nbr_rows x inp_sz] = dlt[nbr_rows x out_sz] . w
+void nn_dense_backward_error(FLT_TYP *e, const FLT_TYP *dlt, IND_TYP nbr_rows,
+                             const FLT_TYP *w, IND_TYP out_sz, IND_TYP inp_sz);
+
+// zeroes the dropped units of a[nbr_rows x width]
+void nn_dense_mask_rows(FLT_TYP *a, const uint64_t *mask, IND_TYP nbr_rows, IND_TYP width);
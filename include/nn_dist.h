@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+
+// Data-parallel training over several processes (ranks): each rank trains a replica of
+// the model on its own shard of the data (nn_dist_shard) with the nn_dist in
+// nn_model_train_params.dist; after each mini-batch the gradients of all ranks are summed
+// (nn_dist_allreduce) before every rank takes the same optimizer step, so the replicas stay
+// equal. All ranks must train with the same batch size, nbr of epochs and nbr of rows.
+//
+// Transports:
+// NN_DIST_SHM: a POSIX shared memory segment, for the ranks on one host. Each rank copies
+// its buffer into its slot, sums its 1/nbr_ranks of the buffer over the slots of all ranks
+// (reduce-scatter) into a result area and all copy the result back (all-gather); the ranks
+// meet at two spinning barriers per call (per NN_DIST_SHM_CHUNK values).
+// NN_DIST_SOCKET: a ring of Unix domain sockets (rank r sends to rank r + 1), the stand-in
+// for a network ring across hosts; ring allreduce in nbr_ranks - 1 reduce-scatter and
+// nbr_ranks - 1 all-gather steps, each passing 1/nbr_ranks of the buffer to the next rank.
+// Either way all ranks get bitwise equal sums.
+
+enum nn_dist_transport
+{
+    NN_DIST_SHM,
+    NN_DIST_SOCKET
+};
+
+// values per slot of the shared memory segment; longer buffers are reduced in chunks
+#define NN_DIST_SHM_CHUNK (1 << 18)
+// seconds a rank waits for the others (connecting, barriers, transfers) before giving up
+#define NN_DIST_TIMEOUT 60.0
+
+typedef struct nn_dist
+{
+    enum nn_dist_transport transport;
+    int rank;
+    int nbr_ranks;
+    double timeout;
+    bool failed; // a transfer failed or timed out; all later calls fail
+    // NN_DIST_SHM
+    void *seg;
+    size_t seg_size;
+    // NN_DIST_SOCKET
+    int fd_next, fd_prev;
+    FLT_TYP *recv_buf;
+    IND_TYP recv_cap;
+} nn_dist;
+
+#define nn_dist_NULL ((const nn_dist){.rank = -1, .nbr_ranks = 0, .seg = NULL, .fd_next = -1, .fd_prev = -1, .recv_buf = NULL})
+
+// Called by all nbr_ranks ranks with the same transport and name and their own rank;
+// returns once they are connected, NULL (logged) if they are not within NN_DIST_TIMEOUT.
+// name identifies the run: the shared memory object "/nn_dist_<name>" (no '/' in name),
+// or the path prefix of the sockets "<name>.<rank>" (e.g. "/tmp/run42").
+nn_dist *nn_dist_open(nn_dist *dist, enum nn_dist_transport transport, const char *name,
+                      int rank, int nbr_ranks);
+void nn_dist_close(nn_dist *dist);
+
+// buf[0 .. n) = the sum of buf[0 .. n) over all ranks; returns 0, or -1 (logged) if a rank failed
+int nn_dist_allreduce(nn_dist *dist, FLT_TYP *buf, IND_TYP n);
+// the size bytes at buf of rank root to all ranks; returns 0, or -1 (logged)
+int nn_dist_broadcast(nn_dist *dist, void *buf, size_t size, int root);
+
+// The contiguous part of the rows of index_sly (regulated with nbr_data) trained on by the
+// rank: all ranks get index_sly.len / nbr_ranks rows, the remaining last rows are left out.
+slice nn_dist_shard(const nn_dist *dist, slice index_sly, IND_TYP nbr_data);
+
+// Runs func(rank, arg) on nbr_ranks processes: rank 0 in the calling process, the others in
+// forked children exiting after func. Must be called while the process has no other threads.
+// Returns the nbr of ranks whose func did not return 0.
+int nn_dist_fork(int nbr_ranks, int (*func)(int rank, void *arg), void *arg);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "data_points.h"
+#include "nn_model.h"
+#include "nn_loss.h"
+
+// Training callback (nn_model_train_params.callback) validating the model at each call and
+// stopping the training once the validation loss has not improved for patience calls.
+// The best weights can be put back when the training stops or ends.
+
+typedef struct nn_early_stop_params
+{
+    int patience;        // calls without improvement before stopping; <= 0: never stops
+    FLT_TYP min_delta;   // smallest decrease of the loss counted as an improvement
+    bool restore_best;   // puts the best weights back when the training stops or ends
+    IND_TYP subsample;   // > 0: validates on a fixed random subsample of that many rows
+    bool classification; // as nn_model_eval
+    int nbr_threads;     // of the validation; <= 0: one per core
+} nn_early_stop_params;
+
+#define nn_early_stop_params_DEFAULT ((const nn_early_stop_params){.patience = 5, .min_delta = 0, .restore_best = true, \
+                                                                   .subsample = 0, .classification = false, .nbr_threads = 1})
+
+typedef struct nn_early_stop
+{
+    nn_early_stop_params params;
+    // validation data; the subsample is a copy of the sliced columns of its rows
+    const data_points *data_x;
+    slice x_sly;
+    const data_points *data_trg;
+    slice trg_sly;
+    const vec *data_weight;
+    slice index_sly;
+    nn_loss loss;
+    data_points sub_x, sub_trg;
+    vec *sub_weight;
+    // progress
+    int nbr_calls;
+    FLT_TYP last_loss;
+    FLT_TYP best_loss;
+    int best_epoch;    // epoch and batch of the best loss
+    IND_TYP best_batch;
+    int nbr_bad_calls; // since the best loss
+    bool stopped;
+    FLT_TYP *best_param; // nn_model_get_param of the best weights (restore_best)
+} nn_early_stop;
+
+// The validation data must outlive the early stop (unless subsampled).
+nn_early_stop *nn_early_stop_construct(nn_early_stop *es,
+                                       const data_points *data_x, slice x_sly,
+                                       const data_points *data_trg, slice trg_sly,
+                                       const vec *data_weight,
+                                       slice index_sly,
+                                       const nn_loss loss,
+                                       const nn_early_stop_params *params);
+void nn_early_stop_destruct(nn_early_stop *es);
+// forgets the progress, e.g. before training again
+void nn_early_stop_reset(nn_early_stop *es);
+
+// the callback; ctx is the nn_early_stop
+bool nn_early_stop_callback(nn_model *model, const nn_model_train_info *info, void *ctx);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "data_points.h"
+#include "nn_loss.h"
+
+// The chunked loss evaluation shared by nn_model_eval_par and nn_qmodel_eval: the rows are
+// forwarded in chunks of NN_EVAL_CHUNK, the partial sums are kept per chunk and reduced in
+// chunk order, so the result does not depend on the nbr of threads.
+
+// nbr of rows per eval chunk
+#define NN_EVAL_CHUNK 256
+
+// The forward pass of one kind of model, each thread with a context of its own.
+typedef struct nn_eval_class
+{
+    // a context for batch_cap rows of the model; NULL (logged) if it can't be made
+    void *(*construct)(const void *model, IND_TYP batch_cap);
+    void (*destruct)(void *ctx);
+    // row-major input buffer of the context
+    FLT_TYP *(*input)(void *ctx);
+    // forwards the first nbr_rows rows of the context input; returns the row-major outputs
+    const FLT_TYP *(*infer_batch)(const void *model, void *ctx, IND_TYP nbr_rows);
+} nn_eval_class;
+
+// Loss of model (as nn_model_eval) over the rows of index_sly on nbr_threads threads (<= 0: one
+// per core). The slices are regulated and fit input_size and ouput_size; index_sly is not empty.
+FLT_TYP nn_eval_loss(const nn_eval_class *cls, const void *model,
+                     IND_TYP input_size, IND_TYP ouput_size,
+                     const data_points *data_x, slice x_sly,
+                     const data_points *data_trg, slice trg_sly,
+                     const vec *data_weight, slice index_sly,
+                     const nn_loss loss, bool classification,
+                     int nbr_threads);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "nn_config.h"
+#include "nn_model.h"
+
+// Ahead-of-time export of a trained nn_model as a standalone C source file.
+// The file holds the weights and biases as 64 byte aligned static const arrays and
+//     void <prefix>_forward(const FLT_TYP *restrict in, FLT_TYP *restrict out);
+// with the layer sizes as constants, the activations inlined and the dot products
+// unrolled over NN_EXPORT_LANES accumulators. It only needs <math.h> (sigmoid, tanh)
+// and C11; <PREFIX>_INPUT_SIZE / <PREFIX>_OUTPUT_SIZE are defined for the caller.
+// Dropout is not exported (inference). Weights are printed as hex floats, so the
+// exported forward gives the same values as nn_model_apply up to the summation order.
+
+#define NN_EXPORT_LANES 8
+
+// prefix must be a C identifier; only the ID, SIGMOID, TANH and RELU activations
+// and finite weights and biases can be exported. Returns 0 on success, -1 (logged,
+// no file left behind) otherwise.
+int nn_model_export_c(const nn_model *model, const char *file_path, const char *prefix);
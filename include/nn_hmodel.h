@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "nn_model.h"
+#include "nn_infer_ctx.h"
+
+// Inference copy of a trained nn_model with 16 bit weights (biases stay FLT_TYP).
+// The kernel converts small blocks of weights to fp32 right before using them
+// (F16C when compiled for it) and accumulates in FLT_TYP; no full size float copy
+// of the weights is ever made.
+
+enum nn_half_fmt
+{
+    NN_HALF_FP16, // IEEE binary16: 10 bit mantissa, range up to 65504
+    NN_HALF_BF16  // bfloat16: 7 bit mantissa, fp32 range
+};
+
+typedef struct nn_hlayer
+{
+    IND_TYP out_sz;
+    IND_TYP inp_sz;
+    uint16_t *w;   // out_sz x inp_sz
+    FLT_TYP *bias; // out_sz
+    nn_activ activ;
+} nn_hlayer;
+
+typedef struct nn_hmodel
+{
+    enum nn_half_fmt fmt;
+    IND_TYP input_size;
+    IND_TYP ouput_size;
+    IND_TYP max_width;
+    int nbr_layers;
+    nn_hlayer *layer;
+} nn_hmodel;
+
+#define nn_hmodel_NULL ((const nn_hmodel){.fmt = NN_HALF_FP16, .input_size = 0, .ouput_size = 0, .max_width = 0, .nbr_layers = 0, .layer = NULL})
+
+// hmodel must be nn_hmodel_NULL; weights are rounded to nearest even
+nn_hmodel *nn_model_to_half(nn_hmodel *hmodel, const nn_model *model, enum nn_half_fmt fmt);
+void nn_hmodel_destruct(nn_hmodel *hmodel);
+
+size_t nn_hmodel_weight_bytes(const nn_hmodel *hmodel);
+
+uint16_t nn_half_from_f32(float f, enum nn_half_fmt fmt);
+float nn_half_to_f32(uint16_t h, enum nn_half_fmt fmt);
+
+// As nn_model_infer_batch; ctx from nn_infer_ctx_construct_dims(ctx, input_size, max_width, ..)
+const FLT_TYP *nn_hmodel_infer_batch(const nn_hmodel *hmodel, nn_infer_ctx *ctx, IND_TYP nbr_rows);
+vec *nn_hmodel_infer(const nn_hmodel *hmodel, nn_infer_ctx *ctx, const vec *input, vec *output);
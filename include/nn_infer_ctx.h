@@ -0,0 +1,36 @@
+#pragma once
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "nn_model.h"
+
+// Inference context: owns the activation buffers of a forward pass, so that
+// any number of contexts (e.g. one per thread) can share one read-only model.
+typedef struct nn_infer_ctx
+{
+    IND_TYP input_size;
+    IND_TYP max_width;
+    IND_TYP batch_cap; // max nbr of rows forwarded at once
+    payload inp;       // batch_cap x input_size
+    payload buf[2];    // batch_cap x max_width; layers alternate between them
+} nn_infer_ctx;
+
+#define nn_infer_ctx_NULL ((const nn_infer_ctx){.input_size = 0, .max_width = 0, .batch_cap = 0})
+
+// buffers are sized from the model's input_size and max_width; batch_cap >= 1
+nn_infer_ctx *nn_infer_ctx_construct(nn_infer_ctx *ctx, const nn_model *model, IND_TYP batch_cap);
+// same for models of other weight types (e.g. nn_hmodel)
+nn_infer_ctx *nn_infer_ctx_construct_dims(nn_infer_ctx *ctx, IND_TYP input_size, IND_TYP max_width,
+                                          IND_TYP batch_cap);
+void nn_infer_ctx_destruct(nn_infer_ctx *ctx);
+
+// row-major input buffer of the context; room for batch_cap rows of the model input
+FLT_TYP *nn_infer_ctx_input(nn_infer_ctx *ctx);
+
+// Forwards the first nbr_rows rows of the context input through the model;
+// returns the row-major outputs, which stay valid until the next call with ctx.
+// The model is only read.
+const FLT_TYP *nn_model_infer_batch(const nn_model *model, nn_infer_ctx *ctx, IND_TYP nbr_rows);
+
+// reentrant counterpart of nn_model_apply(model, input, output, false)
+vec *nn_model_infer(const nn_model *model, nn_infer_ctx *ctx, const vec *input, vec *output);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Read-only memory mappings of whole files (POSIX mmap). The pages come from the
+// page cache, so every process mapping the same file shares them.
+// Also the atomic file replacement the files are written with.
+
+typedef struct nn_mapping
+{
+    void *addr;
+    size_t size;
+} nn_mapping;
+
+#define nn_mapping_NULL ((const nn_mapping){.addr = NULL, .size = 0})
+
+enum nn_mapping_advice
+{
+    NN_MAP_NORMAL,
+    NN_MAP_SEQUENTIAL,
+    NN_MAP_RANDOM,
+    NN_MAP_WILLNEED
+};
+
+// map must be nn_mapping_NULL; returns NULL (logged) if the file can't be mapped or is empty
+nn_mapping *nn_mapping_open(nn_mapping *map, const char *file_path);
+void nn_mapping_close(nn_mapping *map);
+bool nn_mapping_is_open(const nn_mapping *map);
+
+// access pattern hint for the bytes [off, off + len) of the mapping; only a hint
+void nn_mapping_advise(const nn_mapping *map, size_t off, size_t len, enum nn_mapping_advice advice);
+
+// Replacing a file atomically: the new contents go to a temporary file next to file_path,
+// named after the pid and a per-process counter (concurrent saves to one path don't collide),
+// which is synced and renamed over file_path once complete. Readers, and processes having
+// the old file mapped, never see a partial file.
+typedef struct nn_file_replace
+{
+    int fd; // of the temporary file
+    char *tmp_path;
+} nn_file_replace;
+
+// creates the temporary file; returns its fd, or -1 (logged)
+int nn_file_replace_open(nn_file_replace *rep, const char *file_path);
+// if ok, syncs the temporary file and renames it over file_path, otherwise (or if that fails)
+// removes it; returns 0, or -1 (logged, file_path untouched)
+int nn_file_replace_close(nn_file_replace *rep, const char *file_path, bool ok);
+// writes the size bytes, resuming after partial writes; false on error
+bool nn_file_write_all(int fd, const void *bytes, size_t size);
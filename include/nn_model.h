@@ -1,10 +1,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "nn_config.h"
 #include "nn_layer.h"
 #include "nn_model_intern.h"
+#include "nn_mmap.h"
+#include "nn_prof.h"
 #include "data_points.h"
 
 
@@ -18,9 +21,16 @@ typedef struct nn_model
     nn_layer *layer;
     mat *weight;
     vec *bias;
+    // packed parameters (nn_model_pack): weight and bias are views into param
+    payload param;
+    // file mapping param lives in (nn_model_mmap)
+    nn_mapping map;
     nn_model_intern intern;
 } nn_model;
 
+// byte alignment of the layer blocks in the packed parameter and gradient buffers
+#define NN_MODEL_PARAM_ALIGN 64
+
 extern const nn_model nn_model_NULL;
 
 #include "nn_optim.h"
@@ -35,11 +45,24 @@ void nn_model_destruct(nn_model *model);
 nn_model *nn_model_init_uniform_rnd(nn_model *model, FLT_TYP amp, FLT_TYP mean);
 // nn_model *nn_model_init_copy(nn_model *model, const nn_model *src_model);
 
+// Moves all weights and biases into one contiguous buffer (model->param) and the gradients
+// into a matching one (model->intern.grad); weight[l], bias[l], d_w[l] and d_b[l] stay usable
+// as views. The padding between layer blocks is zero so optimizers can sweep a whole buffer.
+// Appending or removing layers repacks the model.
+nn_model *nn_model_pack(nn_model *model);
+bool nn_model_is_packed(const nn_model *model);
+// offsets of the layers' weight and bias in the packed buffers (w_off, b_off may be NULL);
+// returns the buffer size
+IND_TYP nn_model_param_layout(const nn_model *model, IND_TYP *w_off, IND_TYP *b_off);
+
 // append layer
 nn_model *nn_model_append(nn_model *model, const nn_layer *layer);
 // remove layer
 nn_model *nn_model_remove(nn_model *model, int layer_index);
 
+// writes into model->intern, so calls on one model must not overlap;
+// nn_model_infer (nn_infer_ctx.h) only reads the model;
+// training: applies freshly drawn dropout masks
 vec *nn_model_apply(const nn_model *model, const vec *input, vec *output, bool training);
 
 nn_model *nn_model_train(nn_model *model,
@@ -53,6 +76,90 @@ nn_model *nn_model_train(nn_model *model,
                            nn_optim *optimizer,
                            const nn_loss loss);
 
+typedef struct nn_model_train_stats
+{
+    IND_TYP nbr_samples;    // nbr of samples trained on (epochs x data unless stopped early)
+    int nbr_epochs;         // nbr of epochs begun; fewer than asked for if stopped early
+    bool stopped;           // stopped early by the callback
+    double wall_time;       // seconds spent in the training loop
+    double samples_per_sec;
+    FLT_TYP final_loss;     // loss of the trained model over the training data (as nn_model_eval)
+                            // if params->stats_final_loss, otherwise 0
+} nn_model_train_stats;
+
+typedef struct nn_model_train_info
+{
+    int epoch;           // the current epoch, 1 .. nbr_epochs
+    int nbr_epochs;
+    IND_TYP batch;       // nbr of mini-batches done in the epoch
+    bool epoch_end;      // the epoch is done
+    double wall_time;    // seconds since training began
+    const nn_prof *prof; // the counters so far (params->prof); NULL if not profiled
+} nn_model_train_info;
+
+// Called at the end of every epoch (and every callback_every mini-batches) on one of the
+// training threads while the others wait, so it may read and change the model's weights.
+// Returning true stops the training.
+typedef bool (*nn_model_train_callback)(nn_model *model, const nn_model_train_info *info, void *ctx);
+
+typedef struct nn_model_train_params
+{
+    // data-parallel worker threads; each mini-batch is sharded over them
+    // and their gradients are summed before one optimizer step; <= 0: one per core
+    int nbr_threads;
+    // lock-free (Hogwild) mode: each thread trains on its own mini-batches and applies
+    // the SGD step to the shared weights without any synchronisation;
+    // needs the SGD optimizer, otherwise training stays synchronous
+    bool async;
+    // a producer thread gathers (and shuffles) the next mini-batch into a staging buffer
+    // while the current one trains; same results as without; synchronous mode only
+    bool prefetch;
+    // if not NULL, filled in at the end of training
+    nn_model_train_stats *stats;
+    // also fill in stats->final_loss: one more pass over the training data (nn_model_eval_par)
+    bool stats_final_loss;
+    // if not NULL, the phase counters of the training are added to it (builds with -DNN_PROF);
+    // constructed with the model's nbr of layers
+    nn_prof *prof;
+    // if not NULL, called with callback_ctx at the end of every epoch
+    nn_model_train_callback callback;
+    void *callback_ctx;
+    // > 0: the callback is also called every callback_every mini-batches (not in async mode)
+    IND_TYP callback_every;
+    // 0: the data order and the dropout masks are drawn from the global generator;
+    // otherwise those of an epoch only depend on seed and the epoch (rnd_shuffle_epoch)
+    uint64_t seed;
+    // resuming: the epochs before first_epoch are taken as done
+    int first_epoch;
+    // if not NULL, a snapshot of the model, the optimizer, the epochs done and the seed
+    // (drawn if 0) is handed to it every checkpoint_every epochs and after the last epoch
+    struct nn_checkpoint *checkpoint;
+    int checkpoint_every;
+    // if not NULL, data-parallel training with the other ranks (nn_dist.h) on their shards:
+    // the weights and the seed of rank 0 are taken on by all, the gradients of each mini-batch
+    // are summed over the ranks and a stop is agreed on at the callback calls; synchronous
+    // mode only; a packed model is trained (nn_model_pack); pass checkpoint on one rank only
+    struct nn_dist *dist;
+} nn_model_train_params;
+
+#define nn_model_train_params_DEFAULT ((const nn_model_train_params){.nbr_threads = 1, .async = false, .prefetch = false, .stats = NULL, .stats_final_loss = false, \
+                                                                     .prof = NULL, .callback = NULL, .callback_ctx = NULL, .callback_every = 0, \
+                                                                     .seed = 0, .first_epoch = 0, .checkpoint = NULL, .checkpoint_every = 1, \
+                                                                     .dist = NULL})
+
+// nn_model_train with extra params; NULL params means nn_model_train_params_DEFAULT
+nn_model *nn_model_train_with(nn_model *model,
+                                const data_points *data_x, slice x_sly,
+                                const data_points *data_trg, slice trg_sly,
+                                const vec *data_weight,
+                                slice index_sly,
+                                IND_TYP batch_size,
+                                int nbr_epochs,
+                                bool shuffle,
+                                nn_optim *optimizer,
+                                const nn_loss loss,
+                                const nn_model_train_params *params);
+
 FLT_TYP nn_model_eval(const nn_model *model,
                       const data_points *data_x, slice x_sly,
                       const data_points *data_trg, slice trg_sly,
@@ -61,10 +168,25 @@ FLT_TYP nn_model_eval(const nn_model *model,
                       const nn_loss loss,
                       bool classification);
 
+// nn_model_eval on nbr_threads threads (<= 0: one per core), each with its own
+// forward buffers; the result does not depend on nbr_threads
+FLT_TYP nn_model_eval_par(const nn_model *model,
+                          const data_points *data_x, slice x_sly,
+                          const data_points *data_trg, slice trg_sly,
+                          const vec *data_weight,
+                          slice index_sly,
+                          const nn_loss loss,
+                          bool classification,
+                          int nbr_threads);
+
 char *nn_model_to_str(const nn_model *model, char *string);
 void nn_model_print(const nn_model *model);
 
 size_t nn_model_nbr_param(const nn_model *model);
+// copies the nn_model_nbr_param weights and biases, layer by layer (w row-major, then b),
+// into param / back from it
+FLT_TYP *nn_model_get_param(const nn_model *model, FLT_TYP *param);
+nn_model *nn_model_set_param(nn_model *model, const FLT_TYP *param);
 
 size_t nn_model_serial_size(const nn_model *model);
 // returns a pointer to the byte after the last written byte
@@ -72,8 +194,36 @@ uint8_t *nn_model_serialize(const nn_model *model, uint8_t *byte_arr);
 // returns a pointer to the byte after the last read byte
 const uint8_t *nn_model_deserialize(nn_model *model, const uint8_t *byte_arr);
 
-void nn_model_save(const nn_model *model, const char *file_path);
+// Model file: a versioned header, one record per layer (sizes, activation, dropout and the
+// offsets of its tensors) and the parameters in the packed layout (nn_model_param_layout)
+// at a NN_MODEL_PARAM_ALIGN aligned file offset.
+// Saving streams the tensors from their buffers into a temporary file renamed over file_path
+// once it is complete; returns 0 on success, -1 (logged, file_path untouched) otherwise.
+int nn_model_save(const nn_model *model, const char *file_path);
+// reads model files and the byte stream of nn_model_serialize written by former versions;
+// the loaded model is packed. Returns NULL (logged, model left null) if the file can't be
+// read or is not a valid model file (the former format is only checked for its size).
 nn_model *nn_model_load(nn_model *model, const char *file_path);
-
-// Merges identically structured models
-// int nn_model_merge(nn_model *result, const nn_model *model_arr[], FLT_TYP weight_arr[]);
+// Zero-copy load of a model file: weight and bias are views into a read-only shared mapping
+// of the file, so processes serving the same file share its pages. Training or re-initializing
+// the model first copies its parameters into memory (nn_model_pack). Returns NULL (logged)
+// if the file is not a valid model file.
+nn_model *nn_model_mmap(nn_model *model, const char *file_path);
+bool nn_model_is_mapped(const nn_model *model);
+// The model file in memory, e.g. to embed it in another file: nn_model_file_serialize writes
+// the nn_model_file_size bytes of the file and returns a pointer to the byte after them;
+// nn_model_file_deserialize checks size bytes like nn_model_load checks a file and constructs
+// a packed model, NULL (logged, model left null) if they are not a valid model file.
+size_t nn_model_file_size(const nn_model *model);
+uint8_t *nn_model_file_serialize(const nn_model *model, uint8_t *byte_arr);
+nn_model *nn_model_file_deserialize(nn_model *model, const uint8_t *byte_arr, size_t size);
+
+// Weighted average of the parameters of identically structured models (input size, layer sizes
+// and activations), e.g. replicas trained on disjoint shards: the weights and biases of result
+// become sum_k weight_arr[k] * model_arr[k] / sum_k weight_arr[k] (weight_arr NULL: equal
+// weights). result may be one of the models; a result that is nn_model_NULL is constructed
+// as a copy of model_arr[0]. Runs on nbr_threads threads (<= 0: one per core); the result
+// does not depend on nbr_threads. Returns 0 on success, -1 (logged, result unchanged) if the
+// structures differ or the weights do not sum up to a positive value.
+int nn_model_merge(nn_model *result, const nn_model *const model_arr[], const FLT_TYP weight_arr[],
+                   int nbr_models, int nbr_threads);
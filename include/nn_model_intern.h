@@ -5,6 +5,7 @@
 #include "nn_config.h"
 #include "lin_alg.h"
 #include "nn_layer.h"
+#include "nn_prof.h"
 
 typedef struct nn_model_intern
 {
@@ -13,11 +14,25 @@ typedef struct nn_model_intern
     vec *d_b;
     vec *s;
     vec *a;
-    vec *a_mask;
+    // per layer dropout masks of the layer's input, bitsets with one row
+    // per sample (see nn_dense.h); max(batch_cap, 1) rows
+    uint64_t **a_mask;
     vec a_inp;
+    // mini-batch buffers; row-major with batch_cap rows
+    IND_TYP batch_cap;
+    payload *s_bt;    // per layer: batch_cap x out_sz
+    payload *a_bt;    // per layer: batch_cap x out_sz
+    payload a_inp_bt; // batch_cap x inp_size
+    payload err_bt;   // batch_cap x max width; error backpropagated to a layer's output
+    payload dlt_bt;   // batch_cap x max width; error at a layer's pre-activation
+    // packed gradients (nn_model_pack): d_w, d_b are views into grad
+    payload grad;
+    // counters of this thread while training (NN_PROF builds), NULL otherwise
+    nn_prof *prof;
 } nn_model_intern;
 
-#define nn_model_intern_NULL ((const nn_model_intern){.nbr_layers = 0, .d_w = NULL, .d_b = NULL, .s = NULL, .a = NULL, .a_mask = NULL})
+#define nn_model_intern_NULL ((const nn_model_intern){.nbr_layers = 0, .d_w = NULL, .d_b = NULL, .s = NULL, .a = NULL, .a_mask = NULL, \
+                                                      .batch_cap = 0, .s_bt = NULL, .a_bt = NULL, .prof = NULL})
 
 nn_model_intern *nn_model_intern_construct(nn_model_intern *intern, int layer_capacity, IND_TYP inp_size);
 
@@ -26,4 +41,23 @@ void nn_model_intern_destruct(nn_model_intern *intern);
 nn_model_intern *nn_model_intern_add(nn_model_intern *intern, const nn_layer *layer, IND_TYP input_size);
 nn_model_intern *nn_model_intern_remove(nn_model_intern *intern, int layer_index);
 
-void nn_model_reset_gradients(nn_model_intern *intern);
\ No newline at end of file
+// makes sure the batch buffers can hold batch_size rows;
+// adding or removing layers releases them
+nn_model_intern *nn_model_intern_reserve_batch(nn_model_intern *intern, IND_TYP batch_size);
+
+// moves the gradients into one zero padded buffer of grad_size with layer l's d_w and d_b
+// at w_off[l] and b_off[l]; adding or removing layers unpacks them again
+nn_model_intern *nn_model_intern_pack(nn_model_intern *intern, IND_TYP grad_size,
+                                      const IND_TYP *w_off, const IND_TYP *b_off);
+bool nn_model_intern_is_packed(const nn_model_intern *intern);
+
+// moves the values of m (v) into pyl at off and makes it a view of pyl
+void nn_model_mat_pack(mat *m, payload *pyl, IND_TYP off);
+void nn_model_vec_pack(vec *v, payload *pyl, IND_TYP off);
+// gives a view storage of its own holding the same values
+void nn_model_mat_unpack(mat *m);
+void nn_model_vec_unpack(vec *v);
+
+void nn_model_reset_gradients(nn_model_intern *intern);
+// intern->d_w, d_b += src->d_w, d_b
+void nn_model_add_gradients(nn_model_intern *intern, const nn_model_intern *src);
\ No newline at end of file
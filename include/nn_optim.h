@@ -1,6 +1,9 @@
 #ifndef NN_OPTIM_H_INCLUDED
 #define NN_OPTIM_H_INCLUDED 1
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "nn_config.h"
 // #include "nn_model.h"
 
@@ -17,6 +20,11 @@ typedef nn_model *(*nn_optim_update_model_func)(nn_optim *optimizer, nn_model *m
 typedef nn_optim *(*nn_optim_construct_func)(nn_optim *optimizer, const nn_model *model);
 typedef nn_optim *(*nn_optim_set_params_func)(nn_optim *optimizer, const void *params);
 typedef void (*nn_optim_destruct_func)(nn_optim *optimizer);
+// params and state (e.g. moments, step count) of the optimizer, for checkpoints
+typedef size_t (*nn_optim_serial_size_func)(const nn_optim *optimizer);
+typedef uint8_t *(*nn_optim_serialize_func)(const nn_optim *optimizer, uint8_t *byte_arr);
+// into an optimizer constructed for the same model; NULL if the size bytes don't fit it
+typedef const uint8_t *(*nn_optim_deserialize_func)(nn_optim *optimizer, const uint8_t *byte_arr, size_t size);
 
 struct nn_optim_class
 {
@@ -24,10 +32,15 @@ struct nn_optim_class
     nn_optim_construct_func construct;
     nn_optim_set_params_func set_params;
     nn_optim_destruct_func destruct;
+    // optional; a class without them has no state to checkpoint
+    nn_optim_serial_size_func serial_size;
+    nn_optim_serialize_func serialize;
+    nn_optim_deserialize_func deserialize;
 };
 
 #define nn_optim_class_NULL \
-((const nn_optim_class){.update_model = NULL, .construct = NULL, .set_params = NULL, .destruct = NULL})
+((const nn_optim_class){.update_model = NULL, .construct = NULL, .set_params = NULL, .destruct = NULL, \
+                        .serial_size = NULL, .serialize = NULL, .deserialize = NULL})
 
 struct nn_optim
 {
@@ -42,5 +55,12 @@ nn_optim *nn_optim_construct(nn_optim *optimizer, const nn_optim_class *optim_cl
 nn_optim *nn_optim_set_params(nn_optim *optimizer, const void *params);
 void nn_optim_destruct(nn_optim *optimizer);
 nn_model *nn_optim_update_model(nn_optim *optimizer, nn_model *model);
+size_t nn_optim_serial_size(const nn_optim *optimizer);
+// returns a pointer to the byte after the last written byte
+uint8_t *nn_optim_serialize(const nn_optim *optimizer, uint8_t *byte_arr);
+// restores the state of nn_optim_serialize (size bytes) into an optimizer of the same class
+// constructed for the same model; returns a pointer to the byte after the last read byte,
+// NULL (logged, optimizer unchanged or partly restored) if the bytes don't fit it
+const uint8_t *nn_optim_deserialize(nn_optim *optimizer, const uint8_t *byte_arr, size_t size);
 
 #endif /* NN_OPTIM_H_INCLUDED */
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <threads.h>
+
+#include "nn_config.h"
+
+// Minimal fork-join helpers on top of C11 threads.
+
+typedef int (*nn_par_func)(void *arg);
+
+// nbr of online processors (>= 1)
+int nn_par_nbr_cores(void);
+
+// effective nbr of threads for nbr_tasks independent tasks;
+// nbr_threads <= 0 means one per online processor
+int nn_par_nbr_threads(int nbr_threads, IND_TYP nbr_tasks);
+
+// Runs func on (char *)args + t * arg_size for t = 0 .. nbr_threads - 1 concurrently
+// and waits for all of them; t = 0 runs on the calling thread.
+// Returns the nbr of calls that did not return 0, or -1 (logged) without calling func at all
+// if not all threads could be created (the caller may retry with fewer threads).
+int nn_par_run(int nbr_threads, nn_par_func func, void *args, size_t arg_size);
+// nn_par_run for tasks that don't wait on each other: if the threads can't be created,
+// the tasks run one after the other on the calling thread.
+int nn_par_run_tasks(int nbr_threads, nn_par_func func, void *args, size_t arg_size);
+
+// reusable barrier for the threads of one nn_par_run
+typedef struct nn_par_barrier
+{
+    mtx_t mtx;
+    cnd_t cnd;
+    int nbr_threads;
+    int count;
+    unsigned long generation;
+} nn_par_barrier;
+
+// returns 0 on success
+int nn_par_barrier_init(nn_par_barrier *barrier, int nbr_threads);
+void nn_par_barrier_destroy(nn_par_barrier *barrier);
+// blocks until nbr_threads threads have called it
+void nn_par_barrier_wait(nn_par_barrier *barrier);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "data_points.h"
+
+// Background producer of the mini-batches of a training run. A thread walks the epochs
+// in order (shuffling the data indices at each epoch start, as training does) and gathers
+// the rows of the next mini-batch, features, targets and data weights, into one of two
+// contiguous staging buffers while the consumer trains on the other one.
+
+typedef struct nn_prefetch_batch
+{
+    IND_TYP nbr_rows;
+    const FLT_TYP *x;      // nbr_rows x x_sly.len
+    const FLT_TYP *trg;    // nbr_rows x trg_sly.len
+    const FLT_TYP *weight; // nbr_rows; NULL without data weights
+} nn_prefetch_batch;
+
+typedef struct nn_prefetch
+{
+    const data_points *data_x;
+    slice x_sly;
+    const data_points *data_trg;
+    slice trg_sly;
+    const vec *data_weight;
+    slice index_sly;
+    IND_TYP batch_size;
+    int first_epoch, nbr_epochs;
+    bool shuffle;
+    uint64_t seed;
+    IND_TYP *ind;
+
+    FLT_TYP *x[2];
+    FLT_TYP *trg[2];
+    FLT_TYP *weight[2];
+    nn_prefetch_batch batch[2];
+    int state[2]; // free, filled or in use
+    long nbr_acquired;
+    bool stop;
+    mtx_t mtx;
+    cnd_t cnd;
+    thrd_t thrd;
+} nn_prefetch;
+
+// Starts the producer on the epochs first_epoch .. nbr_epochs - 1, shuffled as by
+// rnd_shuffle_epoch with seed; x_sly, trg_sly and index_sly must be regulated.
+// Returns NULL (logged) if the thread can't be started.
+nn_prefetch *nn_prefetch_start(nn_prefetch *pf,
+                               const data_points *data_x, slice x_sly,
+                               const data_points *data_trg, slice trg_sly,
+                               const vec *data_weight,
+                               slice index_sly,
+                               IND_TYP batch_size,
+                               int first_epoch,
+                               int nbr_epochs,
+                               bool shuffle,
+                               uint64_t seed);
+// the next mini-batch in training order; waits for it if needed
+const nn_prefetch_batch *nn_prefetch_acquire(nn_prefetch *pf);
+// the consumer is done with the batch of the last acquire
+void nn_prefetch_release(nn_prefetch *pf);
+// stops the producer (also before the last batch) and frees the buffers
+void nn_prefetch_stop(nn_prefetch *pf);
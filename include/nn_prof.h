@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nn_config.h"
+
+// Training counters: time, FLOPs and bytes touched per phase, in total and per layer.
+// The counting code in the training loop is only compiled in with -DNN_PROF; without it
+// the counters stay 0 and cost nothing. FLOPs and bytes are nominal (from the sizes of
+// the operands, no cache effects); optimizer FLOPs depend on the class and are not counted.
+
+enum nn_prof_phase
+{
+    NN_PROF_GATHER,    // mini-batch rows into the batch buffer
+    NN_PROF_DROPOUT,   // dropout mask generation
+    NN_PROF_RESET,     // gradient reset
+    NN_PROF_FORWARD,   // per layer: GEMM + bias (+ activation when fused)
+    NN_PROF_ACTIV,     // per layer: stand-alone activation and dropout masking
+    NN_PROF_LOSS,      // loss derivative
+    NN_PROF_BACKWARD,  // per layer: delta, error backpropagation and gradients
+    NN_PROF_REDUCE,    // sum of the per-thread gradients
+    NN_PROF_ALLREDUCE, // sum of the gradients of the ranks (nn_dist)
+    NN_PROF_OPTIM,     // optimizer update
+    NN_PROF_NBR_PHASES
+};
+
+typedef struct nn_prof_counter
+{
+    uint64_t ns;
+    uint64_t calls;
+    double flop;
+    double bytes;
+} nn_prof_counter;
+
+typedef struct nn_prof
+{
+    int nbr_layers;
+    nn_prof_counter total[NN_PROF_NBR_PHASES];
+    // nbr_layers x NN_PROF_NBR_PHASES; only the per layer phases are counted
+    nn_prof_counter *layer;
+} nn_prof;
+
+#define nn_prof_NULL ((const nn_prof){.nbr_layers = 0, .layer = NULL})
+
+nn_prof *nn_prof_construct(nn_prof *prof, int nbr_layers);
+void nn_prof_destruct(nn_prof *prof);
+void nn_prof_reset(nn_prof *prof);
+
+// monotonic clock in ns
+uint64_t nn_prof_now(void);
+// adds one call of phase to the totals and, for layer >= 0, to the layer's counters
+void nn_prof_add(nn_prof *prof, int layer, enum nn_prof_phase phase, uint64_t ns, double flop, double bytes);
+// dst += src; src must have the same nbr of layers
+void nn_prof_merge(nn_prof *dst, const nn_prof *src);
+
+const char *nn_prof_phase_str(enum nn_prof_phase phase);
+char *nn_prof_to_str(const nn_prof *prof, char *string, size_t size);
+void nn_prof_print(const nn_prof *prof);
+
+#ifdef NN_PROF
+#define NN_PROF_START(t) uint64_t t = nn_prof_now()
+#define NN_PROF_STOP(prof, t, layer, phase, flop, bytes)                                          \
+    do                                                                                            \
+    {                                                                                             \
+        if (prof)                                                                                 \
+            nn_prof_add((prof), (layer), (phase), nn_prof_now() - (t), (double)(flop), (double)(bytes)); \
+    } while (0)
+#else
+#define NN_PROF_START(t) ((void)0)
+#define NN_PROF_STOP(prof, t, layer, phase, flop, bytes) ((void)0)
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nn_config.h"
+#include "lin_alg.h"
+#include "nn_model.h"
+
+// Int8 inference copy of a trained nn_model. Weights are stored as int8 with one scale
+// per output row; a layer input is quantized per sample (symmetric, one scale per row)
+// right before the layer. Dot products accumulate in int32 and are dequantized together
+// with the float bias and the activation.
+// The kernel is picked at run time: u8 x s8 vpdpbusd on CPUs with AVX-VNNI or AVX512-VNNI
+// (the activations offset by 128, corrected with the row sums of the weights), int16
+// vpmaddwd on AVX2, portable C otherwise; all give the same int32 sums.
+
+// weight rows are zero padded to a multiple of this
+#define NN_QMODEL_ROW_ALIGN 32
+
+typedef struct nn_qlayer
+{
+    IND_TYP out_sz;
+    IND_TYP inp_sz;
+    IND_TYP inp_pad; // row length of w
+    int8_t *w;       // out_sz x inp_pad
+    float *w_scale;  // out_sz; weight[o][i] ~ w_scale[o] * w[o][i]
+    int32_t *w_sum;  // out_sz; sum of the row w[o]
+    FLT_TYP *bias;   // out_sz
+    nn_activ activ;
+} nn_qlayer;
+
+typedef struct nn_qmodel
+{
+    IND_TYP input_size;
+    IND_TYP ouput_size;
+    IND_TYP max_width;
+    int nbr_layers;
+    nn_qlayer *layer;
+} nn_qmodel;
+
+#define nn_qmodel_NULL ((const nn_qmodel){.input_size = 0, .ouput_size = 0, .max_width = 0, .nbr_layers = 0, .layer = NULL})
+
+// qmodel must be nn_qmodel_NULL; the float model is only read
+nn_qmodel *nn_model_quantize(nn_qmodel *qmodel, const nn_model *model);
+void nn_qmodel_destruct(nn_qmodel *qmodel);
+
+// bytes taken by the int8 weights, their scales and row sums
+size_t nn_qmodel_weight_bytes(const nn_qmodel *qmodel);
+
+// Inference context of a quantized model, as nn_infer_ctx for nn_model
+typedef struct nn_qinfer_ctx
+{
+    IND_TYP input_size;
+    IND_TYP max_width;
+    IND_TYP batch_cap;
+    payload inp;    // batch_cap x input_size
+    payload buf[2]; // batch_cap x max_width
+    int8_t *q;      // batch_cap x padded width; quantized layer input
+    float *q_scale; // batch_cap
+} nn_qinfer_ctx;
+
+#define nn_qinfer_ctx_NULL ((const nn_qinfer_ctx){.input_size = 0, .max_width = 0, .batch_cap = 0, .q = NULL, .q_scale = NULL})
+
+nn_qinfer_ctx *nn_qinfer_ctx_construct(nn_qinfer_ctx *ctx, const nn_qmodel *qmodel, IND_TYP batch_cap);
+void nn_qinfer_ctx_destruct(nn_qinfer_ctx *ctx);
+FLT_TYP *nn_qinfer_ctx_input(nn_qinfer_ctx *ctx);
+
+// forwards the first nbr_rows rows of the ctx input; returns the row-major outputs
+const FLT_TYP *nn_qmodel_infer_batch(const nn_qmodel *qmodel, nn_qinfer_ctx *ctx, IND_TYP nbr_rows);
+vec *nn_qmodel_infer(const nn_qmodel *qmodel, nn_qinfer_ctx *ctx, const vec *input, vec *output);
+
+// same measure as nn_model_eval, for the quantized model
+FLT_TYP nn_qmodel_eval(const nn_qmodel *qmodel,
+                       const data_points *data_x, slice x_sly,
+                       const data_points *data_trg, slice trg_sly,
+                       const vec *data_weight,
+                       slice index_sly,
+                       const nn_loss loss,
+                       bool classification);
+
+typedef struct nn_qmodel_report
+{
+    IND_TYP nbr_samples;
+    FLT_TYP loss_float;       // nn_model_eval of the float model
+    FLT_TYP loss_quant;       // nn_qmodel_eval of the quantized one
+    FLT_TYP max_abs_diff;     // largest difference of an output between the two
+    FLT_TYP mean_abs_diff;    // mean over all outputs
+    FLT_TYP argmax_agreement; // fraction of samples whose largest output is the same
+    size_t float_bytes;       // weights and biases of the float model
+    size_t quant_bytes;       // nn_qmodel_weight_bytes + biases
+} nn_qmodel_report;
+
+// compares the quantized model with its float model on a calibration set
+nn_qmodel_report *nn_qmodel_compare(nn_qmodel_report *report,
+                                    const nn_qmodel *qmodel, const nn_model *model,
+                                    const data_points *data_x, slice x_sly,
+                                    const data_points *data_trg, slice trg_sly,
+                                    slice index_sly,
+                                    const nn_loss loss,
+                                    bool classification);
+void nn_qmodel_report_print(const nn_qmodel_report *report);
@@ -26,3 +26,36 @@ typedef struct flt_rnd_param
 
 FLT_TYP uniform_flt_rnd(const void *param);
 IND_TYP int_rnd(IND_TYP a, IND_TYP b);
+// Fisher-Yates shuffle of ind[0 .. size)
+void rnd_shuffle_ind(IND_TYP *ind, IND_TYP size, uint64_t rnd(void));
+
+// Counter-based stream: the n-th output is a hash of (seed, n), so independent
+// streams (e.g. one per thread) share no state.
+typedef struct rnd_stream
+{
+    uint64_t seed;
+    uint64_t ctr;
+} rnd_stream;
+
+// splitmix64 finalizer
+static inline uint64_t rnd_mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+rnd_stream *rnd_stream_init(rnd_stream *st, uint64_t seed);
+uint64_t rnd_stream_uint64(rnd_stream *st);
+// uniform in [0, 1)
+FLT_TYP rnd_stream_flt(rnd_stream *st);
+// Fisher-Yates shuffle of ind[0 .. size) drawing from st
+void rnd_stream_shuffle_ind(rnd_stream *st, IND_TYP *ind, IND_TYP size);
+// the data order of a training epoch: with seed 0, ind is shuffled further with the
+// global generator; otherwise it is reset to 0 .. size - 1 and shuffled by a stream of
+// (seed, epoch), so the order of any epoch can be reproduced on its own
+void rnd_shuffle_epoch(IND_TYP *ind, IND_TYP size, uint64_t seed, int epoch);
+// fills bits[0 .. (nbr_bits + 63) / 64) so that each of the first nbr_bits bits is set
+// with probability p_one (at 32 bit resolution) and the rest are clear; one hash gives
+// two bits and the hashes are independent of each other, so the loop vectorizes
+void rnd_stream_fill_bits(rnd_stream *st, uint64_t *bits, IND_TYP nbr_bits, FLT_TYP p_one);
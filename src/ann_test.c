@@ -1,12 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "nn.h"
+#include "data_points_csv.h"
 #include "log.h"
+#include "rnd.h"
 
 static inline FLT_TYP flt_rnd(void)
 {
@@ -100,6 +110,831 @@ void gen_cat_data(data_points *x, data_points *trg)
     mat_destruct(&lbl_m);
 }
 
+static void cmp_sync_async(const nn_model *model, data_points *x, data_points *trg, slice dt_sly,
+                           IND_TYP batch_sz, int nbr_ep, nn_loss loss)
+{
+    size_t sz = nn_model_serial_size(model);
+    uint8_t *bytes = malloc(sz);
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    // sync, sync with prefetching, async
+    for (int mode = 0; mode < 3; mode++)
+    {
+        nn_model cp = nn_model_NULL;
+        nn_model_deserialize(&cp, bytes);
+        // trains on a single parameter and gradient buffer
+        nn_model_pack(&cp);
+        nn_optim opt;
+        nn_optim_construct(&opt, &nn_optim_cls_SGD, &cp);
+        nn_optim_cls_SGD_params sgd_p = {.learning_rate = 0.0001f};
+        nn_optim_set_params(&opt, &sgd_p);
+        nn_model_train_stats stats;
+        nn_model_train_params params = nn_model_train_params_DEFAULT;
+        params.nbr_threads = 4;
+        params.async = (mode == 2);
+        params.prefetch = (mode == 1);
+        params.stats = &stats;
+        params.stats_final_loss = true;
+        nn_model_train_with(&cp, x, slice_NONE, trg, slice_NONE, NULL, dt_sly, batch_sz, nbr_ep, true, &opt, loss, &params);
+        static const char *const mode_str[] = {"    Sync", "Prefetch", "   Async"};
+        printf("%s SGD, 4 threads: %.0f samples/s, final train loss %f\n",
+               mode_str[mode], stats.samples_per_sec, stats.final_loss);
+        nn_optim_destruct(&opt);
+        nn_model_destruct(&cp);
+    }
+    free(bytes);
+}
+
+// largest difference of the parameters of two models; -1 if they differ in structure
+static FLT_TYP param_dif(const nn_model *a, const nn_model *b)
+{
+    size_t n = nn_model_nbr_param(a);
+    if (a->nbr_layers != b->nbr_layers || a->input_size != b->input_size || n != nn_model_nbr_param(b))
+        return -1;
+    for (int l = 0; l < a->nbr_layers; l++)
+        if (a->layer[l].out_sz != b->layer[l].out_sz ||
+            nn_activ_to_enum(&a->layer[l].activ) != nn_activ_to_enum(&b->layer[l].activ))
+            return -1;
+    FLT_TYP *pa = malloc(2 * n * sizeof(FLT_TYP));
+    assert(pa);
+    FLT_TYP *pb = pa + n;
+    nn_model_get_param(a, pa);
+    nn_model_get_param(b, pb);
+    FLT_TYP dif = 0;
+    for (size_t i = 0; i < n; i++)
+        dif = fmax(dif, fabs(pa[i] - pb[i]));
+    free(pa);
+    return dif;
+}
+
+#ifdef NN_PROF
+// a profiled training run of a copy of model (make test_prof): the forward, backward and
+// optimizer counters, in total and for each layer where counted per layer, must be set
+static void cmp_prof(const nn_model *model, data_points *x, data_points *trg, slice dt_sly, int batch_sz,
+                     nn_loss loss)
+{
+    size_t sz = nn_model_serial_size(model);
+    uint8_t *bytes = malloc(sz);
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    nn_model copy = nn_model_NULL;
+    nn_model_deserialize(&copy, bytes);
+    free(bytes);
+    nn_optim opt;
+    nn_optim_construct(&opt, &nn_optim_cls_ADAM, &copy);
+    nn_prof prof;
+    nn_prof_construct(&prof, copy.nbr_layers);
+    nn_model_train_params params = nn_model_train_params_DEFAULT;
+    params.nbr_threads = 2;
+    params.prof = &prof;
+    nn_model_train_with(&copy, x, slice_NONE, trg, slice_NONE, NULL, dt_sly, batch_sz, 2, true, &opt, loss, &params);
+    static const enum nn_prof_phase phase_arr[] = {NN_PROF_FORWARD, NN_PROF_BACKWARD, NN_PROF_OPTIM};
+    int nbr_unset = 0;
+    for (int p = 0; p < 3; p++)
+    {
+        const nn_prof_counter *tot = prof.total + phase_arr[p];
+        nbr_unset += tot->calls == 0 || tot->bytes <= 0 || (phase_arr[p] != NN_PROF_OPTIM && tot->flop <= 0);
+        for (int l = 0; l < prof.nbr_layers && phase_arr[p] != NN_PROF_OPTIM; l++)
+            nbr_unset += prof.layer[l * NN_PROF_NBR_PHASES + phase_arr[p]].calls == 0;
+    }
+    printf("Profiled training: %d forward, backward or optim counters unset\n", nbr_unset);
+    nn_prof_destruct(&prof);
+    nn_optim_destruct(&opt);
+    nn_model_destruct(&copy);
+}
+#endif
+
+// nn_model_merge of model and a re-initialized copy with the weights 1 and 3 against the
+// average computed here, into a null result and into the first model itself; then a merge
+// with a model of another structure and one with weights summing up to 0 must fail and leave
+// the result unchanged
+static void cmp_merge(const nn_model *model)
+{
+    size_t sz = nn_model_serial_size(model);
+    uint8_t *bytes = malloc(sz);
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    nn_model m0 = nn_model_NULL, m1 = nn_model_NULL;
+    nn_model_deserialize(&m0, bytes);
+    nn_model_deserialize(&m1, bytes);
+    nn_model expect = nn_model_NULL;
+    nn_model_deserialize(&expect, bytes);
+    free(bytes);
+    nn_model_init_uniform_rnd(&m1, 0.5, 0.1);
+
+    size_t n = nn_model_nbr_param(model);
+    FLT_TYP *p0 = malloc(3 * n * sizeof(FLT_TYP));
+    assert(p0);
+    FLT_TYP *p1 = p0 + n, *avg = p1 + n;
+    nn_model_get_param(&m0, p0);
+    nn_model_get_param(&m1, p1);
+    for (size_t i = 0; i < n; i++)
+        avg[i] = (p0[i] + 3 * p1[i]) / 4;
+    nn_model_set_param(&expect, avg);
+
+    const nn_model *const model_arr[] = {&m0, &m1};
+    const FLT_TYP weight_arr[] = {1, 3};
+    nn_model merged = nn_model_NULL;
+    FLT_TYP dif_null = -1, dif_alias = -1;
+    if (nn_model_merge(&merged, model_arr, weight_arr, 2, 3) == 0)
+        dif_null = param_dif(&merged, &expect);
+    if (nn_model_merge(&m0, model_arr, weight_arr, 2, 1) == 0)
+        dif_alias = param_dif(&m0, &expect);
+    printf("nn_model_merge max param diff to the weighted average: into a null result %g, into the first model %g\n",
+           dif_null, dif_alias);
+
+    // merged holds the average now
+    nn_model other = nn_model_NULL;
+    nn_model_construct(&other, 1, model->input_size);
+    nn_layer lay = model->layer[model->nbr_layers - 1];
+    nn_model_append(&other, &lay);
+    nn_model_init_uniform_rnd(&other, 0.1, 0);
+    const nn_model *const mismatch_arr[] = {&m1, &other};
+    const FLT_TYP zero_sum_arr[] = {1, -1};
+    bool failed_mismatch = nn_model_merge(&merged, mismatch_arr, NULL, 2, 1) == -1 && param_dif(&merged, &expect) == 0;
+    bool failed_zero_sum = nn_model_merge(&merged, model_arr, zero_sum_arr, 2, 1) == -1 && param_dif(&merged, &expect) == 0;
+    printf("nn_model_merge refused, result unchanged: other structure %s, weights summing up to 0 %s\n",
+           failed_mismatch ? "yes" : "no", failed_zero_sum ? "yes" : "no");
+
+    nn_model_destruct(&other);
+    nn_model_destruct(&merged);
+    nn_model_destruct(&expect);
+    nn_model_destruct(&m1);
+    nn_model_destruct(&m0);
+    free(p0);
+}
+
+// nn_model_save, then nn_model_load and nn_model_mmap, and nn_model_load of a file written
+// by nn_model_serialize (the former file format)
+static void cmp_save_load(const nn_model *model)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ann_test_%d_model.nn", (int)getpid());
+    FLT_TYP dif_load = -1, dif_mmap = -1, dif_legacy = -1;
+    if (nn_model_save(model, path) == 0)
+    {
+        nn_model loaded = nn_model_NULL, mapped = nn_model_NULL;
+        nn_model_load(&loaded, path);
+        dif_load = param_dif(model, &loaded);
+        if (nn_model_mmap(&mapped, path))
+            dif_mmap = param_dif(model, &mapped);
+        nn_model_destruct(&mapped);
+        nn_model_destruct(&loaded);
+    }
+    size_t sz = nn_model_serial_size(model);
+    uint8_t *bytes = malloc(sz);
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    FILE *f = fopen(path, "wb");
+    assert(f);
+    fwrite(bytes, 1, sz, f);
+    fclose(f);
+    nn_model legacy = nn_model_NULL;
+    nn_model_load(&legacy, path);
+    dif_legacy = param_dif(model, &legacy);
+    nn_model_destruct(&legacy);
+    free(bytes);
+    printf("Max param diff after save (-1: differs in structure): load %g, mmap %g, legacy file load %g\n",
+           dif_load, dif_mmap, dif_legacy);
+
+    // damaged files: another version, a layer size beyond the parameters, the parameters cut
+    // short, a legacy stream cut short, and no file
+    int nbr_refused = 0, nbr_damaged = 5;
+    for (int k = 0; k < nbr_damaged; k++)
+    {
+        if (k < 4)
+        {
+            nn_model_save(model, path);
+            f = fopen(path, "r+b");
+            assert(f);
+            // the version follows the 8 byte magic, the first layer record the 64 byte header
+            uint32_t version = 99;
+            uint64_t out_sz = (uint64_t)1 << 40;
+            fseek(f, (k == 0) ? 8 : 64, SEEK_SET);
+            if (k == 0)
+                fwrite(&version, sizeof(version), 1, f);
+            else if (k == 1)
+                fwrite(&out_sz, sizeof(out_sz), 1, f);
+            fseek(f, 0, SEEK_END);
+            long size = ftell(f);
+            fclose(f);
+            if (k == 2)
+                truncate(path, size - 4);
+            else if (k == 3)
+            {
+                // a legacy stream claiming more bytes than the file has
+                f = fopen(path, "wb");
+                assert(f);
+                size_t sz_claimed = 1000000;
+                fwrite(&sz_claimed, sizeof(sz_claimed), 1, f);
+                fwrite(&sz_claimed, sizeof(sz_claimed), 1, f);
+                fclose(f);
+            }
+        }
+        else
+            remove(path);
+        nn_model damaged = nn_model_NULL;
+        nbr_refused += nn_model_load(&damaged, path) == NULL && nn_model_is_null(&damaged);
+        nn_model_destruct(&damaged);
+    }
+    remove(path);
+    printf("nn_model_load of damaged or missing files: %d of %d refused\n", nbr_refused, nbr_damaged);
+}
+
+// data_points_save and data_points_mmap of the inputs and targets: the mapped rows against
+// the written ones, eval on the mappings against eval in memory, and damaged files
+static void cmp_data_points_file(const nn_model *model, data_points *x, data_points *trg, slice tst_sly, nn_loss loss)
+{
+    char x_path[64], trg_path[64];
+    snprintf(x_path, sizeof(x_path), "/tmp/ann_test_%d_x.dat", (int)getpid());
+    snprintf(trg_path, sizeof(trg_path), "/tmp/ann_test_%d_trg.dat", (int)getpid());
+    data_points map_x = data_points_NULL, map_trg = data_points_NULL;
+    long nbr_dif = -1;
+    FLT_TYP err_mem = -1, err_map = -2;
+    if (data_points_save(x, x_path) == 0 && data_points_save(trg, trg_path) == 0 &&
+        data_points_mmap(&map_x, x_path, NN_MAP_SEQUENTIAL) && data_points_mmap(&map_trg, trg_path, NN_MAP_SEQUENTIAL))
+    {
+        nbr_dif = (map_x.width != x->width || map_x.nbr_points != x->nbr_points ||
+                   map_trg.width != trg->width || map_trg.nbr_points != trg->nbr_points);
+        for (IND_TYP i = 0; i < x->nbr_points && nbr_dif == 0; i++)
+        {
+            nbr_dif += memcmp(data_points_ptr_at(&map_x, i), data_points_ptr_at(x, i), x->width * sizeof(FLT_TYP)) != 0 ||
+                       memcmp(data_points_ptr_at(&map_trg, i), data_points_ptr_at(trg, i), trg->width * sizeof(FLT_TYP)) != 0;
+        }
+        err_mem = nn_model_eval(model, x, slice_NONE, trg, slice_NONE, NULL, tst_sly, loss, false);
+        err_map = nn_model_eval(model, &map_x, slice_NONE, &map_trg, slice_NONE, NULL, tst_sly, loss, false);
+    }
+    printf("data_points_mmap of saved data: %ld rows differ, eval on the mapping %s\n", nbr_dif,
+           (err_map == err_mem) ? "equal" : "differs");
+    if (data_points_is_mapped(&map_x))
+        data_points_destruct(&map_x);
+    if (data_points_is_mapped(&map_trg))
+        data_points_destruct(&map_trg);
+    remove(trg_path);
+
+    // damaged files: another magic, another sizeof(FLT_TYP), the rows cut short
+    int nbr_refused = 0, nbr_damaged = 3;
+    for (int k = 0; k < nbr_damaged; k++)
+    {
+        data_points_save(x, x_path);
+        FILE *f = fopen(x_path, "r+b");
+        assert(f);
+        // the FLT_TYP size follows the 8 byte magic and the 4 byte version
+        uint32_t flt_size = 2 * sizeof(FLT_TYP);
+        fseek(f, (k == 0) ? 0 : 12, SEEK_SET);
+        if (k == 0)
+            fputc('X', f);
+        else if (k == 1)
+            fwrite(&flt_size, sizeof(flt_size), 1, f);
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fclose(f);
+        if (k == 2)
+            truncate(x_path, size - 4);
+        data_points damaged = data_points_NULL;
+        if (data_points_mmap(&damaged, x_path, NN_MAP_SEQUENTIAL) == NULL)
+            nbr_refused++;
+        else
+            data_points_destruct(&damaged);
+    }
+    remove(x_path);
+    printf("data_points_mmap of damaged files: %d of %d refused\n", nbr_refused, nbr_damaged);
+}
+
+// rows nbr_rows x width with the values 0, 1, 2, ... row-major
+static void gen_index_data(data_points *dtpts, IND_TYP nbr_rows, IND_TYP width)
+{
+    data_points_construct(dtpts, width, nbr_rows);
+    dtpts->nbr_points = nbr_rows;
+    for (IND_TYP i = 0; i < nbr_rows * width; i++)
+        *payload_at(&dtpts->payload, i) = (FLT_TYP)i;
+}
+
+// data_points_shuffle against the row swaps of the former Fisher-Yates shuffle drawing from
+// the same generator state, which a forked child has; and data_points_permute of a random
+// permutation of a strided slice, staged and in place (data_points_set_permute_max_stage 0),
+// against gathering the rows here
+static void cmp_permute(void)
+{
+    const IND_TYP nbr_rows = 10007, width = 3;
+    data_points orig, shuffled, staged, in_place;
+    gen_index_data(&orig, nbr_rows, width);
+    gen_index_data(&shuffled, nbr_rows, width);
+    gen_index_data(&staged, nbr_rows, width);
+    gen_index_data(&in_place, nbr_rows, width);
+    IND_TYP *perm = malloc(nbr_rows * sizeof(IND_TYP));
+    assert(perm);
+    // the fork first, before data_points_permute starts threads
+    int fd[2];
+    if (pipe(fd) != 0)
+        abort();
+    fflush(NULL);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        close(fd[0]);
+        for (IND_TYP i = 0; i < nbr_rows; i++)
+            perm[i] = i;
+        for (IND_TYP i = 0; i < nbr_rows - 1; i++)
+        {
+            IND_TYP l = i + (IND_TYP)(UINT_RND_GEN() % (nbr_rows - i));
+            IND_TYP tmp = perm[i];
+            perm[i] = perm[l];
+            perm[l] = tmp;
+        }
+        size_t sz = nbr_rows * sizeof(IND_TYP);
+        for (size_t off = 0; off < sz;)
+        {
+            ssize_t n = write(fd[1], (uint8_t *)perm + off, sz - off);
+            if (n <= 0)
+                _exit(1);
+            off += n;
+        }
+        _exit(0);
+    }
+    close(fd[1]);
+    data_points_shuffle(&shuffled, slice_NONE);
+    size_t sz = nbr_rows * sizeof(IND_TYP), off = 0;
+    while (off < sz)
+    {
+        ssize_t n = read(fd[0], (uint8_t *)perm + off, sz - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+    int nbr_dif_shuffle = (off == sz) ? 0 : -1;
+    for (IND_TYP i = 0; i < nbr_rows && nbr_dif_shuffle >= 0; i++)
+        nbr_dif_shuffle += *data_points_ptr_at(&shuffled, i) != (FLT_TYP)(perm[i] * width);
+    printf("data_points_shuffle rows differing from the Fisher-Yates swaps: %d\n", nbr_dif_shuffle);
+
+    slice sly;
+    slice_set(&sly, 5, nbr_rows - 2, 2);
+    slice_regulate(&sly, nbr_rows);
+    for (IND_TYP k = 0; k < sly.len; k++)
+        perm[k] = k;
+    rnd_shuffle_ind(perm, sly.len, UINT_RND_GEN);
+    data_points_permute(&staged, sly, perm, 4);
+    size_t former = data_points_set_permute_max_stage(0);
+    data_points_permute(&in_place, sly, perm, 4);
+    data_points_set_permute_max_stage(former);
+    // rows outside the slice stay
+    int nbr_dif_staged = 0, nbr_dif_in_place = 0;
+    IND_TYP k = 0;
+    for (IND_TYP i = 0; i < nbr_rows; i++)
+    {
+        IND_TYP src = i;
+        if (k < sly.len && i == slice_index(&sly, k))
+            src = slice_index(&sly, perm[k++]);
+        size_t row_sz = width * sizeof(FLT_TYP);
+        nbr_dif_staged += memcmp(data_points_ptr_at(&staged, i), data_points_ptr_at(&orig, src), row_sz) != 0;
+        nbr_dif_in_place += memcmp(data_points_ptr_at(&in_place, i), data_points_ptr_at(&orig, src), row_sz) != 0;
+    }
+    printf("data_points_permute rows differing from a gather: staged %d, in place %d\n", nbr_dif_staged,
+           nbr_dif_in_place);
+
+    free(perm);
+    data_points_destruct(&in_place);
+    data_points_destruct(&staged);
+    data_points_destruct(&shuffled);
+    data_points_destruct(&orig);
+}
+
+// data_points_load_csv of a generated file with a header, CRLF line ends and column slices,
+// of one with a malformed row, and data_points_parse_flt against strtod
+static void cmp_csv(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ann_test_%d_data.csv", (int)getpid());
+    const int nbr_rows = 1000;
+    // columns: x0, skipped, x1, target
+    FILE *f = fopen(path, "wb");
+    assert(f);
+    fprintf(f, "x0,skip,x1,y\r\n");
+    for (int i = 0; i < nbr_rows; i++)
+        fprintf(f, "%g,%d,%.6e,%d\r\n", 0.25 * i - 100, -i, 1e-3 * i, i % 3);
+    fclose(f);
+    data_points_csv_params csv_p = data_points_csv_params_DEFAULT;
+    csv_p.header = true;
+    slice_set(&csv_p.x_sly, 0, 3, 2);
+    slice_set(&csv_p.trg_sly, 3, 4, 1);
+    csv_p.nbr_threads = 4;
+    data_points csv_x = data_points_NULL, csv_trg = data_points_NULL;
+    IND_TYP nbr_loaded = data_points_load_csv(&csv_x, &csv_trg, path, &csv_p);
+    FLT_TYP max_dif = -1;
+    if (nbr_loaded == nbr_rows && csv_x.width == 2 && csv_trg.width == 1)
+    {
+        max_dif = 0;
+        for (int i = 0; i < nbr_rows; i++)
+        {
+            FLT_TYP x[2], y;
+            data_points_copy_at(&csv_x, x, i, NULL);
+            data_points_copy_at(&csv_trg, &y, i, NULL);
+            max_dif = fmax(max_dif, fabs(x[0] - (FLT_TYP)(0.25 * i - 100)));
+            max_dif = fmax(max_dif, fabs(x[1] - (FLT_TYP)(1e-3 * i)));
+            max_dif = fmax(max_dif, fabs(y - (FLT_TYP)(i % 3)));
+        }
+    }
+    printf("CSV load: %ld of %d rows, max diff to the written values %g\n", (long)nbr_loaded, nbr_rows, max_dif);
+    if (nbr_loaded >= 0)
+    {
+        data_points_destruct(&csv_x);
+        data_points_destruct(&csv_trg);
+    }
+
+    f = fopen(path, "wb");
+    assert(f);
+    fprintf(f, "x0,skip,x1,y\r\n1,2,3,4\r\n5,6,7\r\n8,9,10,11\r\n");
+    fclose(f);
+    nbr_loaded = data_points_load_csv(&csv_x, &csv_trg, path, &csv_p);
+    printf("CSV load of a file with a short row rejected: %s\n",
+           (nbr_loaded == -1 && csv_x.width == 0 && csv_trg.width == 0) ? "yes" : "no");
+    remove(path);
+
+    static const char *const num_str[] = {"0", "-17", "+3.25", "1e10", "-2.5E-7", ".5", "7.", "123456789012345678901234",
+                                          "0.000000000000000000000123456", "1.7976931348623157e308", "4.9e-324",
+                                          "3.14159x", "1e", "2e+", "inf", "-nan"};
+    int nbr_num = sizeof(num_str) / sizeof(num_str[0]);
+    int nbr_agree = 0;
+    for (int k = 0; k < nbr_num; k++)
+    {
+        const char *str = num_str[k];
+        const char *end = str + strlen(str);
+        char *ref_end;
+        double ref = strtod(str, &ref_end);
+        double v = 0;
+        const char *p = data_points_parse_flt(str, end, &v);
+        nbr_agree += (p == ref_end) && (v == ref || (isnan(v) && isnan(ref)));
+    }
+    printf("data_points_parse_flt agrees with strtod on %d of %d numbers\n", nbr_agree, nbr_num);
+
+    const char *bad = "abc";
+    double v;
+    printf("data_points_parse_flt of a non-number: %s\n", data_points_parse_flt(bad, bad + 3, &v) ? "parsed" : "NULL");
+}
+
+// Trains a copy of model nbr_ep epochs straight, and another one nbr_ep / 2 epochs checkpointed,
+// resumed from the checkpoint file (nn_checkpoint_load, first_epoch, seed) up to nbr_ep;
+// for the SGD and the ADAM optimizer. Then loads the checkpoint for the other optimizer.
+static void cmp_checkpoint(const nn_model *model, data_points *x, data_points *trg, slice dt_sly,
+                           int batch_sz, int nbr_ep, nn_loss loss)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ann_test_%d_ckpt.bin", (int)getpid());
+    size_t sz = nn_model_serial_size(model);
+    uint8_t *bytes = malloc(sz);
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    static const nn_optim_class *const cls_arr[] = {&nn_optim_cls_SGD, &nn_optim_cls_ADAM};
+    static const char *const cls_str[] = {"SGD", "ADAM"};
+    for (int k = 0; k < 2; k++)
+    {
+        nn_model_train_params params = nn_model_train_params_DEFAULT;
+        params.seed = 20240501;
+
+        nn_model straight = nn_model_NULL;
+        nn_model_deserialize(&straight, bytes);
+        nn_optim opt;
+        nn_optim_construct(&opt, cls_arr[k], &straight);
+        nn_model_train_with(&straight, x, slice_NONE, trg, slice_NONE, NULL, dt_sly, batch_sz, nbr_ep, true, &opt, loss, &params);
+        nn_optim_destruct(&opt);
+
+        nn_model part = nn_model_NULL;
+        nn_model_deserialize(&part, bytes);
+        nn_optim_construct(&opt, cls_arr[k], &part);
+        nn_checkpoint ck;
+        nn_checkpoint_start(&ck, path);
+        params.checkpoint = &ck;
+        nn_model_train_with(&part, x, slice_NONE, trg, slice_NONE, NULL, dt_sly, batch_sz, nbr_ep / 2, true, &opt, loss, &params);
+        nn_checkpoint_stop(&ck);
+        nn_optim_destruct(&opt);
+        nn_model_destruct(&part);
+
+        nn_model resumed = nn_model_NULL;
+        nn_checkpoint_state state;
+        FLT_TYP dif = -1;
+        if (nn_checkpoint_load(path, &resumed, &opt, cls_arr[k], &state) == 0)
+        {
+            params = nn_model_train_params_DEFAULT;
+            params.first_epoch = state.epoch;
+            params.seed = state.seed;
+            nn_model_train_with(&resumed, x, slice_NONE, trg, slice_NONE, NULL, dt_sly, batch_sz, nbr_ep, true, &opt, loss, &params);
+            dif = param_dif(&straight, &resumed);
+            nn_optim_destruct(&opt);
+            nn_model_destruct(&resumed);
+        }
+        printf("%s resumed from a checkpoint after %d of %d epochs, max param diff to a straight run: %g\n",
+               cls_str[k], nbr_ep / 2, nbr_ep, dif);
+
+        nn_model wrong = nn_model_NULL;
+        int res = nn_checkpoint_load(path, &wrong, &opt, cls_arr[1 - k], &state);
+        printf("%s checkpoint loaded for %s rejected: %s\n", cls_str[k], cls_str[1 - k],
+               (res != 0 && nn_model_is_null(&wrong)) ? "yes" : "no");
+        if (res == 0)
+        {
+            nn_optim_destruct(&opt);
+            nn_model_destruct(&wrong);
+        }
+        nn_model_destruct(&straight);
+    }
+
+    // the model part with a layer size beyond the parameters: the first layer record follows
+    // the 48 byte checkpoint header and the 64 byte model file header
+    FILE *f = fopen(path, "r+b");
+    assert(f);
+    uint64_t out_sz = (uint64_t)1 << 40;
+    fseek(f, 48 + 64, SEEK_SET);
+    fwrite(&out_sz, sizeof(out_sz), 1, f);
+    fclose(f);
+    nn_model damaged = nn_model_NULL;
+    nn_optim opt;
+    nn_checkpoint_state state;
+    int res = nn_checkpoint_load(path, &damaged, &opt, cls_arr[1], &state);
+    printf("Checkpoint with a damaged model rejected: %s\n", (res != 0 && nn_model_is_null(&damaged)) ? "yes" : "no");
+    if (res == 0)
+    {
+        nn_optim_destruct(&opt);
+        nn_model_destruct(&damaged);
+    }
+    remove(path);
+    free(bytes);
+}
+
+typedef struct dist_test
+{
+    enum nn_dist_transport transport;
+    char name[64];
+    int nbr_ranks;
+} dist_test;
+
+// allreduces, then broadcasts from a changing root, each rank checking every result;
+// the broadcasts span several NN_DIST_SHM_CHUNK chunks
+static int dist_collectives(int rank, void *arg)
+{
+    const dist_test *dt = (const dist_test *)arg;
+    nn_dist dist = nn_dist_NULL;
+    if (!nn_dist_open(&dist, dt->transport, dt->name, rank, dt->nbr_ranks))
+        return -1;
+    IND_TYP n = 5 * NN_DIST_SHM_CHUNK / 2;
+    FLT_TYP *buf = malloc(n * sizeof(FLT_TYP));
+    assert(buf);
+    int nbr_bad = 0;
+    for (int it = 0; it < 20 && nbr_bad == 0; it++)
+    {
+        for (IND_TYP j = 0; j < n; j++)
+            buf[j] = (FLT_TYP)(rank + it + j % 64);
+        if (nn_dist_allreduce(&dist, buf, n) != 0)
+            nbr_bad++;
+        // sum over the ranks r of r + it + j % 64, all small integers
+        FLT_TYP base = (FLT_TYP)(dt->nbr_ranks * (dt->nbr_ranks - 1) / 2 + dt->nbr_ranks * it);
+        for (IND_TYP j = 0; j < n; j++)
+            nbr_bad += buf[j] != base + dt->nbr_ranks * (FLT_TYP)(j % 64);
+        int root = it % dt->nbr_ranks;
+        for (IND_TYP j = 0; j < n; j++)
+            buf[j] = (rank == root) ? (FLT_TYP)(-it - j % 128) : 0;
+        if (nn_dist_broadcast(&dist, buf, n * sizeof(FLT_TYP), root) != 0)
+            nbr_bad++;
+        for (IND_TYP j = 0; j < n; j++)
+            nbr_bad += buf[j] != (FLT_TYP)(-it - j % 128);
+    }
+    free(buf);
+    nn_dist_close(&dist);
+    return nbr_bad != 0;
+}
+
+// leaves the shared memory segment of name behind as a rank 0 killed while waiting for the
+// other ranks does, set up and linked
+static void leave_stale_shm(const char *name, int nbr_ranks)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "/nn_dist_%s", name);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        nn_dist dist = nn_dist_NULL;
+        nn_dist_open(&dist, NN_DIST_SHM, name, 0, nbr_ranks);
+        _exit(1);
+    }
+    int fd;
+    while ((fd = shm_open(path, O_RDONLY, 0)) < 0)
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    close(fd);
+    nanosleep(&(struct timespec){.tv_nsec = 100000000}, NULL);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+// rank 0 comes last, after the others had time to open the segment linked at the name
+static int dist_collectives_late_root(int rank, void *arg)
+{
+    if (rank == 0)
+        nanosleep(&(struct timespec){.tv_nsec = 200000000}, NULL);
+    return dist_collectives(rank, arg);
+}
+
+static void cmp_dist_collectives(int nbr_ranks)
+{
+    static const char *const transport_str[] = {"shared memory", "sockets"};
+    for (int tr = NN_DIST_SHM; tr <= NN_DIST_SOCKET; tr++)
+    {
+        dist_test dt = {.transport = (enum nn_dist_transport)tr, .nbr_ranks = nbr_ranks};
+        snprintf(dt.name, sizeof(dt.name), (tr == NN_DIST_SHM) ? "ann_test_%d" : "/tmp/ann_test_%d_sock", (int)getpid());
+        int nbr_failed = nn_dist_fork(nbr_ranks, dist_collectives, &dt);
+        printf("Allreduce then broadcast on %d ranks over %s: %d ranks with wrong results\n",
+               nbr_ranks, transport_str[tr], nbr_failed);
+    }
+    // the ranks > 0 may find the segment of a failed run before rank 0 replaces it
+    dist_test dt = {.transport = NN_DIST_SHM, .nbr_ranks = nbr_ranks};
+    snprintf(dt.name, sizeof(dt.name), "ann_test_%d_stale", (int)getpid());
+    leave_stale_shm(dt.name, nbr_ranks);
+    int nbr_failed = nn_dist_fork(nbr_ranks, dist_collectives_late_root, &dt);
+    printf("Allreduce then broadcast on %d ranks over shared memory left over by a failed run: "
+           "%d ranks with wrong results\n", nbr_ranks, nbr_failed);
+}
+
+typedef struct dist_train_test
+{
+    dist_test dt;
+    const uint8_t *model_bytes; // the serialized initial model
+    data_points *x, *trg;
+    char out_prefix[64]; // rank r saves its trained replica to "<out_prefix><r>.nn"
+} dist_train_test;
+
+// trains the initial model with ADAM on the rank's shard, allreducing the gradients, and
+// saves the trained replica
+static int dist_train(int rank, void *arg)
+{
+    const dist_train_test *tt = (const dist_train_test *)arg;
+    nn_dist dist = nn_dist_NULL;
+    if (!nn_dist_open(&dist, tt->dt.transport, tt->dt.name, rank, tt->dt.nbr_ranks))
+        return -1;
+    nn_model model = nn_model_NULL;
+    nn_model_deserialize(&model, tt->model_bytes);
+    nn_optim opt;
+    nn_optim_construct(&opt, &nn_optim_cls_ADAM, &model);
+    nn_model_train_params params = nn_model_train_params_DEFAULT;
+    params.dist = &dist;
+    params.seed = 7;
+    slice shard = nn_dist_shard(&dist, slice_NONE, tt->x->nbr_points);
+    nn_model_train_with(&model, tt->x, slice_NONE, tt->trg, slice_NONE, NULL, shard, 16, 3, true, &opt,
+                        nn_loss_MSE, &params);
+    char path[80];
+    snprintf(path, sizeof(path), "%s%d.nn", tt->out_prefix, rank);
+    int ret = (!dist.failed && nn_model_save(&model, path) == 0) ? 0 : -1;
+    nn_optim_destruct(&opt);
+    nn_model_destruct(&model);
+    nn_dist_close(&dist);
+    return ret;
+}
+
+// data-parallel training of one model on nbr_ranks forked ranks over each transport; the
+// replicas must end up bitwise equal, and differ from the initial model
+static void cmp_dist_train(int nbr_ranks)
+{
+    static const char *const transport_str[] = {"shared memory", "sockets"};
+    IND_TYP nbr_data = 960;
+    data_points x, trg;
+    data_points_construct(&x, 2, nbr_data);
+    data_points_construct(&trg, 2, nbr_data);
+    gen_reg_data(&x, &trg);
+
+    nn_model init = nn_model_NULL;
+    nn_model_construct(&init, 3, 2);
+    nn_layer lay0 = {.out_sz = 8, .dropout = 0, .activ = nn_activ_TANH};
+    nn_layer lay1 = {.out_sz = 2, .dropout = 0, .activ = nn_activ_ID};
+    nn_model_append(&init, &lay0);
+    nn_model_append(&init, &lay1);
+    nn_model_init_uniform_rnd(&init, 0.5, 0);
+    uint8_t *bytes = malloc(nn_model_serial_size(&init));
+    assert(bytes);
+    nn_model_serialize(&init, bytes);
+
+    for (int tr = NN_DIST_SHM; tr <= NN_DIST_SOCKET; tr++)
+    {
+        dist_train_test tt = {.dt = {.transport = (enum nn_dist_transport)tr, .nbr_ranks = nbr_ranks},
+                              .model_bytes = bytes, .x = &x, .trg = &trg};
+        snprintf(tt.dt.name, sizeof(tt.dt.name), (tr == NN_DIST_SHM) ? "ann_test_%d_train" : "/tmp/ann_test_%d_train_sock",
+                 (int)getpid());
+        snprintf(tt.out_prefix, sizeof(tt.out_prefix), "/tmp/ann_test_%d_rank", (int)getpid());
+        int nbr_failed = nn_dist_fork(nbr_ranks, dist_train, &tt);
+        FLT_TYP max_dif = -1, trained_dif = -1;
+        nn_model first = nn_model_NULL;
+        char path[80];
+        for (int r = 0; r < nbr_ranks; r++)
+        {
+            snprintf(path, sizeof(path), "%s%d.nn", tt.out_prefix, r);
+            nn_model replica = nn_model_NULL;
+            if (nbr_failed == 0 && nn_model_load((r == 0) ? &first : &replica, path))
+            {
+                if (r == 0)
+                {
+                    max_dif = 0;
+                    trained_dif = param_dif(&init, &first);
+                }
+                else
+                {
+                    FLT_TYP dif = param_dif(&first, &replica);
+                    max_dif = (dif < 0 || max_dif < 0) ? -1 : fmax(max_dif, dif);
+                }
+            }
+            nn_model_destruct(&replica);
+            remove(path);
+        }
+        nn_model_destruct(&first);
+        printf("Training on %d ranks over %s: %d ranks failed, max param diff between the replicas %g, "
+               "trained %s\n", nbr_ranks, transport_str[tr], nbr_failed, max_dif, (trained_dif > 0) ? "yes" : "no");
+    }
+    free(bytes);
+    nn_model_destruct(&init);
+    data_points_destruct(&x);
+    data_points_destruct(&trg);
+}
+
+// exports the model as C, compiles it with a driver forwarding the first nbr_rows rows of x
+// and compares its outputs with nn_model_apply
+static void cmp_export(const nn_model *model, data_points *x, IND_TYP nbr_rows)
+{
+    char src_path[64], drv_path[64], bin_path[64], cmd[256];
+    snprintf(src_path, sizeof(src_path), "/tmp/ann_test_%d_model.c", (int)getpid());
+    snprintf(drv_path, sizeof(drv_path), "/tmp/ann_test_%d_drv.c", (int)getpid());
+    snprintf(bin_path, sizeof(bin_path), "/tmp/ann_test_%d_drv.out", (int)getpid());
+    if (nn_model_export_c(model, src_path, "tst") != 0)
+    {
+        puts("Exported C forward: export failed!");
+        return;
+    }
+    const char *flt_name = (sizeof(FLT_TYP) == sizeof(double)) ? "double" : "float";
+    FILE *f = fopen(drv_path, "w");
+    assert(f);
+    fprintf(f, "#include <stdio.h>\n#include \"%s\"\n\nstatic const %s inp[%ld][TST_INPUT_SIZE] = {\n",
+            src_path, flt_name, (long)nbr_rows);
+    vec inp = vec_NULL;
+    for (IND_TYP i = 0; i < nbr_rows; i++)
+    {
+        data_points_at(x, &inp, i, NULL);
+        fprintf(f, "    {");
+        for (IND_TYP j = 0; j < inp.d; j++)
+            fprintf(f, "%s%a", (j > 0) ? ", " : "", (double)*vec_at(&inp, j));
+        fprintf(f, "},\n");
+    }
+    fprintf(f, "};\n\nint main(void)\n{\n    %s out[TST_OUTPUT_SIZE];\n", flt_name);
+    fprintf(f, "    for (int i = 0; i < %ld; i++)\n    {\n        tst_forward(inp[i], out);\n", (long)nbr_rows);
+    fprintf(f, "        for (int j = 0; j < TST_OUTPUT_SIZE; j++)\n            printf(\"%%a\\n\", (double)out[j]);\n");
+    fprintf(f, "    }\n    return 0;\n}\n");
+    fclose(f);
+
+    const char *cc = getenv("CC");
+    snprintf(cmd, sizeof(cmd), "%s -std=c11 -O2 -o %s %s -lm", (cc) ? cc : "cc", bin_path, drv_path);
+    if (system(cmd) != 0)
+    {
+        puts("Exported C forward: cannot compile it, not compared");
+    }
+    else
+    {
+        FILE *p = popen(bin_path, "r");
+        assert(p);
+        vec *out = vec_new(model->ouput_size);
+        FLT_TYP max_dif = 0;
+        IND_TYP nbr_read = 0;
+        for (IND_TYP i = 0; i < nbr_rows; i++)
+        {
+            data_points_at(x, &inp, i, NULL);
+            nn_model_apply(model, &inp, out, false);
+            for (IND_TYP j = 0; j < model->ouput_size; j++)
+            {
+                double v;
+                if (fscanf(p, "%la", &v) != 1)
+                    break;
+                nbr_read++;
+                max_dif = fmax(max_dif, fabs(*vec_at(out, j) - v));
+            }
+        }
+        pclose(p);
+        vec_del(out);
+        printf("Max diff of the exported C forward vs nn_model_apply: %g (%ld of %ld outputs)\n", max_dif,
+               (long)nbr_read, (long)(nbr_rows * model->ouput_size));
+    }
+    vec_destruct(&inp);
+    remove(bin_path);
+    remove(drv_path);
+    remove(src_path);
+
+    // a model with a NaN weight has no C source
+    nn_model nan_model = nn_model_NULL;
+    uint8_t *bytes = malloc(nn_model_serial_size(model));
+    assert(bytes);
+    nn_model_serialize(model, bytes);
+    nn_model_deserialize(&nan_model, bytes);
+    *mat_at(nan_model.weight, 0, 0) = NAN;
+    printf("Export of a model with a NaN weight refused: %s\n",
+           (nn_model_export_c(&nan_model, src_path, "tst") != 0 && access(src_path, F_OK) != 0) ? "yes" : "no");
+    nn_model_destruct(&nan_model);
+    free(bytes);
+}
+
 int main()
 {
     srand(time(NULL));
@@ -113,6 +948,16 @@ int main()
     int nbr_ep = 300;
     int batch_sz = 16;
 
+    puts("--------------");
+    puts("DATA");
+    puts("--------------");
+    cmp_csv();
+    // forks, so before any thread is started
+    cmp_permute();
+    // forks, so before any thread is started
+    cmp_dist_collectives(3);
+    cmp_dist_train(2);
+
     puts("--------------");
     puts("REGRESSi0N");
     puts("--------------");
@@ -156,6 +1001,7 @@ int main()
     // puts("init model:");
     // nn_model_print(&reg_model);
     printf("Model nbr of parameters: %lu\n", nn_model_nbr_param(&reg_model));
+    cmp_sync_async(&reg_model, &reg_x, &reg_trg, reg_dt_sly, batch_sz, 50, nn_loss_MSE);
     FLT_TYP avg_err = nn_model_eval(&reg_model, &reg_x, slice_NONE, &reg_trg, slice_NONE, NULL, reg_tst_sly, nn_loss_MSE, false);
     printf("Eval avg err before training: %f\n", avg_err);
     nn_model_train(&reg_model, &reg_x, slice_NONE, &reg_trg, slice_NONE, NULL, reg_dt_sly, batch_sz, nbr_ep, true, &reg_opt, nn_loss_MSE);
@@ -164,6 +1010,33 @@ int main()
     avg_err = nn_model_eval(&reg_model, &reg_x, slice_NONE, &reg_trg, slice_NONE, NULL, reg_tst_sly, nn_loss_MSE, false);
     printf("Eval avg err after training: %f\n", avg_err);
 
+    nn_infer_ctx reg_ctx;
+    nn_infer_ctx_construct(&reg_ctx, &reg_model, 1);
+    vec reg_inp = vec_NULL;
+    vec *reg_out = vec_new(nbr_out), *reg_out_ctx = vec_new(nbr_out);
+    FLT_TYP max_dif = 0;
+    for (IND_TYP i = 0; i < 100; i++)
+    {
+        data_points_at(&reg_x, &reg_inp, dt_end + i, NULL);
+        nn_model_apply(&reg_model, &reg_inp, reg_out, false);
+        nn_model_infer(&reg_model, &reg_ctx, &reg_inp, reg_out_ctx);
+        for (IND_TYP j = 0; j < nbr_out; j++)
+            max_dif = fmax(max_dif, fabs(*vec_at(reg_out, j) - *vec_at(reg_out_ctx, j)));
+    }
+    printf("Max diff of nn_model_infer vs nn_model_apply: %g\n", max_dif);
+    cmp_export(&reg_model, &reg_x, 100);
+    cmp_save_load(&reg_model);
+    cmp_merge(&reg_model);
+#ifdef NN_PROF
+    cmp_prof(&reg_model, &reg_x, &reg_trg, reg_dt_sly, batch_sz, nn_loss_MSE);
+#endif
+    cmp_data_points_file(&reg_model, &reg_x, &reg_trg, reg_tst_sly, nn_loss_MSE);
+    cmp_checkpoint(&reg_model, &reg_x, &reg_trg, reg_dt_sly, batch_sz, 6, nn_loss_MSE);
+    vec_del(reg_out);
+    vec_del(reg_out_ctx);
+    vec_destruct(&reg_inp);
+    nn_infer_ctx_destruct(&reg_ctx);
+
     nn_optim_destruct(&reg_opt);
     nn_model_destruct(&reg_model);
     data_points_destruct(&reg_x);
@@ -206,11 +1079,64 @@ int main()
     printf("Model nbr of parameters: %lu\n", nn_model_nbr_param(&cat_model));
     avg_err = nn_model_eval(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, cat_tst_sly, nn_loss_CrossEnt, true);
     printf("Eval inaccuracy before training: %f\n", avg_err);
-    nn_model_train(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, cat_dt_sly, batch_sz, nbr_ep, true, &cat_opt, nn_loss_CrossEnt);
+    // the last tenth of the training data validates the model after each epoch, on a subsample
+    slice cat_fit_sly, cat_val_sly;
+    IND_TYP val_start = round(0.9 * dt_end);
+    slice_set(&cat_fit_sly, 0, val_start, 1);
+    slice_set(&cat_val_sly, val_start, dt_end, 1);
+    nn_early_stop cat_es;
+    nn_early_stop_params es_p = nn_early_stop_params_DEFAULT;
+    es_p.subsample = (dt_end - val_start) / 2;
+    es_p.classification = true;
+    nn_early_stop_construct(&cat_es, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, cat_val_sly, nn_loss_CrossEnt, &es_p);
+    nn_model_train_stats cat_stats;
+    nn_model_train_params cat_p = nn_model_train_params_DEFAULT;
+    cat_p.callback = nn_early_stop_callback;
+    cat_p.callback_ctx = &cat_es;
+    cat_p.stats = &cat_stats;
+    nn_model_train_with(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, cat_fit_sly, batch_sz, nbr_ep, true, &cat_opt, nn_loss_CrossEnt, &cat_p);
+    printf("Trained %d epochs%s, best validation inaccuracy %f in epoch %d\n", cat_stats.nbr_epochs,
+           (cat_stats.stopped) ? " (stopped early)" : "", cat_es.best_loss, cat_es.best_epoch);
+    nn_early_stop_destruct(&cat_es);
     // puts("trained model:");
     // nn_model_print(&cat_model);
     avg_err = nn_model_eval(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, cat_tst_sly, nn_loss_CrossEnt, true);
     printf("Eval inaccuracy after training: %f\n", avg_err);
+    avg_err = nn_model_eval_par(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, slice_NONE, nn_loss_CrossEnt, true, 4);
+    FLT_TYP avg_err_1 = nn_model_eval(&cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE, NULL, slice_NONE, nn_loss_CrossEnt, true);
+    printf("Eval inaccuracy on all data, 4 threads: %f, 1 thread: %f\n", avg_err, avg_err_1);
+
+    nn_qmodel cat_qmodel = nn_qmodel_NULL;
+    nn_model_quantize(&cat_qmodel, &cat_model);
+    nn_qmodel_report q_rep;
+    nn_qmodel_compare(&q_rep, &cat_qmodel, &cat_model, &cat_x, slice_NONE, &cat_trg, slice_NONE,
+                      cat_tst_sly, nn_loss_CrossEnt, true);
+    nn_qmodel_report_print(&q_rep);
+    nn_qmodel_destruct(&cat_qmodel);
+
+    for (int fmt = NN_HALF_FP16; fmt <= NN_HALF_BF16; fmt++)
+    {
+        nn_hmodel cat_hmodel = nn_hmodel_NULL;
+        nn_model_to_half(&cat_hmodel, &cat_model, fmt);
+        nn_infer_ctx f_ctx, h_ctx;
+        nn_infer_ctx_construct(&f_ctx, &cat_model, nbr_data);
+        nn_infer_ctx_construct_dims(&h_ctx, cat_hmodel.input_size, cat_hmodel.max_width, nbr_data);
+        for (IND_TYP i = 0; i < nbr_data; i++)
+        {
+            data_points_copy_at(&cat_x, nn_infer_ctx_input(&f_ctx) + i * nbr_feat, i, NULL);
+            data_points_copy_at(&cat_x, nn_infer_ctx_input(&h_ctx) + i * nbr_feat, i, NULL);
+        }
+        const FLT_TYP *f_out = nn_model_infer_batch(&cat_model, &f_ctx, nbr_data);
+        const FLT_TYP *h_out = nn_hmodel_infer_batch(&cat_hmodel, &h_ctx, nbr_data);
+        FLT_TYP h_dif = 0;
+        for (IND_TYP i = 0; i < nbr_data * nbr_lbl; i++)
+            h_dif = fmax(h_dif, fabs(f_out[i] - h_out[i]));
+        printf("%s weights: %zu bytes, max output diff %g\n", (fmt == NN_HALF_FP16) ? "fp16" : "bf16",
+               nn_hmodel_weight_bytes(&cat_hmodel), h_dif);
+        nn_infer_ctx_destruct(&h_ctx);
+        nn_infer_ctx_destruct(&f_ctx);
+        nn_hmodel_destruct(&cat_hmodel);
+    }
 
     nn_optim_destruct(&cat_opt);
     nn_model_destruct(&cat_model);
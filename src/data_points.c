@@ -1,8 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "data_points.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 
+#include "nn_par.h"
 #include "rnd.h"
 #include "log.h"
 
@@ -27,6 +33,7 @@ data_points *data_points_construct(data_points *dtpts, IND_TYP width, IND_TYP in
     dtpts->capacity = dtpts->init_capacity;
     dtpts->width = width;
     dtpts->payload = payload_NULL;
+    dtpts->map = nn_mapping_NULL;
     payload_construct(&dtpts->payload, dtpts->width * dtpts->capacity);
     assert(payload_is_valid(&dtpts->payload));
     if (!payload_is_valid(&dtpts->payload))
@@ -38,11 +45,123 @@ data_points *data_points_construct(data_points *dtpts, IND_TYP width, IND_TYP in
     return dtpts;
 }
 
+// dataset file format; fields in the byte order of the writer, checked by byte_order
+#define DATA_POINTS_FILE_MAGIC "NNDATA"
+#define DATA_POINTS_FILE_VERSION 1
+#define DATA_POINTS_FILE_BYTE_ORDER 0x01020304u
+
+typedef struct data_points_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flt_size;   // sizeof(FLT_TYP) of the writer
+    uint32_t byte_order; // DATA_POINTS_FILE_BYTE_ORDER
+    uint32_t reserved;
+    uint64_t width;
+    uint64_t nbr_points;
+    uint8_t pad[24]; // the rows start 64 byte aligned
+} data_points_file_header;
+
+_Static_assert(sizeof(data_points_file_header) == 64, "data_points_file_header must be 64 bytes");
+
+data_points *data_points_mmap(data_points *dtpts, const char *file_path, enum nn_mapping_advice advice)
+{
+    assert(dtpts);
+    assert(file_path);
+
+    nn_mapping map = nn_mapping_NULL;
+    if (!nn_mapping_open(&map, file_path))
+        return NULL;
+    data_points_file_header hdr;
+    const char *err = "not a dataset file";
+    if (map.size >= sizeof(hdr))
+    {
+        memcpy(&hdr, map.addr, sizeof(hdr));
+        size_t max_nbr = map.size - sizeof(hdr);
+        if (memcmp(hdr.magic, DATA_POINTS_FILE_MAGIC, sizeof(DATA_POINTS_FILE_MAGIC)) != 0)
+            err = "not a dataset file";
+        else if (hdr.version != DATA_POINTS_FILE_VERSION)
+            err = "unsupported version";
+        else if (hdr.byte_order != DATA_POINTS_FILE_BYTE_ORDER)
+            err = "written with another byte order";
+        else if (hdr.flt_size != sizeof(FLT_TYP))
+            err = "written with another FLT_TYP";
+        else if (hdr.width == 0 || hdr.nbr_points == 0)
+            err = "no data points";
+        else if (hdr.width > max_nbr / sizeof(FLT_TYP) ||
+                 hdr.nbr_points > max_nbr / sizeof(FLT_TYP) / hdr.width)
+            err = "truncated file";
+        else
+            err = NULL;
+    }
+    if (err)
+    {
+        log_msg(LOG_ERR, "data_points_mmap: %s: %s!", file_path, err);
+        nn_mapping_close(&map);
+        return NULL;
+    }
+    *dtpts = data_points_NULL;
+    dtpts->width = (IND_TYP)hdr.width;
+    dtpts->nbr_points = (IND_TYP)hdr.nbr_points;
+    dtpts->capacity = dtpts->nbr_points;
+    dtpts->init_capacity = dtpts->nbr_points;
+    // the payload was not allocated by payload_construct; it is never resized nor released
+    dtpts->payload.arr = (FLT_TYP *)((uint8_t *)map.addr + sizeof(hdr));
+    dtpts->payload.size = dtpts->nbr_points * dtpts->width;
+    dtpts->payload.ref_count = 1;
+    dtpts->map = map;
+    data_points_advise(dtpts, advice);
+    return dtpts;
+}
+
+bool data_points_is_mapped(const data_points *dtpts)
+{
+    assert(dtpts);
+    return nn_mapping_is_open(&dtpts->map);
+}
+
+void data_points_advise(const data_points *dtpts, enum nn_mapping_advice advice)
+{
+    assert(dtpts);
+    if (data_points_is_mapped(dtpts))
+        nn_mapping_advise(&dtpts->map, sizeof(data_points_file_header), dtpts->map.size, advice);
+}
+
+int data_points_save(const data_points *dtpts, const char *file_path)
+{
+    assert(data_points_is_valid(dtpts));
+    assert(file_path);
+
+    data_points_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DATA_POINTS_FILE_MAGIC, sizeof(DATA_POINTS_FILE_MAGIC));
+    hdr.version = DATA_POINTS_FILE_VERSION;
+    hdr.flt_size = sizeof(FLT_TYP);
+    hdr.byte_order = DATA_POINTS_FILE_BYTE_ORDER;
+    hdr.width = dtpts->width;
+    hdr.nbr_points = dtpts->nbr_points;
+
+    // renamed over file_path once complete: a mapping of the old file stays intact
+    nn_file_replace rep;
+    if (nn_file_replace_open(&rep, file_path) < 0)
+        return -1;
+    size_t n = dtpts->nbr_points * dtpts->width;
+    bool ok = nn_file_write_all(rep.fd, &hdr, sizeof(hdr)) &&
+              nn_file_write_all(rep.fd, payload_at((payload *)&dtpts->payload, 0), n * sizeof(FLT_TYP));
+    return nn_file_replace_close(&rep, file_path, ok);
+}
+
 void data_points_destruct(data_points *dtpts)
 {
     assert(data_points_is_valid(dtpts));
     if (!dtpts)
         return;
+    if (data_points_is_mapped(dtpts))
+    {
+        nn_mapping_close(&dtpts->map);
+        *dtpts = data_points_NULL;
+        return;
+    }
     payload_release(&dtpts->payload);
     log_msg(LOG_DBG, "data_points_destruct: payload after release: %p ref_c: %d", dtpts->payload.arr, dtpts->payload.ref_count);
     *dtpts = data_points_NULL;
@@ -53,6 +172,11 @@ data_points *data_points_append(data_points *dest, const data_points *src)
     assert(data_points_is_valid(dest));
     assert(data_points_is_valid(src));
 
+    if (data_points_is_mapped(dest))
+    {
+        log_msg(LOG_WRN, "data_points_append: dest is a read-only mapping; nothing appended.");
+        return dest;
+    }
     IND_TYP new_nbr = dest->nbr_points + src->nbr_points;
     if (dest->capacity < new_nbr)
     {
@@ -87,6 +211,34 @@ vec *data_points_at(data_points *dtpts, vec *data, IND_TYP i, const slice *sly)
     return vec_construct_prealloc(data, &dtpts->payload, i * dtpts->width + sly->start, sly->len, sly->step);
 }
 
+FLT_TYP *data_points_copy_at(const data_points *dtpts, FLT_TYP *dst, IND_TYP i, const slice *sly)
+{
+    assert(data_points_is_valid(dtpts));
+    assert(dst);
+
+    if (i < 0)
+        i += dtpts->nbr_points;
+    assert(i < dtpts->nbr_points && i >= 0);
+
+    const FLT_TYP *src = data_points_ptr_at((data_points *)dtpts, i);
+    if (!sly || slice_is_none(sly))
+    {
+        memcpy(dst, src, dtpts->width * sizeof(FLT_TYP));
+        return dst;
+    }
+
+    assert(slice_is_valid(sly));
+    assert(slice_is_regulated(sly));
+
+    src += sly->start;
+    if (sly->step == 1)
+        memcpy(dst, src, sly->len * sizeof(FLT_TYP));
+    else
+        for (IND_TYP j = 0; j < sly->len; j++)
+            dst[j] = src[j * sly->step];
+    return dst;
+}
+
 vec *data_points_at_rnd(data_points *dtpts, vec *data, const slice *sly)
 {
     assert(data_points_is_valid(dtpts));
@@ -95,30 +247,169 @@ vec *data_points_at_rnd(data_points *dtpts, vec *data, const slice *sly)
     return data_points_at(dtpts, data, i, sly);
 }
 
+// rows gathered ahead of the one being copied
+#define DATA_POINTS_PREFETCH_DIST 8
+
+static inline void prefetch_row(const FLT_TYP *row)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(row, 0, 0);
+#else
+    (void)row;
+#endif
+}
+
+typedef struct permute_range
+{
+    data_points *dtpts;
+    const slice *i_sly;
+    const IND_TYP *perm;
+    FLT_TYP *stage;
+    IND_TYP k0, k1;
+} permute_range;
+
+// stage[k - k0] = row perm[k] for k in [k0, k1)
+static int permute_gather(void *arg)
+{
+    permute_range *rg = (permute_range *)arg;
+    IND_TYP width = rg->dtpts->width;
+    size_t row_sz = width * sizeof(FLT_TYP);
+    for (IND_TYP k = rg->k0; k < rg->k1; k++)
+    {
+        if (k + DATA_POINTS_PREFETCH_DIST < rg->k1)
+            prefetch_row(data_points_ptr_at(rg->dtpts, slice_index(rg->i_sly, rg->perm[k + DATA_POINTS_PREFETCH_DIST])));
+        memcpy(rg->stage + k * width, data_points_ptr_at(rg->dtpts, slice_index(rg->i_sly, rg->perm[k])), row_sz);
+    }
+    return 0;
+}
+
+// rows k of [k0, k1) = stage[k]; sequential on both sides
+static int permute_scatter(void *arg)
+{
+    permute_range *rg = (permute_range *)arg;
+    IND_TYP width = rg->dtpts->width;
+    if (rg->i_sly->step == 1)
+    {
+        memcpy(data_points_ptr_at(rg->dtpts, slice_index(rg->i_sly, rg->k0)), rg->stage + rg->k0 * width,
+               (rg->k1 - rg->k0) * width * sizeof(FLT_TYP));
+        return 0;
+    }
+    for (IND_TYP k = rg->k0; k < rg->k1; k++)
+        memcpy(data_points_ptr_at(rg->dtpts, slice_index(rg->i_sly, k)), rg->stage + k * width,
+               width * sizeof(FLT_TYP));
+    return 0;
+}
+
+static size_t permute_max_stage = DATA_POINTS_PERMUTE_MAX_STAGE;
+
+size_t data_points_set_permute_max_stage(size_t max_stage)
+{
+    size_t former = permute_max_stage;
+    permute_max_stage = max_stage;
+    return former;
+}
+
+// in place, one row of extra memory: follows each cycle of perm once
+static bool permute_cycles(data_points *dtpts, const slice *i_sly, const IND_TYP *perm)
+{
+    IND_TYP len = i_sly->len;
+    size_t row_sz = dtpts->width * sizeof(FLT_TYP);
+    uint8_t *done = (uint8_t *)calloc((size_t)len / 8 + 1, 1);
+    FLT_TYP *tmp = (FLT_TYP *)malloc(row_sz);
+    if (!done || !tmp)
+    {
+        free(done);
+        free(tmp);
+        return false;
+    }
+    for (IND_TYP s = 0; s < len; s++)
+    {
+        if ((done[s / 8] >> (s % 8)) & 1 || perm[s] == s)
+            continue;
+        memcpy(tmp, data_points_ptr_at(dtpts, slice_index(i_sly, s)), row_sz);
+        IND_TYP j = s;
+        for (;;)
+        {
+            done[j / 8] |= (uint8_t)(1u << (j % 8));
+            IND_TYP k = perm[j];
+            FLT_TYP *dst = data_points_ptr_at(dtpts, slice_index(i_sly, j));
+            if (k == s)
+            {
+                memcpy(dst, tmp, row_sz);
+                break;
+            }
+            memcpy(dst, data_points_ptr_at(dtpts, slice_index(i_sly, k)), row_sz);
+            j = k;
+        }
+    }
+    free(done);
+    free(tmp);
+    return true;
+}
+
+data_points *data_points_permute(data_points *dtpts, slice i_sly, const IND_TYP *perm, int nbr_threads)
+{
+    assert(data_points_is_valid(dtpts));
+    assert(slice_is_valid(&i_sly));
+    assert(perm);
+
+    if (data_points_is_mapped(dtpts))
+    {
+        log_msg(LOG_WRN, "data_points_permute: the data points are a read-only mapping; nothing permuted.");
+        return dtpts;
+    }
+    slice_regulate(&i_sly, dtpts->nbr_points);
+    IND_TYP len = i_sly.len;
+    if (len <= 1)
+        return dtpts;
+
+    size_t stage_sz = (size_t)len * dtpts->width * sizeof(FLT_TYP);
+    FLT_TYP *stage = (stage_sz <= permute_max_stage) ? (FLT_TYP *)malloc(stage_sz) : NULL;
+    if (!stage)
+    {
+        if (!permute_cycles(dtpts, &i_sly, perm))
+            log_msg(LOG_ERR, "data_points_permute: out of memory; nothing permuted.");
+        return dtpts;
+    }
+    nbr_threads = nn_par_nbr_threads(nbr_threads, len / DATA_POINTS_PERMUTE_MIN_ROWS + 1);
+    permute_range *rg = (permute_range *)calloc(nbr_threads, sizeof(permute_range));
+    assert(rg);
+    for (int t = 0; t < nbr_threads; t++)
+        rg[t] = (permute_range){.dtpts = dtpts, .i_sly = &i_sly, .perm = perm, .stage = stage,
+                                .k0 = len * t / nbr_threads, .k1 = len * (t + 1) / nbr_threads};
+    nn_par_run_tasks(nbr_threads, permute_gather, rg, sizeof(permute_range));
+    nn_par_run_tasks(nbr_threads, permute_scatter, rg, sizeof(permute_range));
+    free(rg);
+    free(stage);
+    return dtpts;
+}
+
 data_points *data_points_shuffle(data_points *dtpts, slice i_sly)
 {
     assert(data_points_is_valid(dtpts));
     assert(slice_is_valid(&i_sly));
 
+    if (data_points_is_mapped(dtpts))
+    {
+        log_msg(LOG_WRN, "data_points_shuffle: the data points are a read-only mapping; nothing shuffled.");
+        return dtpts;
+    }
     slice_regulate(&i_sly, dtpts->nbr_points);
+    if (i_sly.len <= 1)
+        return dtpts;
 
-    vec tmp = vec_NULL, va = vec_NULL, vb = vec_NULL;
-    vec_construct(&tmp, dtpts->width);
-    for (IND_TYP k = 0; k < i_sly.len - 1; k++)
+    // same draws as swapping the rows themselves, so the same order
+    IND_TYP *perm = (IND_TYP *)malloc(i_sly.len * sizeof(IND_TYP));
+    if (!perm)
     {
-        IND_TYP l = k + (IND_TYP)(UINT_RND_GEN() % (i_sly.len - k));
-        if (l != k)
-        {
-            data_points_at(dtpts, &va, slice_index(&i_sly, k), NULL);
-            data_points_at(dtpts, &vb, slice_index(&i_sly, l), NULL);
-            vec_assign(&tmp, &va);
-            vec_assign(&va, &vb);
-            vec_assign(&vb, &tmp);
-        }
+        log_msg(LOG_ERR, "data_points_shuffle: out of memory; nothing shuffled.");
+        return dtpts;
     }
-    vec_destruct(&tmp);
-    vec_destruct(&va);
-    vec_destruct(&vb);
+    for (IND_TYP k = 0; k < i_sly.len; k++)
+        perm[k] = k;
+    rnd_shuffle_ind(perm, i_sly.len, UINT_RND_GEN);
+    data_points_permute(dtpts, i_sly, perm, 0);
+    free(perm);
     return dtpts;
 }
 
@@ -143,6 +434,11 @@ bool data_points_is_valid(const data_points *dtpts)
 data_points *data_points_clear(data_points *dtpts)
 {
     assert(data_points_is_valid(dtpts));
+    if (data_points_is_mapped(dtpts))
+    {
+        log_msg(LOG_WRN, "data_points_clear: the data points are a read-only mapping; nothing cleared.");
+        return dtpts;
+    }
     dtpts->nbr_points = 0;
     if (!payload_resize(&dtpts->payload, dtpts->init_capacity))
     {
@@ -0,0 +1,364 @@
+#include "data_points_csv.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "nn_mmap.h"
+#include "nn_par.h"
+#include "log.h"
+
+// smallest byte range worth a thread of its own
+#define DATA_POINTS_CSV_MIN_RANGE (1 << 20)
+// numbers longer than this are not handed to strtod
+#define DATA_POINTS_CSV_MAX_NUM 128
+
+static const double pow10_tab[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool is_digit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+// strtod on a copy of [p, end): the text is not 0 terminated
+static const char *parse_slow(const char *p, const char *end, double *val)
+{
+    char buf[DATA_POINTS_CSV_MAX_NUM];
+    size_t n = (size_t)(end - p);
+    if (n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+    memcpy(buf, p, n);
+    buf[n] = 0;
+    char *q;
+    *val = strtod(buf, &q);
+    return (q == buf) ? NULL : p + (q - buf);
+}
+
+const char *data_points_parse_flt(const char *p, const char *end, double *val)
+{
+    assert(p && end && val);
+    const char *beg = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = (*p++ == '-');
+
+    // up to 19 significant digits in man; exactly rounded when man <= 2^53 and
+    // |exp10| <= 22 (both factors exact), strtod otherwise
+    uint64_t man = 0;
+    int nbr_dig = 0;
+    int exp10 = 0;
+    bool any = false, trunc = false;
+    for (; p < end && is_digit(*p); p++, any = true)
+    {
+        if (nbr_dig < 19)
+        {
+            man = man * 10 + (uint64_t)(*p - '0');
+            nbr_dig += (man != 0);
+        }
+        else
+        {
+            exp10++;
+            trunc = true;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && is_digit(*p); p++, any = true)
+        {
+            if (nbr_dig < 19)
+            {
+                man = man * 10 + (uint64_t)(*p - '0');
+                nbr_dig += (man != 0);
+                exp10--;
+            }
+            else
+            {
+                trunc = true;
+            }
+        }
+    }
+    if (!any)
+        return parse_slow(beg, end, val); // nan, inf
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool e_neg = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            e_neg = (*q++ == '-');
+        if (q < end && is_digit(*q))
+        {
+            int e = 0;
+            for (; q < end && is_digit(*q); q++)
+                if (e < 100000)
+                    e = e * 10 + (*q - '0');
+            exp10 += (e_neg) ? -e : e;
+            p = q;
+        }
+    }
+    if (trunc || man > (UINT64_C(1) << 53) || exp10 < -22 || exp10 > 22)
+    {
+        if (p - beg < DATA_POINTS_CSV_MAX_NUM)
+            return parse_slow(beg, p, val);
+        // absurdly long number: nearly exact is good enough
+        double v = (double)man;
+        for (; exp10 > 22; exp10 -= 22)
+            v *= pow10_tab[22];
+        for (; exp10 < -22; exp10 += 22)
+            v /= pow10_tab[22];
+        v = (exp10 < 0) ? v / pow10_tab[-exp10] : v * pow10_tab[exp10];
+        *val = (neg) ? -v : v;
+        return p;
+    }
+    double v = (exp10 < 0) ? (double)man / pow10_tab[-exp10] : (double)man * pow10_tab[exp10];
+    *val = (neg) ? -v : v;
+    return p;
+}
+
+typedef struct csv_job
+{
+    const char *data;
+    char delim;
+    IND_TYP nbr_cols;
+    const IND_TYP *x_col;   // per column: index in a row of data_x, -1 if not taken
+    const IND_TYP *trg_col; // same for data_trg; NULL without targets
+    data_points *data_x;
+    data_points *data_trg;
+} csv_job;
+
+typedef struct csv_range
+{
+    const csv_job *job;
+    size_t beg, end;  // byte range; starts at a line start
+    IND_TYP nbr_rows; // pass 1
+    IND_TYP row0;     // first row of the range
+    IND_TYP bad_row;  // pass 2: first row that can't be parsed, -1 if none
+} csv_range;
+
+// [*line, *eol) is the next line of [p, end) without its line break; returns the start of the one after
+static inline const char *next_line(const char *p, const char *end, const char **eol)
+{
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    const char *e = (nl) ? nl : end;
+    if (e > p && e[-1] == '\r')
+        e--;
+    *eol = e;
+    return (nl) ? nl + 1 : end;
+}
+
+static int count_rows(void *arg)
+{
+    csv_range *rg = (csv_range *)arg;
+    const char *p = rg->job->data + rg->beg;
+    const char *end = rg->job->data + rg->end;
+    IND_TYP n = 0;
+    while (p < end)
+    {
+        const char *eol;
+        const char *nxt = next_line(p, end, &eol);
+        n += (eol > p);
+        p = nxt;
+    }
+    rg->nbr_rows = n;
+    return 0;
+}
+
+static inline const char *skip_spaces(const char *p, const char *end)
+{
+    while (p < end && *p == ' ')
+        p++;
+    return p;
+}
+
+static bool parse_row(const csv_job *job, const char *p, const char *eol, FLT_TYP *x_row, FLT_TYP *trg_row)
+{
+    for (IND_TYP c = 0; c < job->nbr_cols; c++)
+    {
+        IND_TYP xc = job->x_col[c];
+        IND_TYP tc = (job->trg_col) ? job->trg_col[c] : -1;
+        if (xc < 0 && tc < 0)
+        {
+            // unused column: only find its end
+            const char *d = memchr(p, job->delim, (size_t)(eol - p));
+            p = (d) ? d : eol;
+        }
+        else
+        {
+            double v;
+            p = data_points_parse_flt(skip_spaces(p, eol), eol, &v);
+            if (!p)
+                return false;
+            p = skip_spaces(p, eol);
+            if (xc >= 0)
+                x_row[xc] = (FLT_TYP)v;
+            if (tc >= 0)
+                trg_row[tc] = (FLT_TYP)v;
+        }
+        if (c + 1 < job->nbr_cols)
+        {
+            if (p == eol || *p != job->delim)
+                return false;
+            p++;
+        }
+    }
+    return p == eol;
+}
+
+static int parse_rows(void *arg)
+{
+    csv_range *rg = (csv_range *)arg;
+    const csv_job *job = rg->job;
+    const char *p = job->data + rg->beg;
+    const char *end = job->data + rg->end;
+    IND_TYP r = rg->row0;
+    rg->bad_row = -1;
+    while (p < end)
+    {
+        const char *eol;
+        const char *nxt = next_line(p, end, &eol);
+        if (eol > p)
+        {
+            FLT_TYP *x_row = data_points_ptr_at(job->data_x, r);
+            FLT_TYP *trg_row = (job->data_trg) ? data_points_ptr_at(job->data_trg, r) : NULL;
+            if (!parse_row(job, p, eol, x_row, trg_row))
+            {
+                rg->bad_row = r;
+                return 1;
+            }
+            r++;
+        }
+        p = nxt;
+    }
+    return 0;
+}
+
+// per column index into the row of the slice, -1 for columns not in it
+static IND_TYP *column_map(slice sly, IND_TYP nbr_cols)
+{
+    IND_TYP *col = (IND_TYP *)malloc(nbr_cols * sizeof(IND_TYP));
+    assert(col);
+    for (IND_TYP c = 0; c < nbr_cols; c++)
+        col[c] = -1;
+    for (IND_TYP k = 0; k < sly.len; k++)
+        col[slice_index(&sly, k)] = k;
+    return col;
+}
+
+IND_TYP data_points_load_csv(data_points *data_x, data_points *data_trg, const char *file_path,
+                             const data_points_csv_params *params)
+{
+    assert(data_x);
+    assert(file_path);
+    const data_points_csv_params dflt_params = data_points_csv_params_DEFAULT;
+    if (!params)
+        params = &dflt_params;
+
+    nn_mapping map = nn_mapping_NULL;
+    if (!nn_mapping_open(&map, file_path))
+        return -1;
+    nn_mapping_advise(&map, 0, map.size, NN_MAP_SEQUENTIAL);
+    const char *data = (const char *)map.addr;
+    const char *end = data + map.size;
+
+    // the first row gives the delimiter and the nbr of columns
+    const char *p = data, *eol = data;
+    if (params->header)
+        p = next_line(p, end, &eol);
+    size_t beg = (size_t)(p - data);
+    while (p < end)
+    {
+        const char *nxt = next_line(p, end, &eol);
+        if (eol > p)
+            break;
+        p = nxt;
+    }
+    if (p == end)
+    {
+        log_msg(LOG_ERR, "data_points_load_csv: %s has no data rows!", file_path);
+        nn_mapping_close(&map);
+        return -1;
+    }
+    char delim = params->delim;
+    if (!delim)
+        delim = (memchr(p, '\t', (size_t)(eol - p))) ? '\t' : ',';
+    IND_TYP nbr_cols = 1;
+    for (const char *q = p; q < eol; q++)
+        nbr_cols += (*q == delim);
+
+    slice x_sly = params->x_sly;
+    slice trg_sly = params->trg_sly;
+    slice_regulate(&x_sly, nbr_cols);
+    slice_regulate(&trg_sly, nbr_cols);
+    if (x_sly.len <= 0 || (data_trg && trg_sly.len <= 0))
+    {
+        log_msg(LOG_ERR, "data_points_load_csv: the column slices select no column of the %ld!", (long)nbr_cols);
+        nn_mapping_close(&map);
+        return -1;
+    }
+
+    csv_job job = {.data = data, .delim = delim, .nbr_cols = nbr_cols,
+                   .data_x = data_x, .data_trg = data_trg};
+    IND_TYP *x_col = column_map(x_sly, nbr_cols);
+    IND_TYP *trg_col = (data_trg) ? column_map(trg_sly, nbr_cols) : NULL;
+    job.x_col = x_col;
+    job.trg_col = trg_col;
+
+    // byte ranges starting at line starts
+    size_t size = map.size - beg;
+    int nbr_threads = nn_par_nbr_threads(params->nbr_threads, (IND_TYP)(size / DATA_POINTS_CSV_MIN_RANGE + 1));
+    csv_range *rg = (csv_range *)calloc(nbr_threads, sizeof(csv_range));
+    assert(rg);
+    for (int t = 0; t < nbr_threads; t++)
+    {
+        rg[t].job = &job;
+        rg[t].beg = beg + size * t / nbr_threads;
+        if (t > 0)
+        {
+            const char *nl = memchr(data + rg[t].beg - 1, '\n', (size_t)(end - (data + rg[t].beg - 1)));
+            rg[t].beg = (nl) ? (size_t)(nl + 1 - data) : map.size;
+            if (rg[t].beg < rg[t - 1].beg)
+                rg[t].beg = rg[t - 1].beg;
+        }
+    }
+    for (int t = 0; t < nbr_threads; t++)
+        rg[t].end = (t + 1 < nbr_threads) ? rg[t + 1].beg : map.size;
+
+    nn_par_run_tasks(nbr_threads, count_rows, rg, sizeof(csv_range));
+    IND_TYP nbr_rows = 0;
+    for (int t = 0; t < nbr_threads; t++)
+    {
+        rg[t].row0 = nbr_rows;
+        nbr_rows += rg[t].nbr_rows;
+    }
+
+    // sized once, filled in place
+    data_points_construct(data_x, x_sly.len, nbr_rows);
+    data_x->nbr_points = nbr_rows;
+    if (data_trg)
+    {
+        data_points_construct(data_trg, trg_sly.len, nbr_rows);
+        data_trg->nbr_points = nbr_rows;
+    }
+    int nbr_fails = nn_par_run_tasks(nbr_threads, parse_rows, rg, sizeof(csv_range));
+    if (nbr_fails > 0)
+    {
+        for (int t = 0; t < nbr_threads; t++)
+        {
+            if (rg[t].bad_row >= 0)
+            {
+                log_msg(LOG_ERR, "data_points_load_csv: %s: data row %ld can't be parsed!", file_path, (long)rg[t].bad_row);
+                break;
+            }
+        }
+        data_points_destruct(data_x);
+        if (data_trg)
+            data_points_destruct(data_trg);
+        nbr_rows = -1;
+    }
+    free(rg);
+    free(x_col);
+    free(trg_col);
+    nn_mapping_close(&map);
+    return nbr_rows;
+}
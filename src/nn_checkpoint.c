@@ -0,0 +1,263 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "nn_checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nn_mmap.h"
+#include "log.h"
+
+// checkpoint file format; all fields in the byte order of the writer, checked by byte_order
+#define NN_CHECKPOINT_MAGIC "NNCKPT"
+#define NN_CHECKPOINT_VERSION 2
+#define NN_CHECKPOINT_BYTE_ORDER 0x01020304u
+
+// followed by model_size bytes of a model file (nn_model_file_serialize) and optim_size bytes
+// of nn_optim_serialize
+typedef struct nn_checkpoint_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flt_size;   // sizeof(FLT_TYP) of the writer
+    uint32_t byte_order; // NN_CHECKPOINT_BYTE_ORDER
+    int32_t epoch;
+    uint64_t seed;
+    uint64_t model_size;
+    uint64_t optim_size;
+} nn_checkpoint_header;
+
+static size_t serial_size(const nn_model *model, const nn_optim *optimizer)
+{
+    return sizeof(nn_checkpoint_header) + nn_model_file_size(model) + nn_optim_serial_size(optimizer);
+}
+
+// writes serial_size bytes
+static void serialize(const nn_model *model, const nn_optim *optimizer, const nn_checkpoint_state *state,
+                      uint8_t *byte_arr)
+{
+    nn_checkpoint_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, NN_CHECKPOINT_MAGIC, sizeof(NN_CHECKPOINT_MAGIC));
+    hdr.version = NN_CHECKPOINT_VERSION;
+    hdr.flt_size = sizeof(FLT_TYP);
+    hdr.byte_order = NN_CHECKPOINT_BYTE_ORDER;
+    hdr.epoch = state->epoch;
+    hdr.seed = state->seed;
+    hdr.model_size = nn_model_file_size(model);
+    hdr.optim_size = nn_optim_serial_size(optimizer);
+    memcpy(byte_arr, &hdr, sizeof(hdr));
+    uint8_t *end = nn_model_file_serialize(model, byte_arr + sizeof(hdr));
+    end = nn_optim_serialize(optimizer, end);
+    assert((size_t)(end - byte_arr) == sizeof(hdr) + hdr.model_size + hdr.optim_size);
+    (void)end;
+}
+
+// written next to the destination and renamed over it once complete
+static int write_file(const char *file_path, const uint8_t *bytes, size_t size)
+{
+    nn_file_replace rep;
+    if (nn_file_replace_open(&rep, file_path) < 0)
+        return -1;
+    return nn_file_replace_close(&rep, file_path, nn_file_write_all(rep.fd, bytes, size));
+}
+
+static int writer(void *arg)
+{
+    nn_checkpoint *ck = (nn_checkpoint *)arg;
+    mtx_lock(&ck->mtx);
+    for (;;)
+    {
+        while (ck->pending < 0 && !ck->stop)
+            cnd_wait(&ck->cnd, &ck->mtx);
+        if (ck->pending < 0)
+            break;
+        int slot = ck->writing = ck->pending;
+        ck->pending = -1;
+        mtx_unlock(&ck->mtx);
+
+        int status = write_file(ck->file_path, ck->buf[slot], ck->size[slot]);
+
+        mtx_lock(&ck->mtx);
+        ck->writing = -1;
+        ck->status = status;
+        ck->nbr_written++;
+        cnd_broadcast(&ck->cnd);
+    }
+    mtx_unlock(&ck->mtx);
+    return 0;
+}
+
+nn_checkpoint *nn_checkpoint_start(nn_checkpoint *ck, const char *file_path)
+{
+    assert(ck);
+    assert(file_path);
+    *ck = (nn_checkpoint){.pending = -1, .writing = -1};
+    ck->file_path = strdup(file_path);
+    assert(ck->file_path);
+    bool mtx_ok = mtx_init(&ck->mtx, mtx_plain) == thrd_success;
+    bool cnd_ok = mtx_ok && cnd_init(&ck->cnd) == thrd_success;
+    if (!cnd_ok || thrd_create(&ck->thrd, writer, ck) != thrd_success)
+    {
+        log_msg(LOG_ERR, "nn_checkpoint_start: cannot start the writer thread!");
+        if (cnd_ok)
+            cnd_destroy(&ck->cnd);
+        if (mtx_ok)
+            mtx_destroy(&ck->mtx);
+        free(ck->file_path);
+        ck->file_path = NULL;
+        return NULL;
+    }
+    return ck;
+}
+
+void nn_checkpoint_snapshot(nn_checkpoint *ck, const nn_model *model, const nn_optim *optimizer,
+                            const nn_checkpoint_state *state)
+{
+    assert(ck && ck->file_path);
+    assert(model && optimizer && state);
+    // the slot not being written; a snapshot still waiting in it is replaced
+    mtx_lock(&ck->mtx);
+    int slot = (ck->writing == 0) ? 1 : 0;
+    if (ck->pending == slot)
+    {
+        ck->pending = -1;
+        ck->nbr_dropped++;
+    }
+    mtx_unlock(&ck->mtx);
+
+    size_t size = serial_size(model, optimizer);
+    if (size > ck->capacity[slot])
+    {
+        free(ck->buf[slot]);
+        ck->buf[slot] = (uint8_t *)malloc(size);
+        assert(ck->buf[slot]);
+        ck->capacity[slot] = size;
+    }
+    serialize(model, optimizer, state, ck->buf[slot]);
+    ck->size[slot] = size;
+
+    mtx_lock(&ck->mtx);
+    ck->pending = slot;
+    ck->nbr_snapshots++;
+    cnd_broadcast(&ck->cnd);
+    mtx_unlock(&ck->mtx);
+}
+
+int nn_checkpoint_flush(nn_checkpoint *ck)
+{
+    assert(ck && ck->file_path);
+    mtx_lock(&ck->mtx);
+    while (ck->pending >= 0 || ck->writing >= 0)
+        cnd_wait(&ck->cnd, &ck->mtx);
+    int status = ck->status;
+    mtx_unlock(&ck->mtx);
+    return status;
+}
+
+int nn_checkpoint_stop(nn_checkpoint *ck)
+{
+    assert(ck && ck->file_path);
+    mtx_lock(&ck->mtx);
+    ck->stop = true;
+    cnd_broadcast(&ck->cnd);
+    mtx_unlock(&ck->mtx);
+    // the writer writes the pending snapshot before it stops
+    thrd_join(ck->thrd, NULL);
+    int status = ck->status;
+    log_msg(LOG_DBG, "nn_checkpoint: %ld snapshots, %ld written, %ld replaced before written.",
+            ck->nbr_snapshots, ck->nbr_written, ck->nbr_dropped);
+    cnd_destroy(&ck->cnd);
+    mtx_destroy(&ck->mtx);
+    for (int s = 0; s < 2; s++)
+        free(ck->buf[s]);
+    free(ck->file_path);
+    *ck = (nn_checkpoint){.pending = -1, .writing = -1, .status = status};
+    return status;
+}
+
+int nn_checkpoint_save(const char *file_path, const nn_model *model, const nn_optim *optimizer,
+                       const nn_checkpoint_state *state)
+{
+    assert(file_path);
+    assert(model && optimizer && state);
+    size_t size = serial_size(model, optimizer);
+    uint8_t *bytes = (uint8_t *)malloc(size);
+    assert(bytes);
+    serialize(model, optimizer, state, bytes);
+    int status = write_file(file_path, bytes, size);
+    free(bytes);
+    return status;
+}
+
+// returns what is wrong with the header, NULL if it can be read
+static const char *check_header(const nn_checkpoint_header *hdr, size_t file_size)
+{
+    if (memcmp(hdr->magic, NN_CHECKPOINT_MAGIC, sizeof(NN_CHECKPOINT_MAGIC)) != 0)
+        return "not a checkpoint file";
+    if (hdr->version != NN_CHECKPOINT_VERSION)
+        return "unsupported version";
+    if (hdr->byte_order != NN_CHECKPOINT_BYTE_ORDER)
+        return "written with another byte order";
+    if (hdr->flt_size != sizeof(FLT_TYP))
+        return "written with another FLT_TYP";
+    if (hdr->epoch < 0 || hdr->model_size > file_size || hdr->optim_size > file_size ||
+        sizeof(*hdr) + hdr->model_size + hdr->optim_size != file_size)
+        return "truncated or inconsistent file";
+    return NULL;
+}
+
+int nn_checkpoint_load(const char *file_path, nn_model *model, nn_optim *optimizer,
+                       const nn_optim_class *optim_class, nn_checkpoint_state *state)
+{
+    assert(file_path);
+    assert(model && nn_model_is_null(model));
+    assert(optimizer && optim_class && state);
+    FILE *file = fopen(file_path, "rb");
+    if (!file)
+    {
+        log_msg(LOG_ERR, "nn_checkpoint_load: can't open %s!", file_path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+    uint8_t *bytes = (file_size > 0) ? (uint8_t *)malloc(file_size) : NULL;
+    const char *err = NULL;
+    if (!bytes || fread(bytes, 1, file_size, file) != (size_t)file_size)
+        err = "can't read the file";
+    fclose(file);
+    nn_checkpoint_header hdr;
+    if (!err && (size_t)file_size < sizeof(hdr))
+        err = "not a checkpoint file";
+    if (!err)
+    {
+        memcpy(&hdr, bytes, sizeof(hdr));
+        err = check_header(&hdr, file_size);
+    }
+    // checked like a model file; the model comes packed
+    const uint8_t *model_bytes = bytes + sizeof(hdr);
+    if (!err && !nn_model_file_deserialize(model, model_bytes, hdr.model_size))
+        err = "invalid model";
+    if (!err)
+    {
+        nn_optim_construct(optimizer, optim_class, model);
+        if (!nn_optim_deserialize(optimizer, model_bytes + hdr.model_size, hdr.optim_size))
+        {
+            err = "the optimizer state does not fit the optimizer class";
+            nn_optim_destruct(optimizer);
+            nn_model_destruct(model);
+        }
+    }
+    free(bytes);
+    if (err)
+    {
+        log_msg(LOG_ERR, "nn_checkpoint_load: %s: %s!", file_path, err);
+        return -1;
+    }
+    *state = (nn_checkpoint_state){.epoch = hdr.epoch, .seed = hdr.seed};
+    log_msg(LOG_INF, "nn_checkpoint_load: %s: resuming after epoch %d.", file_path, hdr.epoch);
+    return 0;
+}
@@ -0,0 +1,326 @@
+#include "nn_dense.h"
+
+#include <assert.h>
+#include <math.h>
+
+#ifdef FLD_FLT64
+#define EXP exp
+#define TANH tanh
+#else
+#define EXP expf
+#define TANH tanhf
+#endif
+
+// number of independent partial sums in the dot products; lets the compiler
+// vectorize the reductions without reassociating floating point ops
+#define NN_DENSE_LANES 8
+// nbr of weight rows kept hot in cache while the batch rows sweep over them
+#define NN_DENSE_BLK_OUT 64
+
+static inline FLT_TYP dot(const FLT_TYP *restrict x, const FLT_TYP *restrict y, IND_TYP n)
+{
+    FLT_TYP acc[NN_DENSE_LANES] = {0};
+    IND_TYP i = 0;
+    for (; i + NN_DENSE_LANES <= n; i += NN_DENSE_LANES)
+        for (int k = 0; k < NN_DENSE_LANES; k++)
+            acc[k] += x[i + k] * y[i + k];
+    FLT_TYP sum = 0;
+    for (; i < n; i++)
+        sum += x[i] * y[i];
+    for (int k = 0; k < NN_DENSE_LANES; k++)
+        sum += acc[k];
+    return sum;
+}
+
+// dot products of four rows of x against the same row y, which stays in L1 between them;
+// separate dot calls vectorize far better than one interleaved loop
+static inline void dot4(FLT_TYP *restrict res,
+                        const FLT_TYP *x0, const FLT_TYP *x1, const FLT_TYP *x2, const FLT_TYP *x3,
+                        const FLT_TYP *y, IND_TYP n)
+{
+    res[0] = dot(x0, y, n);
+    res[1] = dot(x1, y, n);
+    res[2] = dot(x2, y, n);
+    res[3] = dot(x3, y, n);
+}
+
+static inline FLT_TYP act_f(FLT_TYP x, enum nn_activ_enum act)
+{
+    switch (act)
+    {
+    case ACTIV_SIGMOID:
+        return 1 / (1 + EXP(-x));
+    case ACTIV_TANH:
+        return TANH(x);
+    case ACTIV_RELU:
+        return (x > 0) ? x : 0;
+    default:
+        return x;
+    }
+}
+
+// derivative from the pre-activation s or the activation a, whichever is cheaper
+static inline FLT_TYP act_drv(FLT_TYP s, FLT_TYP a, enum nn_activ_enum act)
+{
+    switch (act)
+    {
+    case ACTIV_SIGMOID:
+        return a * (1 - a);
+    case ACTIV_TANH:
+        return 1 - a * a;
+    case ACTIV_RELU:
+        return (FLT_TYP)(s > 0);
+    default:
+        return 1;
+    }
+}
+
+// GEMM with bias + activation (+ dropout mask) as epilogue; inlined with a constant act per caller
+static inline void forward_kern(FLT_TYP *s, FLT_TYP *a, const FLT_TYP *a_in, IND_TYP nbr_rows,
+                                const FLT_TYP *w, const FLT_TYP *b,
+                                IND_TYP out_sz, IND_TYP inp_sz, enum nn_activ_enum act,
+                                const uint64_t *mask)
+{
+    IND_TYP mw = NN_DENSE_MASK_WORDS(out_sz);
+    for (IND_TYP o0 = 0; o0 < out_sz; o0 += NN_DENSE_BLK_OUT)
+    {
+        IND_TYP o1 = (o0 + NN_DENSE_BLK_OUT < out_sz) ? o0 + NN_DENSE_BLK_OUT : out_sz;
+        IND_TYP r = 0;
+        for (; r + 4 <= nbr_rows; r += 4)
+        {
+            const FLT_TYP *a0 = a_in + r * inp_sz;
+            for (IND_TYP o = o0; o < o1; o++)
+            {
+                FLT_TYP res[4];
+                dot4(res, a0, a0 + inp_sz, a0 + 2 * inp_sz, a0 + 3 * inp_sz, w + o * inp_sz, inp_sz);
+                for (int k = 0; k < 4; k++)
+                {
+                    FLT_TYP s_v = res[k] + b[o];
+                    if (s)
+                        s[(r + k) * out_sz + o] = s_v;
+                    FLT_TYP a_v = act_f(s_v, act);
+                    if (mask && !nn_dense_mask_bit(mask + (r + k) * mw, o))
+                        a_v = 0;
+                    a[(r + k) * out_sz + o] = a_v;
+                }
+            }
+        }
+        for (; r < nbr_rows; r++)
+            for (IND_TYP o = o0; o < o1; o++)
+            {
+                FLT_TYP s_v = dot(a_in + r * inp_sz, w + o * inp_sz, inp_sz) + b[o];
+                if (s)
+                    s[r * out_sz + o] = s_v;
+                FLT_TYP a_v = act_f(s_v, act);
+                if (mask && !nn_dense_mask_bit(mask + r * mw, o))
+                    a_v = 0;
+                a[r * out_sz + o] = a_v;
+            }
+    }
+}
+
+void nn_dense_forward(FLT_TYP *s, const FLT_TYP *a, IND_TYP nbr_rows,
+                      const FLT_TYP *w, const FLT_TYP *b,
+                      IND_TYP out_sz, IND_TYP inp_sz)
+{
+    assert(s && a && w && b);
+    assert(nbr_rows >= 0 && out_sz > 0 && inp_sz > 0);
+
+    forward_kern(NULL, s, a, nbr_rows, w, b, out_sz, inp_sz, ACTIV_ID, NULL);
+}
+
+void nn_dense_forward_act(FLT_TYP *s, FLT_TYP *a, const FLT_TYP *a_in, IND_TYP nbr_rows,
+                          const FLT_TYP *w, const FLT_TYP *b,
+                          IND_TYP out_sz, IND_TYP inp_sz, enum nn_activ_enum act,
+                          const uint64_t *mask)
+{
+    assert(a && a_in && w && b);
+    assert(nbr_rows >= 0 && out_sz > 0 && inp_sz > 0);
+    assert(nn_dense_is_fusable(act));
+
+    switch (act)
+    {
+    case ACTIV_SIGMOID:
+        forward_kern(s, a, a_in, nbr_rows, w, b, out_sz, inp_sz, ACTIV_SIGMOID, mask);
+        break;
+    case ACTIV_TANH:
+        forward_kern(s, a, a_in, nbr_rows, w, b, out_sz, inp_sz, ACTIV_TANH, mask);
+        break;
+    case ACTIV_RELU:
+        forward_kern(s, a, a_in, nbr_rows, w, b, out_sz, inp_sz, ACTIV_RELU, mask);
+        break;
+    default:
+        forward_kern(s, a, a_in, nbr_rows, w, b, out_sz, inp_sz, ACTIV_ID, mask);
+        break;
+    }
+}
+
+static inline void activate_kern(FLT_TYP *a, const FLT_TYP *s, IND_TYP n, enum nn_activ_enum act)
+{
+    for (IND_TYP i = 0; i < n; i++)
+        a[i] = act_f(s[i], act);
+}
+
+void nn_dense_activate(FLT_TYP *a, const FLT_TYP *s, IND_TYP n, enum nn_activ_enum act)
+{
+    assert(a && s);
+    assert(nn_dense_is_fusable(act));
+
+    switch (act)
+    {
+    case ACTIV_SIGMOID:
+        activate_kern(a, s, n, ACTIV_SIGMOID);
+        break;
+    case ACTIV_TANH:
+        activate_kern(a, s, n, ACTIV_TANH);
+        break;
+    case ACTIV_RELU:
+        activate_kern(a, s, n, ACTIV_RELU);
+        break;
+    default:
+        if (a != s)
+            activate_kern(a, s, n, ACTIV_ID);
+        break;
+    }
+}
+
+static inline void delta_kern(FLT_TYP *restrict dlt, const FLT_TYP *restrict err,
+                              const FLT_TYP *restrict s, const FLT_TYP *restrict a,
+                              IND_TYP nbr_rows, IND_TYP width, enum nn_activ_enum act,
+                              const uint64_t *mask)
+{
+    IND_TYP mw = NN_DENSE_MASK_WORDS(width);
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        IND_TYP off = r * width;
+        for (IND_TYP u = 0; u < width; u++)
+            dlt[off + u] = act_drv(s[off + u], a[off + u], act) * err[off + u];
+        if (mask)
+            for (IND_TYP u = 0; u < width; u++)
+                if (!nn_dense_mask_bit(mask + r * mw, u))
+                    dlt[off + u] = 0;
+    }
+}
+
+void nn_dense_delta(FLT_TYP *dlt, const FLT_TYP *err, const FLT_TYP *s, const FLT_TYP *a,
+                    IND_TYP nbr_rows, IND_TYP width, enum nn_activ_enum act, const uint64_t *mask)
+{
+    assert(dlt && err && s && a);
+    assert(nn_dense_is_fusable(act));
+
+    switch (act)
+    {
+    case ACTIV_SIGMOID:
+        delta_kern(dlt, err, s, a, nbr_rows, width, ACTIV_SIGMOID, mask);
+        break;
+    case ACTIV_TANH:
+        delta_kern(dlt, err, s, a, nbr_rows, width, ACTIV_TANH, mask);
+        break;
+    case ACTIV_RELU:
+        delta_kern(dlt, err, s, a, nbr_rows, width, ACTIV_RELU, mask);
+        break;
+    default:
+        delta_kern(dlt, err, s, a, nbr_rows, width, ACTIV_ID, mask);
+        break;
+    }
+}
+
+void nn_dense_backward_param(FLT_TYP *d_w, FLT_TYP *d_b,
+                             const FLT_TYP *dlt, const FLT_TYP *a, IND_TYP nbr_rows,
+                             FLT_TYP alpha, IND_TYP out_sz, IND_TYP inp_sz)
+{
+    assert(d_w && d_b && dlt && a);
+    assert(nbr_rows >= 0 && out_sz > 0 && inp_sz > 0);
+
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        const FLT_TYP *restrict dlt_r = dlt + r * out_sz;
+        for (IND_TYP o = 0; o < out_sz; o++)
+            d_b[o] += dlt_r[o];
+    }
+    // each gradient row is read and written once per four batch rows
+    for (IND_TYP o = 0; o < out_sz; o++)
+    {
+        FLT_TYP *restrict dw = d_w + o * inp_sz;
+        IND_TYP r = 0;
+        for (; r + 4 <= nbr_rows; r += 4)
+        {
+            FLT_TYP c0 = alpha * dlt[r * out_sz + o];
+            FLT_TYP c1 = alpha * dlt[(r + 1) * out_sz + o];
+            FLT_TYP c2 = alpha * dlt[(r + 2) * out_sz + o];
+            FLT_TYP c3 = alpha * dlt[(r + 3) * out_sz + o];
+            if (c0 == 0 && c1 == 0 && c2 == 0 && c3 == 0)
+                continue;
+            const FLT_TYP *restrict a0 = a + r * inp_sz;
+            const FLT_TYP *restrict a1 = a0 + inp_sz;
+            const FLT_TYP *restrict a2 = a1 + inp_sz;
+            const FLT_TYP *restrict a3 = a2 + inp_sz;
+            for (IND_TYP i = 0; i < inp_sz; i++)
+                dw[i] += c0 * a0[i] + c1 * a1[i] + c2 * a2[i] + c3 * a3[i];
+        }
+        for (; r < nbr_rows; r++)
+        {
+            FLT_TYP c = alpha * dlt[r * out_sz + o];
+            if (c == 0)
+                continue;
+            const FLT_TYP *restrict a_r = a + r * inp_sz;
+            for (IND_TYP i = 0; i < inp_sz; i++)
+                dw[i] += c * a_r[i];
+        }
+    }
+}
+
+void nn_dense_backward_error(FLT_TYP *e, const FLT_TYP *dlt, IND_TYP nbr_rows,
+                             const FLT_TYP *w, IND_TYP out_sz, IND_TYP inp_sz)
+{
+    assert(e && dlt && w);
+    assert(nbr_rows >= 0 && out_sz > 0 && inp_sz > 0);
+
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        FLT_TYP *restrict e_r = e + r * inp_sz;
+        for (IND_TYP i = 0; i < inp_sz; i++)
+            e_r[i] = 0;
+    }
+    for (IND_TYP o0 = 0; o0 < out_sz; o0 += NN_DENSE_BLK_OUT)
+    {
+        IND_TYP o1 = (o0 + NN_DENSE_BLK_OUT < out_sz) ? o0 + NN_DENSE_BLK_OUT : out_sz;
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+        {
+            FLT_TYP *restrict e_r = e + r * inp_sz;
+            const FLT_TYP *dlt_r = dlt + r * out_sz;
+            IND_TYP o = o0;
+            for (; o + 4 <= o1; o += 4)
+            {
+                FLT_TYP c0 = dlt_r[o], c1 = dlt_r[o + 1], c2 = dlt_r[o + 2], c3 = dlt_r[o + 3];
+                const FLT_TYP *restrict w0 = w + o * inp_sz;
+                const FLT_TYP *restrict w1 = w0 + inp_sz;
+                const FLT_TYP *restrict w2 = w1 + inp_sz;
+                const FLT_TYP *restrict w3 = w2 + inp_sz;
+                for (IND_TYP i = 0; i < inp_sz; i++)
+                    e_r[i] += c0 * w0[i] + c1 * w1[i] + c2 * w2[i] + c3 * w3[i];
+            }
+            for (; o < o1; o++)
+            {
+                FLT_TYP c = dlt_r[o];
+                const FLT_TYP *restrict w_o = w + o * inp_sz;
+                for (IND_TYP i = 0; i < inp_sz; i++)
+                    e_r[i] += c * w_o[i];
+            }
+        }
+    }
+}
+
+void nn_dense_mask_rows(FLT_TYP *a, const uint64_t *mask, IND_TYP nbr_rows, IND_TYP width)
+{
+    assert(a && mask);
+    IND_TYP mw = NN_DENSE_MASK_WORDS(width);
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        FLT_TYP *restrict row = a + r * width;
+        const uint64_t *mask_row = mask + r * mw;
+        for (IND_TYP u = 0; u < width; u++)
+            if (!nn_dense_mask_bit(mask_row, u))
+                row[u] = 0;
+    }
+}
@@ -0,0 +1,623 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "nn_dist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <assert.h>
+
+#include "log.h"
+
+#if ATOMIC_INT_LOCK_FREE != 2
+#error "nn_dist needs lock-free atomics to synchronise processes through shared memory"
+#endif
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void pause_us(long us)
+{
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+// Busy waits at first, then yields the core and finally sleeps, so that waiting ranks
+// don't take the cores of the ranks still computing; false once timeout seconds are over.
+typedef struct waiter
+{
+    long spins;
+    double t_start;
+} waiter;
+
+static bool wait_more(waiter *w, double timeout)
+{
+    w->spins++;
+    if (w->spins < 1024)
+        return true;
+    if (w->spins == 1024)
+        w->t_start = now();
+    else if (w->spins % 64 == 0 && now() - w->t_start > timeout)
+        return false;
+    if (w->spins < 8192)
+        sched_yield();
+    else
+        pause_us(50);
+    return true;
+}
+
+static inline int ring(int rank, int nbr_ranks)
+{
+    return ((rank % nbr_ranks) + nbr_ranks) % nbr_ranks;
+}
+
+// -------------------------------- shared memory --------------------------------
+
+// the segment: the header, nbr_ranks slots of NN_DIST_SHM_CHUNK values and the result area
+#define SHM_READY 0x4e4e4453u
+#define SHM_HEADER_SIZE 256
+
+typedef struct shm_header
+{
+    atomic_uint ready; // SHM_READY once rank 0 has set it up
+    atomic_int attached;
+    atomic_int started; // set by rank 0 once all ranks are attached and the name is unlinked
+    atomic_int failed;  // a rank gave up; the others stop waiting
+    int nbr_ranks;
+    // barrier
+    alignas(64) atomic_uint count;
+    alignas(64) atomic_uint generation;
+} shm_header;
+
+static_assert(sizeof(shm_header) <= SHM_HEADER_SIZE, "shm_header does not fit");
+
+static inline shm_header *shm_hdr(const nn_dist *dist)
+{
+    return (shm_header *)dist->seg;
+}
+
+static inline FLT_TYP *shm_slot(const nn_dist *dist, int rank)
+{
+    return (FLT_TYP *)((char *)dist->seg + SHM_HEADER_SIZE) + (size_t)rank * NN_DIST_SHM_CHUNK;
+}
+
+static int shm_barrier(nn_dist *dist)
+{
+    shm_header *hdr = shm_hdr(dist);
+    unsigned gen = atomic_load_explicit(&hdr->generation, memory_order_acquire);
+    if (atomic_fetch_add_explicit(&hdr->count, 1, memory_order_acq_rel) + 1 == (unsigned)dist->nbr_ranks)
+    {
+        atomic_store_explicit(&hdr->count, 0, memory_order_relaxed);
+        atomic_fetch_add_explicit(&hdr->generation, 1, memory_order_release);
+        return 0;
+    }
+    waiter w = {0};
+    while (atomic_load_explicit(&hdr->generation, memory_order_acquire) == gen)
+    {
+        if (atomic_load_explicit(&hdr->failed, memory_order_relaxed) || !wait_more(&w, dist->timeout))
+        {
+            atomic_store(&hdr->failed, 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// whether the shared memory object linked at path, if any, is still the inode ino
+static bool shm_still_linked(const char *path, ino_t ino)
+{
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0)
+        return true; // unlinked by rank 0, which has started or is replacing it
+    struct stat st;
+    bool same = fstat(fd, &st) != 0 || st.st_ino == ino;
+    close(fd);
+    return same;
+}
+
+// Ranks > 0: a segment left over by a failed run stays linked at path until rank 0 replaces
+// it, and already looks set up. So a rank counts as attached to the segment it mapped only
+// once rank 0 has started the run in it, and moves on to the segment linked at path whenever
+// that changes before. Returns the mapping, or MAP_FAILED (logged).
+static void *shm_attach(nn_dist *dist, const char *path, size_t size)
+{
+    waiter w = {0};
+    bool wrong_size = false;
+    for (;;)
+    {
+        void *seg = MAP_FAILED;
+        struct stat st;
+        int fd = shm_open(path, O_RDWR, 0);
+        // rank 0 may not have created (and sized) it yet
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size != 0)
+        {
+            wrong_size = (size_t)st.st_size != size;
+            if (!wrong_size)
+                seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (fd >= 0)
+            close(fd);
+        bool ok = true;
+        if (seg != MAP_FAILED)
+        {
+            shm_header *hdr = (shm_header *)seg;
+            bool attached = false;
+            while (ok && !atomic_load_explicit(&hdr->started, memory_order_acquire))
+            {
+                if (!attached && atomic_load_explicit(&hdr->ready, memory_order_acquire) == SHM_READY &&
+                    hdr->nbr_ranks == dist->nbr_ranks)
+                {
+                    atomic_fetch_add_explicit(&hdr->attached, 1, memory_order_release);
+                    attached = true;
+                }
+                if (atomic_load_explicit(&hdr->failed, memory_order_relaxed) || !shm_still_linked(path, st.st_ino))
+                    break;
+                ok = wait_more(&w, dist->timeout);
+            }
+            if (atomic_load_explicit(&hdr->started, memory_order_acquire))
+                return seg;
+            if (attached)
+                atomic_fetch_sub_explicit(&hdr->attached, 1, memory_order_release);
+            munmap(seg, size);
+        }
+        else
+            ok = wait_more(&w, dist->timeout);
+        if (!ok)
+            break;
+    }
+    if (wrong_size)
+        log_msg(LOG_ERR, "nn_dist_open: %s has the wrong size; do all ranks use the same nbr of ranks?", path);
+    else
+        log_msg(LOG_ERR, "nn_dist_open: rank %d: the ranks did not meet in %s!", dist->rank, path);
+    return MAP_FAILED;
+}
+
+static nn_dist *shm_connect(nn_dist *dist, const char *name)
+{
+    char path[256];
+    if (strchr(name, '/') || snprintf(path, sizeof(path), "/nn_dist_%s", name) >= (int)sizeof(path))
+    {
+        log_msg(LOG_ERR, "nn_dist_open: invalid shared memory name '%s'!", name);
+        return NULL;
+    }
+    size_t size = SHM_HEADER_SIZE + (size_t)(dist->nbr_ranks + 1) * NN_DIST_SHM_CHUNK * sizeof(FLT_TYP);
+    if (dist->rank > 0)
+    {
+        void *seg = shm_attach(dist, path, size);
+        if (seg == MAP_FAILED)
+            return NULL;
+        dist->seg = seg;
+        dist->seg_size = size;
+        return dist;
+    }
+
+    // left over by a run that failed
+    shm_unlink(path);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0 && ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        shm_unlink(path);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        log_msg(LOG_ERR, "nn_dist_open: rank 0 can't create the shared memory %s: %s!", path, strerror(errno));
+        return NULL;
+    }
+    void *seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+    {
+        log_msg(LOG_ERR, "nn_dist_open: rank 0 can't map %s: %s!", path, strerror(errno));
+        shm_unlink(path);
+        return NULL;
+    }
+    dist->seg = seg;
+    dist->seg_size = size;
+    shm_header *hdr = shm_hdr(dist);
+
+    // the segment is zero filled
+    hdr->nbr_ranks = dist->nbr_ranks;
+    atomic_store_explicit(&hdr->ready, SHM_READY, memory_order_release);
+    bool ok = true;
+    waiter w = {0};
+    while (ok && atomic_load_explicit(&hdr->attached, memory_order_acquire) < dist->nbr_ranks - 1)
+        ok = wait_more(&w, dist->timeout);
+    // all have it mapped; the name is not needed anymore, and unlinked before the start so
+    // that no segment linked at the name has ever started
+    shm_unlink(path);
+    if (!ok)
+    {
+        log_msg(LOG_ERR, "nn_dist_open: rank 0: the ranks did not meet in %s!", path);
+        atomic_store(&hdr->failed, 1);
+        munmap(dist->seg, dist->seg_size);
+        dist->seg = NULL;
+        return NULL;
+    }
+    atomic_store_explicit(&hdr->started, 1, memory_order_release);
+    return dist;
+}
+
+// per chunk: into the own slot; barrier; the rank's part summed over the slots in rank
+// order into the result area; barrier; the result back into buf
+static int shm_allreduce(nn_dist *dist, FLT_TYP *buf, IND_TYP n)
+{
+    int nbr_ranks = dist->nbr_ranks;
+    FLT_TYP *res = shm_slot(dist, nbr_ranks);
+    for (IND_TYP off = 0; off < n; off += NN_DIST_SHM_CHUNK)
+    {
+        IND_TYP m = (n - off < NN_DIST_SHM_CHUNK) ? n - off : NN_DIST_SHM_CHUNK;
+        memcpy(shm_slot(dist, dist->rank), buf + off, m * sizeof(FLT_TYP));
+        if (shm_barrier(dist) != 0)
+            return -1;
+        IND_TYP j0 = m * dist->rank / nbr_ranks;
+        IND_TYP j1 = m * (dist->rank + 1) / nbr_ranks;
+        memcpy(res + j0, shm_slot(dist, 0) + j0, (j1 - j0) * sizeof(FLT_TYP));
+        for (int r = 1; r < nbr_ranks; r++)
+        {
+            const FLT_TYP *slot = shm_slot(dist, r);
+            for (IND_TYP j = j0; j < j1; j++)
+                res[j] += slot[j];
+        }
+        if (shm_barrier(dist) != 0)
+            return -1;
+        memcpy(buf + off, res, m * sizeof(FLT_TYP));
+    }
+    return 0;
+}
+
+static int shm_broadcast(nn_dist *dist, void *buf, size_t size, int root)
+{
+    char *bytes = (char *)buf;
+    char *res = (char *)shm_slot(dist, dist->nbr_ranks);
+    const size_t chunk = NN_DIST_SHM_CHUNK * sizeof(FLT_TYP);
+    for (size_t off = 0; off < size; off += chunk)
+    {
+        size_t m = (size - off < chunk) ? size - off : chunk;
+        // the others may still be copying out the result area (of the last chunk or call)
+        if (shm_barrier(dist) != 0)
+            return -1;
+        if (dist->rank == root)
+            memcpy(res, bytes + off, m);
+        if (shm_barrier(dist) != 0)
+            return -1;
+        if (dist->rank != root)
+            memcpy(bytes + off, res, m);
+    }
+    return 0;
+}
+
+// -------------------------------- sockets --------------------------------
+
+// bytes passed on per step of a broadcast
+#define SOCK_CHUNK (1 << 20)
+
+static bool sock_addr(struct sockaddr_un *addr, const char *name, int rank)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    return snprintf(addr->sun_path, sizeof(addr->sun_path), "%s.%d", name, rank) < (int)sizeof(addr->sun_path);
+}
+
+// Sends send_size bytes to the next rank while receiving recv_size bytes from the previous
+// one, so that a ring of ranks sending at once does not block on full socket buffers.
+static int sock_exchange(nn_dist *dist, const void *send_buf, size_t send_size, void *recv_buf, size_t recv_size)
+{
+    const char *snd = (const char *)send_buf;
+    char *rcv = (char *)recv_buf;
+    size_t sent = 0, recvd = 0;
+    double t_progress = now();
+    while (sent < send_size || recvd < recv_size)
+    {
+        struct pollfd pfd[2];
+        int nbr_fd = 0;
+        if (sent < send_size)
+            pfd[nbr_fd++] = (struct pollfd){.fd = dist->fd_next, .events = POLLOUT};
+        if (recvd < recv_size)
+            pfd[nbr_fd++] = (struct pollfd){.fd = dist->fd_prev, .events = POLLIN};
+        int left_ms = (int)((dist->timeout - (now() - t_progress)) * 1000);
+        if (left_ms <= 0)
+        {
+            log_msg(LOG_ERR, "nn_dist: rank %d: timed out waiting for its neighbours!", dist->rank);
+            return -1;
+        }
+        if (poll(pfd, nbr_fd, left_ms) < 0 && errno != EINTR)
+            return -1;
+        if (sent < send_size)
+        {
+            ssize_t wr = send(dist->fd_next, snd + sent, send_size - sent, MSG_NOSIGNAL);
+            if (wr < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                log_msg(LOG_ERR, "nn_dist: rank %d: can't send: %s!", dist->rank, strerror(errno));
+                return -1;
+            }
+            if (wr > 0)
+            {
+                sent += wr;
+                t_progress = now();
+            }
+        }
+        if (recvd < recv_size)
+        {
+            ssize_t rd = recv(dist->fd_prev, rcv + recvd, recv_size - recvd, 0);
+            if (rd == 0 || (rd < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                log_msg(LOG_ERR, "nn_dist: rank %d: can't receive: %s!", dist->rank,
+                        (rd == 0) ? "the previous rank has gone" : strerror(errno));
+                return -1;
+            }
+            if (rd > 0)
+            {
+                recvd += rd;
+                t_progress = now();
+            }
+        }
+    }
+    return 0;
+}
+
+// every rank listens on "<name>.<rank>", connects to the next rank and accepts the previous one
+static nn_dist *sock_connect(nn_dist *dist, const char *name)
+{
+    struct sockaddr_un own, next;
+    if (!sock_addr(&own, name, dist->rank) || !sock_addr(&next, name, ring(dist->rank + 1, dist->nbr_ranks)))
+    {
+        log_msg(LOG_ERR, "nn_dist_open: socket path '%s' too long!", name);
+        return NULL;
+    }
+    double t0 = now();
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(own.sun_path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&own, sizeof(own)) != 0 || listen(lfd, 1) != 0)
+    {
+        log_msg(LOG_ERR, "nn_dist_open: rank %d can't listen on %s: %s!", dist->rank, own.sun_path, strerror(errno));
+        if (lfd >= 0)
+            close(lfd);
+        return NULL;
+    }
+    // the next rank may not listen yet
+    bool ok = false;
+    while (!ok && now() - t0 < dist->timeout)
+    {
+        dist->fd_next = socket(AF_UNIX, SOCK_STREAM, 0);
+        ok = dist->fd_next >= 0 && connect(dist->fd_next, (struct sockaddr *)&next, sizeof(next)) == 0;
+        if (!ok)
+        {
+            if (dist->fd_next >= 0)
+                close(dist->fd_next);
+            dist->fd_next = -1;
+            pause_us(5000);
+        }
+    }
+    if (ok)
+    {
+        struct pollfd pfd = {.fd = lfd, .events = POLLIN};
+        int left_ms = (int)((dist->timeout - (now() - t0)) * 1000);
+        ok = left_ms > 0 && poll(&pfd, 1, left_ms) == 1 && (dist->fd_prev = accept(lfd, NULL, NULL)) >= 0;
+    }
+    close(lfd);
+    unlink(own.sun_path);
+    ok = ok && fcntl(dist->fd_next, F_SETFL, O_NONBLOCK) == 0 && fcntl(dist->fd_prev, F_SETFL, O_NONBLOCK) == 0;
+    // each rank tells the next one who it is
+    int prev = -1;
+    ok = ok && sock_exchange(dist, &dist->rank, sizeof(int), &prev, sizeof(int)) == 0;
+    if (!ok || prev != ring(dist->rank - 1, dist->nbr_ranks))
+    {
+        log_msg(LOG_ERR, "nn_dist_open: rank %d: the ring of %s could not be closed!", dist->rank, name);
+        if (dist->fd_next >= 0)
+            close(dist->fd_next);
+        if (dist->fd_prev >= 0)
+            close(dist->fd_prev);
+        dist->fd_next = dist->fd_prev = -1;
+        return NULL;
+    }
+    return dist;
+}
+
+// Ring allreduce of the segments k = 0 .. nbr_ranks - 1, [n k / nbr_ranks, n (k + 1) / nbr_ranks):
+// in step s of the reduce-scatter, rank r sends its partial sum of segment r - s and adds
+// the received one of segment r - s - 1; it ends with the full sum of segment r + 1. In the
+// all-gather the full sums are passed on around the ring.
+static int sock_allreduce(nn_dist *dist, FLT_TYP *buf, IND_TYP n)
+{
+    int nbr_ranks = dist->nbr_ranks;
+    int rank = dist->rank;
+    IND_TYP seg_cap = n / nbr_ranks + 1;
+    if (seg_cap > dist->recv_cap)
+    {
+        free(dist->recv_buf);
+        dist->recv_buf = (FLT_TYP *)malloc(seg_cap * sizeof(FLT_TYP));
+        assert(dist->recv_buf);
+        dist->recv_cap = seg_cap;
+    }
+#define SEG_BEG(k) (n * (k) / nbr_ranks)
+#define SEG_LEN(k) (SEG_BEG((k) + 1) - SEG_BEG(k))
+    for (int s = 0; s < nbr_ranks - 1; s++)
+    {
+        int ks = ring(rank - s, nbr_ranks);
+        int kr = ring(rank - s - 1, nbr_ranks);
+        if (sock_exchange(dist, buf + SEG_BEG(ks), SEG_LEN(ks) * sizeof(FLT_TYP),
+                          dist->recv_buf, SEG_LEN(kr) * sizeof(FLT_TYP)) != 0)
+            return -1;
+        FLT_TYP *seg = buf + SEG_BEG(kr);
+        for (IND_TYP j = 0; j < SEG_LEN(kr); j++)
+            seg[j] += dist->recv_buf[j];
+    }
+    for (int s = 0; s < nbr_ranks - 1; s++)
+    {
+        int ks = ring(rank + 1 - s, nbr_ranks);
+        int kr = ring(rank - s, nbr_ranks);
+        if (sock_exchange(dist, buf + SEG_BEG(ks), SEG_LEN(ks) * sizeof(FLT_TYP),
+                          buf + SEG_BEG(kr), SEG_LEN(kr) * sizeof(FLT_TYP)) != 0)
+            return -1;
+    }
+#undef SEG_LEN
+#undef SEG_BEG
+    return 0;
+}
+
+// passed around the ring from root in chunks, so the transfers of the ranks overlap
+static int sock_broadcast(nn_dist *dist, void *buf, size_t size, int root)
+{
+    char *bytes = (char *)buf;
+    bool recv = dist->rank != root;
+    bool send = ring(dist->rank + 1, dist->nbr_ranks) != root;
+    for (size_t off = 0; off < size; off += SOCK_CHUNK)
+    {
+        size_t m = (size - off < SOCK_CHUNK) ? size - off : SOCK_CHUNK;
+        if (recv && sock_exchange(dist, NULL, 0, bytes + off, m) != 0)
+            return -1;
+        if (send && sock_exchange(dist, bytes + off, m, NULL, 0) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// -------------------------------- API --------------------------------
+
+static const char *transport_str(enum nn_dist_transport transport)
+{
+    return (transport == NN_DIST_SHM) ? "shared memory" : "sockets";
+}
+
+nn_dist *nn_dist_open(nn_dist *dist, enum nn_dist_transport transport, const char *name,
+                      int rank, int nbr_ranks)
+{
+    assert(dist);
+    assert(name);
+    assert(transport == NN_DIST_SHM || transport == NN_DIST_SOCKET);
+    assert(nbr_ranks > 0 && rank >= 0 && rank < nbr_ranks);
+    *dist = nn_dist_NULL;
+    dist->transport = transport;
+    dist->rank = rank;
+    dist->nbr_ranks = nbr_ranks;
+    dist->timeout = NN_DIST_TIMEOUT;
+    if (nbr_ranks == 1)
+        return dist;
+    if (!((transport == NN_DIST_SHM) ? shm_connect(dist, name) : sock_connect(dist, name)))
+    {
+        *dist = nn_dist_NULL;
+        return NULL;
+    }
+    log_msg(LOG_DBG, "nn_dist_open: rank %d/%d connected over %s.", rank, nbr_ranks, transport_str(transport));
+    return dist;
+}
+
+void nn_dist_close(nn_dist *dist)
+{
+    assert(dist);
+    if (dist->seg)
+        munmap(dist->seg, dist->seg_size);
+    if (dist->fd_next >= 0)
+        close(dist->fd_next);
+    if (dist->fd_prev >= 0)
+        close(dist->fd_prev);
+    free(dist->recv_buf);
+    *dist = nn_dist_NULL;
+}
+
+int nn_dist_allreduce(nn_dist *dist, FLT_TYP *buf, IND_TYP n)
+{
+    assert(dist && dist->nbr_ranks > 0);
+    assert(buf || n == 0);
+    if (dist->failed)
+        return -1;
+    if (dist->nbr_ranks == 1 || n <= 0)
+        return 0;
+    int res = (dist->transport == NN_DIST_SHM) ? shm_allreduce(dist, buf, n) : sock_allreduce(dist, buf, n);
+    if (res != 0)
+    {
+        log_msg(LOG_ERR, "nn_dist_allreduce: rank %d: failed over %s!", dist->rank, transport_str(dist->transport));
+        dist->failed = true;
+    }
+    return res;
+}
+
+int nn_dist_broadcast(nn_dist *dist, void *buf, size_t size, int root)
+{
+    assert(dist && dist->nbr_ranks > 0);
+    assert(buf || size == 0);
+    assert(root >= 0 && root < dist->nbr_ranks);
+    if (dist->failed)
+        return -1;
+    if (dist->nbr_ranks == 1 || size == 0)
+        return 0;
+    int res = (dist->transport == NN_DIST_SHM) ? shm_broadcast(dist, buf, size, root)
+                                               : sock_broadcast(dist, buf, size, root);
+    if (res != 0)
+    {
+        log_msg(LOG_ERR, "nn_dist_broadcast: rank %d: failed over %s!", dist->rank, transport_str(dist->transport));
+        dist->failed = true;
+    }
+    return res;
+}
+
+slice nn_dist_shard(const nn_dist *dist, slice index_sly, IND_TYP nbr_data)
+{
+    assert(dist && dist->nbr_ranks > 0);
+    assert(slice_is_valid(&index_sly));
+    slice_regulate(&index_sly, nbr_data);
+    IND_TYP len = index_sly.len / dist->nbr_ranks;
+    IND_TYP start = slice_index(&index_sly, dist->rank * len);
+    slice shard;
+    slice_set(&shard, start, start + len * index_sly.step, index_sly.step);
+    slice_regulate(&shard, nbr_data);
+    return shard;
+}
+
+int nn_dist_fork(int nbr_ranks, int (*func)(int rank, void *arg), void *arg)
+{
+    assert(func);
+    assert(nbr_ranks > 0);
+    pid_t *pid = (pid_t *)calloc(nbr_ranks, sizeof(pid_t));
+    assert(pid);
+    // or the children would write out the buffered output of the parent again
+    fflush(NULL);
+    int nbr_fails = 0;
+    for (int r = 1; r < nbr_ranks; r++)
+    {
+        pid[r] = fork();
+        if (pid[r] == 0)
+        {
+            int res = func(r, arg);
+            fflush(NULL);
+            _exit(res != 0);
+        }
+        if (pid[r] < 0)
+        {
+            log_msg(LOG_ERR, "nn_dist_fork: cannot fork rank %d: %s!", r, strerror(errno));
+            nbr_fails++;
+        }
+    }
+    nbr_fails += func(0, arg) != 0;
+    for (int r = 1; r < nbr_ranks; r++)
+    {
+        if (pid[r] <= 0)
+            continue;
+        int status = 0;
+        while (waitpid(pid[r], &status, 0) < 0 && errno == EINTR)
+            ;
+        nbr_fails += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    free(pid);
+    return nbr_fails;
+}
@@ -0,0 +1,167 @@
+#include "nn_early_stop.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+
+#include "rnd.h"
+#include "log.h"
+
+static int cmp_ind(const void *a, const void *b)
+{
+    IND_TYP x = *(const IND_TYP *)a, y = *(const IND_TYP *)b;
+    return (x > y) - (x < y);
+}
+
+// copies nbr random rows of the validation data, in data order
+static void subsample(nn_early_stop *es, IND_TYP nbr)
+{
+    IND_TYP len = es->index_sly.len;
+    IND_TYP *ind = (IND_TYP *)malloc(len * sizeof(IND_TYP));
+    assert(ind);
+    for (IND_TYP i = 0; i < len; i++)
+        ind[i] = i;
+    rnd_shuffle_ind(ind, len, UINT_RND_GEN);
+    qsort(ind, nbr, sizeof(IND_TYP), cmp_ind);
+
+    es->sub_x = data_points_NULL;
+    es->sub_trg = data_points_NULL;
+    data_points_construct(&es->sub_x, es->x_sly.len, nbr);
+    data_points_construct(&es->sub_trg, es->trg_sly.len, nbr);
+    es->sub_x.nbr_points = es->sub_trg.nbr_points = nbr;
+    es->sub_weight = (es->data_weight) ? vec_new(nbr) : NULL;
+    for (IND_TYP r = 0; r < nbr; r++)
+    {
+        IND_TYP k = slice_index(&es->index_sly, ind[r]);
+        data_points_copy_at(es->data_x, data_points_ptr_at(&es->sub_x, r), k, &es->x_sly);
+        data_points_copy_at(es->data_trg, data_points_ptr_at(&es->sub_trg, r), k, &es->trg_sly);
+        if (es->sub_weight)
+            *vec_at(es->sub_weight, r) = *vec_at(es->data_weight, k);
+    }
+    free(ind);
+
+    es->data_x = &es->sub_x;
+    es->data_trg = &es->sub_trg;
+    es->data_weight = es->sub_weight;
+    es->x_sly = slice_NONE;
+    es->trg_sly = slice_NONE;
+    es->index_sly = slice_NONE;
+    slice_regulate(&es->x_sly, es->sub_x.width);
+    slice_regulate(&es->trg_sly, es->sub_trg.width);
+    slice_regulate(&es->index_sly, nbr);
+}
+
+nn_early_stop *nn_early_stop_construct(nn_early_stop *es,
+                                       const data_points *data_x, slice x_sly,
+                                       const data_points *data_trg, slice trg_sly,
+                                       const vec *data_weight,
+                                       slice index_sly,
+                                       const nn_loss loss,
+                                       const nn_early_stop_params *params)
+{
+    assert(es);
+    assert(data_points_is_valid(data_x));
+    assert(data_points_is_valid(data_trg));
+    assert(slice_is_valid(&x_sly));
+    assert(slice_is_valid(&trg_sly));
+    assert(slice_is_valid(&index_sly));
+    const nn_early_stop_params dflt_params = nn_early_stop_params_DEFAULT;
+    if (!params)
+        params = &dflt_params;
+
+    slice_regulate(&x_sly, data_x->width);
+    slice_regulate(&trg_sly, data_trg->width);
+    slice_regulate(&index_sly, data_x->nbr_points);
+    *es = (nn_early_stop){.params = *params, .data_x = data_x, .x_sly = x_sly,
+                          .data_trg = data_trg, .trg_sly = trg_sly, .data_weight = data_weight,
+                          .index_sly = index_sly, .loss = loss,
+                          .sub_x = data_points_NULL, .sub_trg = data_points_NULL, .sub_weight = NULL,
+                          .best_param = NULL};
+    if (params->subsample > 0 && params->subsample < index_sly.len)
+        subsample(es, params->subsample);
+    nn_early_stop_reset(es);
+    return es;
+}
+
+void nn_early_stop_destruct(nn_early_stop *es)
+{
+    assert(es);
+    if (es->data_x == &es->sub_x)
+    {
+        data_points_destruct(&es->sub_x);
+        data_points_destruct(&es->sub_trg);
+        if (es->sub_weight)
+            vec_del(es->sub_weight);
+    }
+    free(es->best_param);
+    es->best_param = NULL;
+}
+
+void nn_early_stop_reset(nn_early_stop *es)
+{
+    assert(es);
+    es->nbr_calls = 0;
+    es->last_loss = FLT_MAX;
+    es->best_loss = FLT_MAX;
+    es->best_epoch = 0;
+    es->best_batch = 0;
+    es->nbr_bad_calls = 0;
+    es->stopped = false;
+    free(es->best_param);
+    es->best_param = NULL;
+}
+
+static void restore_best(nn_early_stop *es, nn_model *model)
+{
+    if (!es->params.restore_best || !es->best_param || es->nbr_bad_calls == 0)
+        return;
+    nn_model_set_param(model, es->best_param);
+    log_msg(LOG_INF, "nn_early_stop: best weights of epoch %d (batch %ld) restored; validation loss %g.",
+            es->best_epoch, (long)es->best_batch, (double)es->best_loss);
+}
+
+bool nn_early_stop_callback(nn_model *model, const nn_model_train_info *info, void *ctx)
+{
+    nn_early_stop *es = (nn_early_stop *)ctx;
+    assert(es && model && info);
+
+    es->nbr_calls++;
+    es->last_loss = nn_model_eval_par(model, es->data_x, es->x_sly, es->data_trg, es->trg_sly,
+                                      es->data_weight, es->index_sly, es->loss,
+                                      es->params.classification, es->params.nbr_threads);
+    log_msg(LOG_DBG, "nn_early_stop: epoch %d batch %ld: validation loss %g.",
+            info->epoch, (long)info->batch, (double)es->last_loss);
+
+    if (es->last_loss < es->best_loss - es->params.min_delta)
+    {
+        es->best_loss = es->last_loss;
+        es->best_epoch = info->epoch;
+        es->best_batch = info->batch;
+        es->nbr_bad_calls = 0;
+        if (es->params.restore_best)
+        {
+            if (!es->best_param)
+            {
+                es->best_param = (FLT_TYP *)malloc(nn_model_nbr_param(model) * sizeof(FLT_TYP));
+                assert(es->best_param);
+            }
+            nn_model_get_param(model, es->best_param);
+        }
+    }
+    else
+    {
+        es->nbr_bad_calls++;
+    }
+
+    if (es->params.patience > 0 && es->nbr_bad_calls >= es->params.patience)
+    {
+        es->stopped = true;
+        log_msg(LOG_INF, "nn_early_stop: no improvement in %d calls; stopping in epoch %d.",
+                es->nbr_bad_calls, info->epoch);
+        restore_best(es, model);
+        return true;
+    }
+    if (info->epoch_end && info->epoch == info->nbr_epochs)
+        restore_best(es, model);
+    return false;
+}
@@ -0,0 +1,136 @@
+#include "nn_eval.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "nn_par.h"
+#include "log.h"
+
+typedef struct eval_args
+{
+    const nn_eval_class *cls;
+    const void *model;
+    IND_TYP input_size;
+    IND_TYP ouput_size;
+    const data_points *data_x;
+    const slice *x_sly;
+    const data_points *data_trg;
+    const slice *trg_sly;
+    const vec *data_weight;
+    const slice *index_sly;
+    const nn_loss *loss;
+    bool classification;
+    IND_TYP nbr_chunks;
+    atomic_llong *next_chunk;
+    double *chunk_loss;
+    double *chunk_nrm;
+} eval_args;
+
+static int eval_worker(void *arg)
+{
+    eval_args *ea = (eval_args *)arg;
+    IND_TYP nbr_data = ea->index_sly->len;
+    IND_TYP inp_sz = ea->input_size;
+    IND_TYP out_sz = ea->ouput_size;
+
+    void *ctx = ea->cls->construct(ea->model, NN_EVAL_CHUNK);
+    if (!ctx)
+        return -1;
+    FLT_TYP *inp = ea->cls->input(ctx);
+    vec *out = vec_new(out_sz);
+    vec *trg = vec_new(out_sz);
+    vec *buf = vec_new(out_sz);
+
+    IND_TYP c;
+    while ((c = (IND_TYP)atomic_fetch_add(ea->next_chunk, 1)) < ea->nbr_chunks)
+    {
+        IND_TYP i0 = c * NN_EVAL_CHUNK;
+        IND_TYP nbr_rows = (i0 + NN_EVAL_CHUNK <= nbr_data) ? NN_EVAL_CHUNK : nbr_data - i0;
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+            data_points_copy_at(ea->data_x, inp + r * inp_sz, slice_index(ea->index_sly, i0 + r), ea->x_sly);
+        const FLT_TYP *out_bt = ea->cls->infer_batch(ea->model, ctx, nbr_rows);
+        double loss_value = 0;
+        double trg_nrm = 0;
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+        {
+            IND_TYP k = slice_index(ea->index_sly, i0 + r);
+            for (IND_TYP j = 0; j < out_sz; j++)
+                *vec_at(out, j) = out_bt[r * out_sz + j];
+            data_points_copy_at(ea->data_trg, vec_at(trg, 0), k, ea->trg_sly);
+            FLT_TYP w = 1;
+            if (ea->data_weight)
+                w = *vec_at(ea->data_weight, k);
+            if (!ea->classification)
+            {
+                trg_nrm += w * vec_norm_2(trg);
+                loss_value += w * ea->loss->func(trg, out, buf);
+            }
+            else
+            {
+                trg_nrm += w;
+                IND_TYP im = vec_argmax(out);
+                loss_value += w * (1 - *vec_at(trg, im));
+            }
+        }
+        ea->chunk_loss[c] = loss_value;
+        ea->chunk_nrm[c] = trg_nrm;
+    }
+
+    vec_del(buf);
+    vec_del(trg);
+    vec_del(out);
+    ea->cls->destruct(ctx);
+    return 0;
+}
+
+FLT_TYP nn_eval_loss(const nn_eval_class *cls, const void *model,
+                     IND_TYP input_size, IND_TYP ouput_size,
+                     const data_points *data_x, slice x_sly,
+                     const data_points *data_trg, slice trg_sly,
+                     const vec *data_weight, slice index_sly,
+                     const nn_loss loss, bool classification,
+                     int nbr_threads)
+{
+    assert(cls && model);
+    assert(index_sly.len > 0);
+
+    data_points_advise(data_x, NN_MAP_SEQUENTIAL);
+    data_points_advise(data_trg, NN_MAP_SEQUENTIAL);
+
+    IND_TYP nbr_chunks = (index_sly.len + NN_EVAL_CHUNK - 1) / NN_EVAL_CHUNK;
+    nbr_threads = nn_par_nbr_threads(nbr_threads, nbr_chunks);
+    double *chunk_loss = (double *)calloc(nbr_chunks, sizeof(double));
+    assert(chunk_loss);
+    double *chunk_nrm = (double *)calloc(nbr_chunks, sizeof(double));
+    assert(chunk_nrm);
+    eval_args *args = (eval_args *)calloc(nbr_threads, sizeof(eval_args));
+    assert(args);
+    atomic_llong next_chunk = 0;
+    for (int t = 0; t < nbr_threads; t++)
+        args[t] = (eval_args){.cls = cls, .model = model, .input_size = input_size, .ouput_size = ouput_size,
+                              .data_x = data_x, .x_sly = &x_sly, .data_trg = data_trg, .trg_sly = &trg_sly,
+                              .data_weight = data_weight, .index_sly = &index_sly,
+                              .loss = &loss, .classification = classification,
+                              .nbr_chunks = nbr_chunks, .next_chunk = &next_chunk,
+                              .chunk_loss = chunk_loss, .chunk_nrm = chunk_nrm};
+    // a thread without a context leaves its chunks to the others
+    bool evaluated = nn_par_run_tasks(nbr_threads, eval_worker, args, sizeof(eval_args)) < nbr_threads;
+
+    double loss_value = 0;
+    double trg_nrm = 0;
+    for (IND_TYP c = 0; c < nbr_chunks; c++)
+    {
+        loss_value += chunk_loss[c];
+        trg_nrm += chunk_nrm[c];
+    }
+    free(args);
+    free(chunk_nrm);
+    free(chunk_loss);
+    if (!evaluated)
+    {
+        log_msg(LOG_ERR, "nn_eval_loss: no inference context could be constructed; nothing evaluated.");
+        return 0;
+    }
+    return (FLT_TYP)(loss_value / trg_nrm);
+}
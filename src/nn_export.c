@@ -0,0 +1,231 @@
+#include "nn_export.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+
+#include "nn_activ.h"
+#include "log.h"
+
+#ifdef FLD_FLT64
+#define EXP_NAME "exp"
+#define TANH_NAME "tanh"
+#define FLT_NAME "double"
+#define FLT_SFX ""
+#else
+#define EXP_NAME "expf"
+#define TANH_NAME "tanhf"
+#define FLT_NAME "float"
+#define FLT_SFX "f"
+#endif
+
+// longest accepted prefix, keeps the generated names reasonable
+#define NN_EXPORT_PREFIX_MAX 64
+
+static bool is_identifier(const char *s)
+{
+    if (!s || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+        return false;
+    int n = 0;
+    for (; s[n]; n++)
+        if (!(isalnum((unsigned char)s[n]) || s[n] == '_') || n >= NN_EXPORT_PREFIX_MAX)
+            return false;
+    return true;
+}
+
+// activation of the pre-activation "s" as a C expression
+static const char *act_expr(enum nn_activ_enum act)
+{
+    switch (act)
+    {
+    case ACTIV_ID:
+        return "s";
+    case ACTIV_SIGMOID:
+        return "1 / (1 + " EXP_NAME "(-s))";
+    case ACTIV_TANH:
+        return TANH_NAME "(s)";
+    case ACTIV_RELU:
+        return "(s > 0) ? s : 0";
+    default:
+        return NULL;
+    }
+}
+
+// NaN and infinities have no C literal
+static bool is_finite_model(const nn_model *model)
+{
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        const mat *w = model->weight + l;
+        const vec *b = model->bias + l;
+        for (IND_TYP o = 0; o < w->d1; o++)
+        {
+            for (IND_TYP i = 0; i < w->d2; i++)
+                if (!isfinite(*mat_at(w, o, i)))
+                    return false;
+            if (!isfinite(*vec_at(b, o)))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void write_value(FILE *f, FLT_TYP x)
+{
+    // hex floats round-trip exactly
+    fprintf(f, "%a" FLT_SFX, (double)x);
+}
+
+static void write_arrays(FILE *f, const nn_model *model, const char *prefix, int l)
+{
+    const mat *w = model->weight + l;
+    const vec *b = model->bias + l;
+    fprintf(f, "static _Alignas(64) const " FLT_NAME " %s_w%d[%ld][%ld] = {\n",
+            prefix, l, (long)w->d1, (long)w->d2);
+    for (IND_TYP o = 0; o < w->d1; o++)
+    {
+        fprintf(f, "    {");
+        for (IND_TYP i = 0; i < w->d2; i++)
+        {
+            if (i > 0)
+                fprintf(f, (i % 4 == 0) ? ",\n     " : ", ");
+            write_value(f, *mat_at(w, o, i));
+        }
+        fprintf(f, "},\n");
+    }
+    fprintf(f, "};\n");
+    fprintf(f, "static _Alignas(64) const " FLT_NAME " %s_b%d[%ld] = {\n", prefix, l, (long)b->d);
+    for (IND_TYP o = 0; o < b->d; o++)
+    {
+        fprintf(f, (o % 4 == 0) ? "    " : " ");
+        write_value(f, *vec_at(b, o));
+        fprintf(f, (o % 4 == 3 || o + 1 == b->d) ? ",\n" : ",");
+    }
+    fprintf(f, "};\n\n");
+}
+
+// y[o] = act(w[o] . x + b[o]) with compile-time sizes and NN_EXPORT_LANES accumulators
+static void write_layer(FILE *f, const nn_model *model, const char *prefix, int l,
+                        const char *x, const char *y)
+{
+    const mat *w = model->weight + l;
+    long out_sz = (long)w->d1;
+    long inp_sz = (long)w->d2;
+    long inp_unr = inp_sz / NN_EXPORT_LANES * NN_EXPORT_LANES;
+    const char *act = act_expr(nn_activ_to_enum(&model->layer[l].activ));
+
+    fprintf(f, "    // layer %d: %ld -> %ld\n", l, inp_sz, out_sz);
+    fprintf(f, "    for (int o = 0; o < %ld; o++)\n    {\n", out_sz);
+    if (inp_unr > 0)
+    {
+        fprintf(f, "        " FLT_NAME " acc0 = 0");
+        for (int k = 1; k < NN_EXPORT_LANES; k++)
+            fprintf(f, ", acc%d = 0", k);
+        fprintf(f, ";\n");
+        fprintf(f, "        for (int i = 0; i < %ld; i += %d)\n        {\n", inp_unr, NN_EXPORT_LANES);
+        for (int k = 0; k < NN_EXPORT_LANES; k++)
+            fprintf(f, "            acc%d += %s_w%d[o][i + %d] * %s[i + %d];\n", k, prefix, l, k, x, k);
+        fprintf(f, "        }\n");
+        fprintf(f, "        " FLT_NAME " s = acc0");
+        for (int k = 1; k < NN_EXPORT_LANES; k++)
+            fprintf(f, " + acc%d", k);
+        fprintf(f, ";\n");
+    }
+    else
+    {
+        fprintf(f, "        " FLT_NAME " s = 0;\n");
+    }
+    for (long i = inp_unr; i < inp_sz; i++)
+        fprintf(f, "        s += %s_w%d[o][%ld] * %s[%ld];\n", prefix, l, i, x, i);
+    fprintf(f, "        s += %s_b%d[o];\n", prefix, l);
+    fprintf(f, "        %s[o] = %s;\n", y, act);
+    fprintf(f, "    }\n");
+}
+
+static void write_source(FILE *f, const nn_model *model, const char *prefix, bool need_math)
+{
+    char upper[NN_EXPORT_PREFIX_MAX + 1];
+    int n = 0;
+    for (; prefix[n]; n++)
+        upper[n] = (char)toupper((unsigned char)prefix[n]);
+    upper[n] = 0;
+
+    fprintf(f, "// Generated by nn_model_export_c; do not edit.\n// %ld", (long)model->input_size);
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        char act_str[16];
+        fprintf(f, " -> %ld %s", (long)model->weight[l].d1, nn_activ_to_str(&model->layer[l].activ, act_str));
+    }
+    fprintf(f, "\n\n");
+    if (need_math)
+        fprintf(f, "#include <math.h>\n\n");
+    fprintf(f, "#define %s_INPUT_SIZE %ld\n", upper, (long)model->input_size);
+    fprintf(f, "#define %s_OUTPUT_SIZE %ld\n\n", upper, (long)model->ouput_size);
+
+    for (int l = 0; l < model->nbr_layers; l++)
+        write_arrays(f, model, prefix, l);
+
+    fprintf(f, "void %s_forward(const " FLT_NAME " *restrict in, " FLT_NAME " *restrict out);\n\n", prefix);
+    fprintf(f, "void %s_forward(const " FLT_NAME " *restrict in, " FLT_NAME " *restrict out)\n{\n", prefix);
+    for (int l = 0; l + 1 < model->nbr_layers; l++)
+        fprintf(f, "    _Alignas(64) " FLT_NAME " a%d[%ld];\n", l, (long)model->weight[l].d1);
+    fprintf(f, "\n");
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        char x[16], y[16];
+        snprintf(x, sizeof(x), (l == 0) ? "in" : "a%d", l - 1);
+        snprintf(y, sizeof(y), (l + 1 == model->nbr_layers) ? "out" : "a%d", l);
+        write_layer(f, model, prefix, l, x, y);
+    }
+    fprintf(f, "}\n");
+}
+
+int nn_model_export_c(const nn_model *model, const char *file_path, const char *prefix)
+{
+    assert(model);
+    assert(file_path);
+
+    if (model->nbr_layers == 0)
+    {
+        log_msg(LOG_ERR, "nn_model_export_c: the model has no layers!");
+        return -1;
+    }
+    if (!is_identifier(prefix))
+    {
+        log_msg(LOG_ERR, "nn_model_export_c: the prefix is not a valid C identifier!");
+        return -1;
+    }
+    if (!is_finite_model(model))
+    {
+        log_msg(LOG_ERR, "nn_model_export_c: the model has NaN or infinite weights!");
+        return -1;
+    }
+    bool need_math = false;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        enum nn_activ_enum act = nn_activ_to_enum(&model->layer[l].activ);
+        if (!act_expr(act))
+        {
+            log_msg(LOG_ERR, "nn_model_export_c: layer %d has an activation that cannot be exported!", l);
+            return -1;
+        }
+        need_math |= (act == ACTIV_SIGMOID || act == ACTIV_TANH);
+    }
+
+    FILE *f = fopen(file_path, "w");
+    if (!f)
+    {
+        log_msg(LOG_ERR, "nn_model_export_c: cannot open %s!", file_path);
+        return -1;
+    }
+    write_source(f, model, prefix, need_math);
+    bool failed = ferror(f);
+    if (fclose(f) != 0 || failed)
+    {
+        log_msg(LOG_ERR, "nn_model_export_c: cannot write %s!", file_path);
+        remove(file_path);
+        return -1;
+    }
+    return 0;
+}
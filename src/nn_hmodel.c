@@ -0,0 +1,271 @@
+#include "nn_hmodel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nn_dense.h"
+#include "log.h"
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// weights converted to fp32 at a time; stays in L1
+#define NN_HMODEL_BLK 256
+// independent accumulators of the inner dot products
+#define NN_HMODEL_LANES 8
+
+static inline uint32_t f32_bits(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+static inline float bits_f32(uint32_t x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static inline float fp16_to_f32(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t man = h & 0x3FF;
+    if (exp == 0)
+    {
+        // zero or subnormal: man * 2^-24
+        float f = (float)man * 0x1.0p-24f;
+        return (sign) ? -f : f;
+    }
+    if (exp == 31)
+        return bits_f32(sign | 0x7F800000 | (man << 13));
+    return bits_f32(sign | ((exp + 112) << 23) | (man << 13));
+}
+
+static uint16_t f32_to_fp16(float f)
+{
+    uint32_t x = f32_bits(f);
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t f_exp = (x >> 23) & 0xFF;
+    uint32_t man = x & 0x7FFFFF;
+    if (f_exp == 0xFF)
+        return (uint16_t)(sign | 0x7C00 | ((man) ? 0x200 : 0));
+    int32_t exp = (int32_t)f_exp - 127 + 15;
+    if (exp >= 31)
+        return (uint16_t)(sign | 0x7C00);
+    if (exp <= 0)
+    {
+        // subnormal half: (1.man) * 2^(exp - 15) = h * 2^-24
+        if (exp < -10)
+            return (uint16_t)sign;
+        man |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t h = man >> shift;
+        uint32_t rem = man & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1)))
+            h++;
+        return (uint16_t)(sign | h);
+    }
+    uint32_t h = ((uint32_t)exp << 10) | (man >> 13);
+    uint32_t rem = man & 0x1FFF;
+    // a carry out of the mantissa correctly bumps the exponent (up to inf)
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+    return (uint16_t)(sign | h);
+}
+
+static uint16_t f32_to_bf16(float f)
+{
+    uint32_t x = f32_bits(f);
+    if ((x & 0x7FFFFFFF) > 0x7F800000)
+        return (uint16_t)((x >> 16) | 0x40); // quiet NaN
+    x += 0x7FFF + ((x >> 16) & 1);
+    return (uint16_t)(x >> 16);
+}
+
+uint16_t nn_half_from_f32(float f, enum nn_half_fmt fmt)
+{
+    return (fmt == NN_HALF_BF16) ? f32_to_bf16(f) : f32_to_fp16(f);
+}
+
+float nn_half_to_f32(uint16_t h, enum nn_half_fmt fmt)
+{
+    if (fmt == NN_HALF_BF16)
+        return bits_f32((uint32_t)h << 16);
+    return fp16_to_f32(h);
+}
+
+static void convert_block(float *restrict dst, const uint16_t *restrict src, IND_TYP n, enum nn_half_fmt fmt)
+{
+    if (fmt == NN_HALF_BF16)
+    {
+        for (IND_TYP i = 0; i < n; i++)
+            dst[i] = bits_f32((uint32_t)src[i] << 16);
+        return;
+    }
+    IND_TYP i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+    for (; i < n; i++)
+        dst[i] = fp16_to_f32(src[i]);
+}
+
+static inline FLT_TYP dot_blk(const FLT_TYP *restrict a, const float *restrict w, IND_TYP n)
+{
+    FLT_TYP acc[NN_HMODEL_LANES] = {0};
+    IND_TYP i = 0;
+    for (; i + NN_HMODEL_LANES <= n; i += NN_HMODEL_LANES)
+        for (int j = 0; j < NN_HMODEL_LANES; j++)
+            acc[j] += a[i + j] * w[i + j];
+    FLT_TYP res = 0;
+    for (; i < n; i++)
+        res += a[i] * w[i];
+    for (int j = 0; j < NN_HMODEL_LANES; j++)
+        res += acc[j];
+    return res;
+}
+
+nn_hmodel *nn_model_to_half(nn_hmodel *hmodel, const nn_model *model, enum nn_half_fmt fmt)
+{
+    assert(hmodel);
+    assert(model);
+    assert(hmodel->nbr_layers == 0 && !hmodel->layer);
+
+    if (model->nbr_layers == 0)
+    {
+        log_msg(LOG_ERR, "nn_model_to_half: the model has no layers!");
+        return NULL;
+    }
+    hmodel->fmt = fmt;
+    hmodel->input_size = model->input_size;
+    hmodel->ouput_size = model->ouput_size;
+    hmodel->max_width = model->max_width;
+    hmodel->nbr_layers = model->nbr_layers;
+    hmodel->layer = (nn_hlayer *)calloc(model->nbr_layers, sizeof(nn_hlayer));
+    assert(hmodel->layer);
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        nn_hlayer *hl = hmodel->layer + l;
+        const mat *w = model->weight + l;
+        hl->out_sz = w->d1;
+        hl->inp_sz = w->d2;
+        hl->activ = model->layer[l].activ;
+        hl->w = (uint16_t *)calloc(hl->out_sz * hl->inp_sz, sizeof(uint16_t));
+        assert(hl->w);
+        hl->bias = (FLT_TYP *)calloc(hl->out_sz, sizeof(FLT_TYP));
+        assert(hl->bias);
+        for (IND_TYP o = 0; o < hl->out_sz; o++)
+        {
+            for (IND_TYP i = 0; i < hl->inp_sz; i++)
+                hl->w[o * hl->inp_sz + i] = nn_half_from_f32((float)*mat_at(w, o, i), fmt);
+            hl->bias[o] = *vec_at(model->bias + l, o);
+        }
+    }
+    return hmodel;
+}
+
+void nn_hmodel_destruct(nn_hmodel *hmodel)
+{
+    assert(hmodel);
+    for (int l = 0; l < hmodel->nbr_layers; l++)
+    {
+        free(hmodel->layer[l].w);
+        free(hmodel->layer[l].bias);
+    }
+    free(hmodel->layer);
+    *hmodel = nn_hmodel_NULL;
+}
+
+size_t nn_hmodel_weight_bytes(const nn_hmodel *hmodel)
+{
+    assert(hmodel);
+    size_t sz = 0;
+    for (int l = 0; l < hmodel->nbr_layers; l++)
+        sz += hmodel->layer[l].out_sz * hmodel->layer[l].inp_sz * sizeof(uint16_t);
+    return sz;
+}
+
+// s[nbr_rows x out_sz] = a . w^T + b; each weight block is converted once per 4 rows
+static void hlayer_forward(FLT_TYP *s, const nn_hlayer *hl, const FLT_TYP *a, IND_TYP nbr_rows,
+                           enum nn_half_fmt fmt)
+{
+    float wb[NN_HMODEL_BLK];
+    IND_TYP inp_sz = hl->inp_sz;
+    IND_TYP out_sz = hl->out_sz;
+    for (IND_TYP r = 0; r < nbr_rows; r += 4)
+    {
+        int nbr = (r + 4 <= nbr_rows) ? 4 : (int)(nbr_rows - r);
+        const FLT_TYP *a0 = a + r * inp_sz;
+        for (IND_TYP o = 0; o < out_sz; o++)
+        {
+            FLT_TYP acc[4] = {0, 0, 0, 0};
+            const uint16_t *w_row = hl->w + o * inp_sz;
+            for (IND_TYP k0 = 0; k0 < inp_sz; k0 += NN_HMODEL_BLK)
+            {
+                IND_TYP n = (k0 + NN_HMODEL_BLK <= inp_sz) ? NN_HMODEL_BLK : inp_sz - k0;
+                convert_block(wb, w_row + k0, n, fmt);
+                for (int k = 0; k < nbr; k++)
+                    acc[k] += dot_blk(a0 + k * inp_sz + k0, wb, n);
+            }
+            for (int k = 0; k < nbr; k++)
+                s[(r + k) * out_sz + o] = acc[k] + hl->bias[o];
+        }
+    }
+}
+
+const FLT_TYP *nn_hmodel_infer_batch(const nn_hmodel *hmodel, nn_infer_ctx *ctx, IND_TYP nbr_rows)
+{
+    assert(hmodel);
+    assert(ctx);
+    assert(hmodel->nbr_layers > 0);
+    assert(ctx->input_size == hmodel->input_size && ctx->max_width >= hmodel->max_width);
+    assert(nbr_rows > 0 && nbr_rows <= ctx->batch_cap);
+
+    const FLT_TYP *a_in = payload_at(&ctx->inp, 0);
+    vec a = vec_NULL;
+    for (int l = 0; l < hmodel->nbr_layers; l++)
+    {
+        const nn_hlayer *hl = hmodel->layer + l;
+        payload *out_pyl = ctx->buf + (l & 1);
+        FLT_TYP *out = payload_at(out_pyl, 0);
+        hlayer_forward(out, hl, a_in, nbr_rows, hmodel->fmt);
+        enum nn_activ_enum act = nn_activ_to_enum(&hl->activ);
+        if (nn_dense_is_fusable(act))
+        {
+            nn_dense_activate(out, out, nbr_rows * hl->out_sz, act);
+        }
+        else
+        {
+            vec_construct_prealloc(&a, out_pyl, 0, nbr_rows * hl->out_sz, 1);
+            hl->activ.func(&a, &a);
+        }
+        a_in = out;
+    }
+    vec_destruct(&a);
+    return a_in;
+}
+
+vec *nn_hmodel_infer(const nn_hmodel *hmodel, nn_infer_ctx *ctx, const vec *input, vec *output)
+{
+    assert(hmodel);
+    assert(ctx);
+    assert(vec_is_valid(input));
+    assert(vec_is_valid(output));
+    assert(input->d == hmodel->input_size);
+    assert(output->d == hmodel->ouput_size);
+
+    FLT_TYP *inp = nn_infer_ctx_input(ctx);
+    for (IND_TYP i = 0; i < input->d; i++)
+        inp[i] = *vec_at(input, i);
+    const FLT_TYP *out = nn_hmodel_infer_batch(hmodel, ctx, 1);
+    for (IND_TYP i = 0; i < output->d; i++)
+        *vec_at(output, i) = out[i];
+    return output;
+}
@@ -0,0 +1,126 @@
+#include "nn_infer_ctx.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "nn_dense.h"
+#include "log.h"
+
+nn_infer_ctx *nn_infer_ctx_construct(nn_infer_ctx *ctx, const nn_model *model, IND_TYP batch_cap)
+{
+    assert(ctx);
+    assert(model);
+
+    if (model->nbr_layers == 0)
+    {
+        log_msg(LOG_ERR, "nn_infer_ctx_construct: the model has no layers!");
+        *ctx = nn_infer_ctx_NULL;
+        return NULL;
+    }
+    return nn_infer_ctx_construct_dims(ctx, model->input_size, model->max_width, batch_cap);
+}
+
+nn_infer_ctx *nn_infer_ctx_construct_dims(nn_infer_ctx *ctx, IND_TYP input_size, IND_TYP max_width,
+                                          IND_TYP batch_cap)
+{
+    assert(ctx);
+    assert(batch_cap > 0);
+
+    if (batch_cap <= 0 || input_size <= 0 || max_width <= 0)
+    {
+        log_msg(LOG_ERR, "nn_infer_ctx_construct: cannot construct the ctx with these params!");
+        *ctx = nn_infer_ctx_NULL;
+        return NULL;
+    }
+    ctx->input_size = input_size;
+    ctx->max_width = max_width;
+    ctx->batch_cap = batch_cap;
+    ctx->inp = payload_NULL;
+    payload_construct(&ctx->inp, batch_cap * ctx->input_size);
+    assert(payload_is_valid(&ctx->inp));
+    for (int i = 0; i < 2; i++)
+    {
+        ctx->buf[i] = payload_NULL;
+        payload_construct(ctx->buf + i, batch_cap * ctx->max_width);
+        assert(payload_is_valid(ctx->buf + i));
+    }
+    return ctx;
+}
+
+void nn_infer_ctx_destruct(nn_infer_ctx *ctx)
+{
+    assert(ctx);
+    if (ctx->batch_cap > 0)
+    {
+        payload_release(&ctx->inp);
+        payload_release(ctx->buf);
+        payload_release(ctx->buf + 1);
+    }
+    *ctx = nn_infer_ctx_NULL;
+}
+
+FLT_TYP *nn_infer_ctx_input(nn_infer_ctx *ctx)
+{
+    assert(ctx && ctx->batch_cap > 0);
+    return payload_at(&ctx->inp, 0);
+}
+
+const FLT_TYP *nn_model_infer_batch(const nn_model *model, nn_infer_ctx *ctx, IND_TYP nbr_rows)
+{
+    assert(model);
+    assert(ctx);
+    assert(model->nbr_layers > 0);
+    assert(ctx->input_size == model->input_size && ctx->max_width >= model->max_width);
+    assert(nbr_rows > 0 && nbr_rows <= ctx->batch_cap);
+
+    const nn_layer *layer = model->layer;
+    const FLT_TYP *a_in = payload_at(&ctx->inp, 0);
+    IND_TYP inp_sz = model->input_size;
+    vec a = vec_NULL;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        IND_TYP out_sz = layer[l].out_sz;
+        payload *out_pyl = ctx->buf + (l & 1);
+        enum nn_activ_enum act = nn_activ_to_enum(&layer[l].activ);
+        if (nn_dense_is_fusable(act))
+        {
+            // pre-activations are not kept at inference
+            nn_dense_forward_act(NULL, payload_at(out_pyl, 0), a_in, nbr_rows,
+                                 mat_at(model->weight + l, 0, 0), vec_at(model->bias + l, 0),
+                                 out_sz, inp_sz, act, NULL);
+        }
+        else
+        {
+            nn_dense_forward(payload_at(out_pyl, 0), a_in, nbr_rows,
+                             mat_at(model->weight + l, 0, 0), vec_at(model->bias + l, 0),
+                             out_sz, inp_sz);
+            // element-wise activation, in place over the whole batch
+            vec_construct_prealloc(&a, out_pyl, 0, nbr_rows * out_sz, 1);
+            layer[l].activ.func(&a, &a);
+        }
+        a_in = payload_at(out_pyl, 0);
+        inp_sz = out_sz;
+    }
+    vec_destruct(&a);
+    return a_in;
+}
+
+vec *nn_model_infer(const nn_model *model, nn_infer_ctx *ctx, const vec *input, vec *output)
+{
+    assert(model);
+    assert(ctx);
+    if (model->nbr_layers == 0)
+        return output;
+    assert(vec_is_valid(input));
+    assert(vec_is_valid(output));
+    assert(input->d == model->input_size);
+    assert(output->d == model->ouput_size);
+
+    FLT_TYP *inp = nn_infer_ctx_input(ctx);
+    for (IND_TYP i = 0; i < input->d; i++)
+        inp[i] = *vec_at(input, i);
+    const FLT_TYP *out = nn_model_infer_batch(model, ctx, 1);
+    for (IND_TYP i = 0; i < output->d; i++)
+        *vec_at(output, i) = out[i];
+    return output;
+}
@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "nn_mmap.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "log.h"
+
+nn_mapping *nn_mapping_open(nn_mapping *map, const char *file_path)
+{
+    assert(map);
+    assert(file_path);
+    assert(!map->addr);
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_msg(LOG_ERR, "nn_mapping_open: can't open %s!", file_path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        log_msg(LOG_ERR, "nn_mapping_open: %s is empty or can't be stat'ed!", file_path);
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping holds its own reference to the file
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        log_msg(LOG_ERR, "nn_mapping_open: can't map %s!", file_path);
+        return NULL;
+    }
+    map->addr = addr;
+    map->size = (size_t)st.st_size;
+    return map;
+}
+
+void nn_mapping_close(nn_mapping *map)
+{
+    assert(map);
+    if (map->addr)
+        munmap(map->addr, map->size);
+    *map = nn_mapping_NULL;
+}
+
+bool nn_mapping_is_open(const nn_mapping *map)
+{
+    assert(map);
+    return map->addr != NULL;
+}
+
+void nn_mapping_advise(const nn_mapping *map, size_t off, size_t len, enum nn_mapping_advice advice)
+{
+    assert(map);
+    if (!map->addr || off >= map->size || len == 0)
+        return;
+    if (len > map->size - off)
+        len = map->size - off;
+    // posix_madvise wants a page aligned start
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = off / page * page;
+    int adv = POSIX_MADV_NORMAL;
+    switch (advice)
+    {
+    case NN_MAP_SEQUENTIAL:
+        adv = POSIX_MADV_SEQUENTIAL;
+        break;
+    case NN_MAP_RANDOM:
+        adv = POSIX_MADV_RANDOM;
+        break;
+    case NN_MAP_WILLNEED:
+        adv = POSIX_MADV_WILLNEED;
+        break;
+    default:
+        break;
+    }
+    posix_madvise((uint8_t *)map->addr + start, len + off - start, adv);
+}
+
+int nn_file_replace_open(nn_file_replace *rep, const char *file_path)
+{
+    assert(rep);
+    assert(file_path);
+    static atomic_uint tmp_cnt = 0;
+
+    size_t path_len = strlen(file_path) + 64;
+    rep->tmp_path = (char *)malloc(path_len);
+    assert(rep->tmp_path);
+    snprintf(rep->tmp_path, path_len, "%s.tmp%ld.%u", file_path, (long)getpid(), atomic_fetch_add(&tmp_cnt, 1));
+    rep->fd = open(rep->tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (rep->fd < 0)
+    {
+        log_msg(LOG_ERR, "nn_file_replace_open: can't create %s!", rep->tmp_path);
+        free(rep->tmp_path);
+        rep->tmp_path = NULL;
+    }
+    return rep->fd;
+}
+
+int nn_file_replace_close(nn_file_replace *rep, const char *file_path, bool ok)
+{
+    assert(rep && rep->tmp_path);
+    assert(file_path);
+
+    ok = ok && fsync(rep->fd) == 0;
+    ok = (close(rep->fd) == 0) && ok;
+    ok = ok && rename(rep->tmp_path, file_path) == 0;
+    if (!ok)
+    {
+        log_msg(LOG_ERR, "nn_file_replace_close: can't write %s: %s!", file_path, strerror(errno));
+        unlink(rep->tmp_path);
+    }
+    free(rep->tmp_path);
+    rep->tmp_path = NULL;
+    rep->fd = -1;
+    return (ok) ? 0 : -1;
+}
+
+bool nn_file_write_all(int fd, const void *bytes, size_t size)
+{
+    const uint8_t *b = (const uint8_t *)bytes;
+    for (size_t pos = 0; pos < size;)
+    {
+        ssize_t wr = write(fd, b + pos, size - pos);
+        if (wr < 0 && errno == EINTR)
+            continue;
+        if (wr <= 0)
+            return false;
+        pos += wr;
+    }
+    return true;
+}
@@ -1,11 +1,27 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "nn_model.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
+#include <math.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
+#include "nn_infer_ctx.h"
+#include "nn_eval.h"
+#include "nn_dense.h"
+#include "nn_par.h"
+#include "nn_prefetch.h"
+#include "nn_checkpoint.h"
+#include "nn_dist.h"
+#include "nn_optim_cls_SGD.h"
 #include "rnd.h"
 #include "log.h"
 
@@ -66,6 +82,17 @@ nn_model *nn_model_construct(nn_model *model, int layer_capacity, IND_TYP input_
     return model;
 }
 
+// releases model->param once no view points into it any more
+static void release_param(nn_model *model)
+{
+    // a mapped param was not allocated by payload_construct
+    if (nn_model_is_mapped(model))
+        nn_mapping_close(&model->map);
+    else if (nn_model_is_packed(model))
+        payload_release(&model->param);
+    model->param = payload_NULL;
+}
+
 void nn_model_destruct(nn_model *model)
 {
     assert(model);
@@ -76,6 +103,7 @@ void nn_model_destruct(nn_model *model)
             mat_destruct(model->weight + l);
             vec_destruct(model->bias + l);
         }
+        release_param(model);
         nn_model_intern_destruct(&model->intern);
         free(model->layer);
         free(model->weight);
@@ -92,6 +120,9 @@ nn_model *nn_model_init_uniform_rnd(nn_model *model, FLT_TYP amp, FLT_TYP mean)
     param.amp = amp;
     param.mean = mean;
 
+    if (nn_model_is_mapped(model))
+        nn_model_pack(model);
+
     for (int l = 0; l < model->nbr_layers; l++)
     {
         mat_fill_gen(model->weight + l, uniform_flt_rnd, &param);
@@ -100,6 +131,78 @@ nn_model *nn_model_init_uniform_rnd(nn_model *model, FLT_TYP amp, FLT_TYP mean)
     return model;
 }
 
+bool nn_model_is_packed(const nn_model *model)
+{
+    assert(model);
+    return payload_is_valid(&model->param);
+}
+
+bool nn_model_is_mapped(const nn_model *model)
+{
+    assert(model);
+    return nn_mapping_is_open(&model->map);
+}
+
+static inline IND_TYP align_param(IND_TYP n)
+{
+    const IND_TYP a = NN_MODEL_PARAM_ALIGN / sizeof(FLT_TYP);
+    return (n + a - 1) / a * a;
+}
+
+IND_TYP nn_model_param_layout(const nn_model *model, IND_TYP *w_off, IND_TYP *b_off)
+{
+    assert(model);
+    IND_TYP off = 0;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        if (w_off)
+            w_off[l] = off;
+        off += align_param(model->weight[l].d1 * model->weight[l].d2);
+        if (b_off)
+            b_off[l] = off;
+        off += align_param(model->bias[l].d);
+    }
+    return off;
+}
+
+static void unpack_param(nn_model *model)
+{
+    if (!nn_model_is_packed(model))
+        return;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        nn_model_mat_unpack(model->weight + l);
+        nn_model_vec_unpack(model->bias + l);
+    }
+    release_param(model);
+}
+
+nn_model *nn_model_pack(nn_model *model)
+{
+    assert(model);
+    if (model->nbr_layers == 0)
+    {
+        log_msg(LOG_WRN, "nn_model_pack: the model has no layers; nothing packed.");
+        return model;
+    }
+    unpack_param(model);
+    IND_TYP *w_off = (IND_TYP *)calloc(2 * model->nbr_layers, sizeof(IND_TYP));
+    assert(w_off);
+    IND_TYP *b_off = w_off + model->nbr_layers;
+    IND_TYP size = nn_model_param_layout(model, w_off, b_off);
+    payload_construct(&model->param, size);
+    assert(payload_is_valid(&model->param));
+    memset(payload_at(&model->param, 0), 0, size * sizeof(FLT_TYP));
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        nn_model_mat_pack(model->weight + l, &model->param, w_off[l]);
+        nn_model_vec_pack(model->bias + l, &model->param, b_off[l]);
+    }
+    nn_model_intern_pack(&model->intern, size, w_off, b_off);
+    free(w_off);
+    return model;
+}
+
 nn_model *nn_model_append(nn_model *model, const nn_layer *layer)
 {
     assert(model);
@@ -124,6 +227,8 @@ nn_model *nn_model_append(nn_model *model, const nn_layer *layer)
     model->nbr_layers++;
     if (layer->out_sz > model->max_width)
         model->max_width = layer->out_sz;
+    if (nn_model_is_packed(model))
+        nn_model_pack(model);
     return model;
 }
 
@@ -152,26 +257,52 @@ nn_model *nn_model_remove(nn_model *model, int layer_index)
         if (model->layer[l].out_sz > model->max_width)
             model->max_width = model->layer[l].out_sz;
     if(model->nbr_layers > 0)
-        model->ouput_size = model->ouput_size;
+        model->ouput_size = model->layer[model->nbr_layers - 1].out_sz;
     else {
         model->ouput_size = 0;
     }
+    if (nn_model_is_packed(model))
+    {
+        if (model->nbr_layers > 0)
+            nn_model_pack(model);
+        else
+            unpack_param(model);
+    }
 
     return model;
 }
 
-static void nn_model_dropping_out(nn_model *model)
+// dropout mask words of one sample
+static inline IND_TYP mask_words(const nn_model *model)
 {
-    nn_layer *layer = model->layer;
-    nn_model_intern *intern = &model->intern;
-
+    IND_TYP n = 0;
     for (int l = 0; l < model->nbr_layers; l++)
+        if (model->layer[l].dropout)
+            n += NN_DENSE_MASK_WORDS((l != 0) ? model->layer[l - 1].out_sz : model->input_size);
+    return n;
+}
+
+// draws the per-sample dropout masks of nbr_rows rows; row r only depends on key + r,
+// so a batch split over threads gets the same masks as a whole one
+static void nn_model_dropping_out(const nn_model *model, nn_model_intern *intern,
+                                  IND_TYP nbr_rows, uint64_t key)
+{
+    const nn_layer *layer = model->layer;
+    NN_PROF_START(t_ph);
+    rnd_stream rs;
+    for (IND_TYP r = 0; r < nbr_rows; r++)
     {
-        FLT_TYP drp = layer[l].dropout;
-        if (drp != 0)
-            for (IND_TYP u = 0; u < intern->a_mask[l].d; u++)
-                *vec_at(intern->a_mask + l, u) = (FLT_TYP)(uniform_flt_rnd(NULL) >= drp);
+        rnd_stream_init(&rs, key + r);
+        for (int l = 0; l < model->nbr_layers; l++)
+        {
+            FLT_TYP drp = layer[l].dropout;
+            if (drp == 0)
+                continue;
+            IND_TYP inp_sz = (l != 0) ? layer[l - 1].out_sz : model->input_size;
+            rnd_stream_fill_bits(&rs, intern->a_mask[l] + r * NN_DENSE_MASK_WORDS(inp_sz), inp_sz, 1 - drp);
+        }
     }
+    NN_PROF_STOP(intern->prof, t_ph, -1, NN_PROF_DROPOUT, 0, nbr_rows * mask_words(model) * sizeof(uint64_t));
 }
 
 vec *nn_model_apply(const nn_model *model, const vec *input, vec *output, bool training)
@@ -184,75 +315,223 @@ vec *nn_model_apply(const nn_model *model, const vec *input, vec *output, bool t
     assert(input->d == model->input_size);
     assert(output->d == model->ouput_size);
 
-    vec *a_inp = &model->intern.a_inp;
-    vec *s = model->intern.s;
-    vec *a = model->intern.a;
-    vec *a_mask = model->intern.a_mask;
-
-    mat *w = model->weight;
-    vec *b = model->bias;
+    nn_model_intern *intern = (nn_model_intern *)&model->intern;
+    vec *a_inp = &intern->a_inp;
+    vec *s = intern->s;
+    vec *a = intern->a;
+    uint64_t **a_mask = intern->a_mask;
 
-    nn_layer *layer = model->layer;
+    const nn_layer *layer = model->layer;
 
+    if (training)
+        nn_model_dropping_out(model, intern, 1, UINT_RND_GEN());
+    // the first layer's dropout is applied while copying the input
+    IND_TYP inp_sz = model->input_size;
+    FLT_TYP *a_in = vec_at(a_inp, 0);
     if (layer->dropout && training)
-        vec_mul(a_inp, a_mask, input);
+        for (IND_TYP i = 0; i < inp_sz; i++)
+            a_in[i] = nn_dense_mask_bit(a_mask[0], i) ? *vec_at(input, i) : 0;
     else
         vec_assign(a_inp, input);
-    mat_dot_vec(s, w, a_inp);
-    vec_addto(s, b);
-    layer->activ.func(a, s);
-    for (int l = 1; l < model->nbr_layers; l++)
+    // a 1-row batch through the dense kernels, as nn_model_infer
+    for (int l = 0; l < model->nbr_layers; l++)
     {
-        if (layer[l].dropout && training)
-            vec_mulby(a + l - 1, a_mask + l);
-        mat_dot_vec(s + l, w + l, a + l - 1);
-        vec_addto(s + l, b + l);
-        layer[l].activ.func(a + l, s + l);
+        IND_TYP out_sz = layer[l].out_sz;
+        // the next layer's dropout is applied to this layer's output
+        const uint64_t *mask = (training && l + 1 < model->nbr_layers && layer[l + 1].dropout) ? a_mask[l + 1] : NULL;
+        enum nn_activ_enum act = nn_activ_to_enum(&layer[l].activ);
+        if (nn_dense_is_fusable(act))
+        {
+            // no backprop from here, so no pre-activations
+            nn_dense_forward_act(NULL, vec_at(a + l, 0), a_in, 1, mat_at(model->weight + l, 0, 0),
+                                 vec_at(model->bias + l, 0), out_sz, inp_sz, act, mask);
+        }
+        else
+        {
+            nn_dense_forward(vec_at(s + l, 0), a_in, 1, mat_at(model->weight + l, 0, 0),
+                             vec_at(model->bias + l, 0), out_sz, inp_sz);
+            layer[l].activ.func(a + l, s + l);
+            if (mask)
+                nn_dense_mask_rows(vec_at(a + l, 0), mask, 1, out_sz);
+        }
+        a_in = vec_at(a + l, 0);
+        inp_sz = out_sz;
     }
     vec_assign(output, a + model->nbr_layers - 1);
     return output;
 }
 
-static inline void nn_model_backprop(nn_model *model, const vec *loss_drv,
-                                     vec *buff_1, vec *buff_2)
+// gathers the (sliced) inputs of the batch rows into intern->a_inp_bt
+static void nn_model_gather_batch(nn_model_intern *intern, const data_points *data_x, const slice *x_sly,
+                                  const slice *index_sly, const IND_TYP *ind, IND_TYP nbr_rows)
 {
-    assert(model);
-    assert(vec_is_valid(loss_drv));
-    // assert(data_x);
-    assert(model->nbr_layers > 0);
-    assert(vec_is_valid(buff_1));
-    assert(vec_is_valid(buff_2));
+    NN_PROF_START(t_ph);
+    FLT_TYP *a_inp = payload_at(&intern->a_inp_bt, 0);
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+        data_points_copy_at(data_x, a_inp + r * x_sly->len, slice_index(index_sly, ind[r]), x_sly);
+    NN_PROF_STOP(intern->prof, t_ph, -1, NN_PROF_GATHER, 0, 2 * nbr_rows * x_sly->len * sizeof(FLT_TYP));
+}
 
-    nn_layer *layer = model->layer;
-    mat *w = model->weight;
-    vec *a = model->intern.a;
-    vec *s = model->intern.s;
-    vec *a_m = model->intern.a_mask;
+// forwards the nbr_rows inputs in intern->a_inp_bt through all layers;
+// one GEMM per layer instead of one GEMV per sample
+static void nn_model_forward_batch(const nn_model *model, nn_model_intern *intern,
+                                   IND_TYP nbr_rows, bool training)
+{
+    assert(nbr_rows > 0 && nbr_rows <= intern->batch_cap);
 
-    buff_1->d = loss_drv->d;
-    vec_assign(buff_1, loss_drv);
+    const nn_layer *layer = model->layer;
+    IND_TYP inp_sz = model->input_size;
+    FLT_TYP *a_in = payload_at(&intern->a_inp_bt, 0);
+    vec s = vec_NULL, a = vec_NULL;
+    if (layer[0].dropout && training)
+        nn_dense_mask_rows(a_in, intern->a_mask[0], nbr_rows, inp_sz);
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        IND_TYP out_sz = layer[l].out_sz;
+        // the next layer's dropout is applied to this layer's output
+        const uint64_t *mask = (training && l + 1 < model->nbr_layers && layer[l + 1].dropout)
+                                   ? intern->a_mask[l + 1] : NULL;
+        enum nn_activ_enum act = nn_activ_to_enum(&layer[l].activ);
+        NN_PROF_START(t_ph);
+        if (nn_dense_is_fusable(act))
+        {
+            nn_dense_forward_act(payload_at(intern->s_bt + l, 0), payload_at(intern->a_bt + l, 0),
+                                 a_in, nbr_rows, mat_at(model->weight + l, 0, 0),
+                                 vec_at(model->bias + l, 0), out_sz, inp_sz, act, mask);
+            // activation counted as 1 FLOP per output
+            NN_PROF_STOP(intern->prof, t_ph, l, NN_PROF_FORWARD, nbr_rows * out_sz * (2 * inp_sz + 2),
+                         ((inp_sz + 1) * out_sz + nbr_rows * (inp_sz + 2 * out_sz)) * sizeof(FLT_TYP));
+        }
+        else
+        {
+            nn_dense_forward(payload_at(intern->s_bt + l, 0), a_in, nbr_rows,
+                             mat_at(model->weight + l, 0, 0), vec_at(model->bias + l, 0),
+                             out_sz, inp_sz);
+            NN_PROF_STOP(intern->prof, t_ph, l, NN_PROF_FORWARD, nbr_rows * out_sz * (2 * inp_sz + 1),
+                         ((inp_sz + 1) * out_sz + nbr_rows * (inp_sz + out_sz)) * sizeof(FLT_TYP));
+            NN_PROF_START(t_act);
+            // activations are element-wise; the whole batch is one long vector for them
+            vec_construct_prealloc(&s, intern->s_bt + l, 0, nbr_rows * out_sz, 1);
+            vec_construct_prealloc(&a, intern->a_bt + l, 0, nbr_rows * out_sz, 1);
+            layer[l].activ.func(&a, &s);
+            if (mask)
+                nn_dense_mask_rows(payload_at(intern->a_bt + l, 0), mask, nbr_rows, out_sz);
+            NN_PROF_STOP(intern->prof, t_act, l, NN_PROF_ACTIV, nbr_rows * out_sz,
+                         2 * nbr_rows * out_sz * sizeof(FLT_TYP));
+        }
+        a_in = payload_at(intern->a_bt + l, 0);
+        inp_sz = out_sz;
+    }
+    vec_destruct(&s);
+    vec_destruct(&a);
+}
 
+// computes the (weighted) loss derivatives of the nbr_rows outputs into intern->err_bt;
+// lbl is a scratch vector of the output size
+static void nn_model_loss_drv_batch(const nn_model *model, nn_model_intern *intern,
+                                    const data_points *data_trg, const slice *trg_sly,
+                                    const vec *data_weight, const slice *index_sly, const IND_TYP *ind,
+                                    IND_TYP nbr_rows, const nn_loss *loss, vec *lbl)
+{
+    IND_TYP out_sz = model->ouput_size;
+    NN_PROF_START(t_ph);
+    vec out = vec_NULL, err = vec_NULL;
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        IND_TYP k = slice_index(index_sly, ind[r]);
+        vec_construct_prealloc(&out, intern->a_bt + model->nbr_layers - 1, r * out_sz, out_sz, 1);
+        vec_construct_prealloc(&err, &intern->err_bt, r * out_sz, out_sz, 1);
+        data_points_copy_at(data_trg, vec_at(lbl, 0), k, trg_sly);
+        loss->deriv(&err, lbl, &out);
+        if (data_weight)
+            vec_scale(&err, *vec_at(data_weight, k));
+    }
+    vec_destruct(&out);
+    vec_destruct(&err);
+    // nominal 3 FLOPs and 3 values per output (target, output, derivative)
+    NN_PROF_STOP(intern->prof, t_ph, -1, NN_PROF_LOSS, 3 * nbr_rows * out_sz, 3 * nbr_rows * out_sz * sizeof(FLT_TYP));
+}
+
+// nn_model_loss_drv_batch for rows staged by the prefetcher: trg holds the nbr_rows
+// target rows back to back, wgt their data weights (NULL for none)
+static void nn_model_loss_drv_staged(const nn_model *model, nn_model_intern *intern,
+                                     const FLT_TYP *trg, const FLT_TYP *wgt,
+                                     IND_TYP nbr_rows, const nn_loss *loss, vec *lbl)
+{
+    IND_TYP out_sz = model->ouput_size;
+    NN_PROF_START(t_ph);
+    vec out = vec_NULL, err = vec_NULL;
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        vec_construct_prealloc(&out, intern->a_bt + model->nbr_layers - 1, r * out_sz, out_sz, 1);
+        vec_construct_prealloc(&err, &intern->err_bt, r * out_sz, out_sz, 1);
+        memcpy(vec_at(lbl, 0), trg + r * out_sz, out_sz * sizeof(FLT_TYP));
+        loss->deriv(&err, lbl, &out);
+        if (wgt)
+            vec_scale(&err, wgt[r]);
+    }
+    vec_destruct(&out);
+    vec_destruct(&err);
+    NN_PROF_STOP(intern->prof, t_ph, -1, NN_PROF_LOSS, 3 * nbr_rows * out_sz, 3 * nbr_rows * out_sz * sizeof(FLT_TYP));
+}
+
+// backpropagates the nbr_rows output errors in intern->err_bt through all layers
+// and accumulates the gradients into intern->d_w and d_b
+static void nn_model_backward_batch(const nn_model *model, nn_model_intern *intern, IND_TYP nbr_rows)
+{
+    assert(nbr_rows > 0 && nbr_rows <= intern->batch_cap);
+
+    const nn_layer *layer = model->layer;
+    FLT_TYP *err = payload_at(&intern->err_bt, 0);
+    FLT_TYP *dlt = payload_at(&intern->dlt_bt, 0);
+    vec v_s = vec_NULL, v_a = vec_NULL, v_dlt = vec_NULL, v_err = vec_NULL;
     for (int l = model->nbr_layers - 1; l >= 0; l--)
     {
-        buff_2->d = a[l].d;
-        layer[l].activ.deriv(buff_2, s + l, a + l);
-        if (l + 1 != model->nbr_layers && layer[l + 1].dropout)
-            vec_mulby(buff_2, a_m + l + 1);
-        vec_mulby(buff_2, buff_1);
-        const vec *tmp;
+        IND_TYP out_sz = layer[l].out_sz;
+        IND_TYP inp_sz = (l != 0) ? layer[l - 1].out_sz : model->input_size;
+        IND_TYP n = nbr_rows * out_sz;
+        const uint64_t *mask = (l + 1 != model->nbr_layers && layer[l + 1].dropout)
+                                   ? intern->a_mask[l + 1] : NULL;
+        enum nn_activ_enum act = nn_activ_to_enum(&layer[l].activ);
+        NN_PROF_START(t_ph);
+        if (nn_dense_is_fusable(act))
+        {
+            nn_dense_delta(dlt, err, payload_at(intern->s_bt + l, 0), payload_at(intern->a_bt + l, 0),
+                           nbr_rows, out_sz, act, mask);
+        }
+        else
+        {
+            vec_construct_prealloc(&v_s, intern->s_bt + l, 0, n, 1);
+            vec_construct_prealloc(&v_a, intern->a_bt + l, 0, n, 1);
+            vec_construct_prealloc(&v_dlt, &intern->dlt_bt, 0, n, 1);
+            vec_construct_prealloc(&v_err, &intern->err_bt, 0, n, 1);
+            layer[l].activ.deriv(&v_dlt, &v_s, &v_a);
+            vec_mulby(&v_dlt, &v_err);
+            if (mask)
+                nn_dense_mask_rows(dlt, mask, nbr_rows, out_sz);
+        }
+        const FLT_TYP *a_prev;
         if (l != 0)
         {
-            buff_1->d = w[l].d2;
-            vec_dot_mat(buff_1, buff_2, w + l);
-            tmp = a + l - 1;
+            nn_dense_backward_error(err, dlt, nbr_rows, mat_at(model->weight + l, 0, 0), out_sz, inp_sz);
+            a_prev = payload_at(intern->a_bt + l - 1, 0);
         }
         else
         {
-            tmp = &model->intern.a_inp; // data_x;
+            a_prev = payload_at(&intern->a_inp_bt, 0);
         }
-        mat_update_outer(model->intern.d_w + l, 1 / (1 - layer[l].dropout), buff_2, tmp);
-        vec_update(model->intern.d_b + l, 1, buff_2);
+        nn_dense_backward_param(mat_at(intern->d_w + l, 0, 0), vec_at(intern->d_b + l, 0),
+                                dlt, a_prev, nbr_rows, 1 / (1 - layer[l].dropout), out_sz, inp_sz);
+        // delta, error to the layer below (not for layer 0), weight and bias gradients
+        NN_PROF_STOP(intern->prof, t_ph, l, NN_PROF_BACKWARD,
+                     n * (2 + ((l != 0) ? 2 * inp_sz : 0) + 2 * inp_sz + 1),
+                     (((l != 0) ? out_sz * inp_sz + n + nbr_rows * inp_sz : 0) + 2 * (out_sz * inp_sz + out_sz) +
+                      4 * n + nbr_rows * inp_sz) * sizeof(FLT_TYP));
     }
+    vec_destruct(&v_s);
+    vec_destruct(&v_a);
+    vec_destruct(&v_dlt);
+    vec_destruct(&v_err);
 }
 
 static inline void init_ind(IND_TYP *ind, IND_TYP size)
@@ -261,19 +540,368 @@ static inline void init_ind(IND_TYP *ind, IND_TYP size)
         ind[i] = i;
 }
 
-static inline void shuffle_ind(IND_TYP *ind, IND_TYP size, uint64_t rnd(void))
+typedef struct train_shared
+{
+    nn_model *model;
+    const data_points *data_x;
+    const slice *x_sly;
+    const data_points *data_trg;
+    const slice *trg_sly;
+    const vec *data_weight;
+    const slice *index_sly;
+    IND_TYP batch_size;
+    int first_epoch, nbr_epochs;
+    bool shuffle;
+    uint64_t train_seed; // of the data order (rnd_shuffle_epoch); 0: global generator
+    uint64_t rank_seed;  // of this rank's data order; train_seed unless distributed
+    nn_optim *optimizer;
+    const nn_loss *loss;
+    IND_TYP *ind;
+    int nbr_threads;
+    nn_model_intern **intern; // per thread; intern[0] is &model->intern
+    nn_par_barrier barrier;
+    uint64_t seed; // of the dropout masks
+    nn_prefetch *prefetch;          // NULL: the threads gather their own rows
+    const nn_prefetch_batch *batch; // the staged current batch, set by thread 0
+    nn_prof *thr_prof;              // per thread counters (NN_PROF builds); NULL if not asked for
+    const nn_model_train_params *params;
+    double t_start;
+    // written by thread 0 only; the other threads read stop after a barrier
+    bool stop;
+    int nbr_epochs_run;
+    IND_TYP nbr_samples;
+    IND_TYP nbr_batches; // over all epochs
+} train_shared;
+
+typedef struct train_args
+{
+    train_shared *sh;
+    int t;
+} train_args;
+
+static inline double wall_time(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// run by thread 0 while the other threads wait or are done with the batch;
+// sets sh->stop if the callback asks for it
+static void call_back(train_shared *sh, int epoch, IND_TYP batch, bool epoch_end)
+{
+    const nn_model_train_params *params = sh->params;
+    if (sh->thr_prof)
+    {
+        for (int t = 0; t < sh->nbr_threads; t++)
+        {
+            nn_prof_merge(params->prof, sh->thr_prof + t);
+            nn_prof_reset(sh->thr_prof + t);
+        }
+    }
+    if (epoch_end)
+        log_msg(LOG_DBG, "nn_model_train: epoch  %d/%d finished.", epoch + 1, sh->nbr_epochs);
+    // the state at the epoch end, before the callback may change the weights
+    if (epoch_end && params->checkpoint &&
+        ((epoch + 1 - sh->first_epoch) % params->checkpoint_every == 0 || epoch + 1 == sh->nbr_epochs))
+    {
+        nn_checkpoint_state state = {.epoch = epoch + 1, .seed = sh->train_seed};
+        nn_checkpoint_snapshot(params->checkpoint, sh->model, sh->optimizer, &state);
+    }
+    if (params->callback)
+    {
+        nn_model_train_info info = {.epoch = epoch + 1, .nbr_epochs = sh->nbr_epochs,
+                                    .batch = batch, .epoch_end = epoch_end,
+                                    .wall_time = wall_time() - sh->t_start,
+                                    .prof = (sh->thr_prof) ? params->prof : NULL};
+        if (params->callback(sh->model, &info, params->callback_ctx))
+        {
+            log_msg(LOG_INF, "nn_model_train: stopped by the callback in epoch %d.", epoch + 1);
+            sh->stop = true;
+        }
+    }
+    // the ranks stop together, whichever asked for it
+    if (params->dist)
+    {
+        FLT_TYP stop = sh->stop;
+        if (nn_dist_allreduce(params->dist, &stop, 1) != 0 || stop > 0)
+            sh->stop = true;
+    }
+}
+
+// All threads run the epoch loop in lockstep; each mini-batch is split into one shard
+// per thread, computed into the thread's own intern, and the gradients are summed
+// with a tree reduction into model->intern. Thread 0 also does the serial parts:
+// shuffling and the optimizer step. Dropout masks are drawn per sample by the
+// thread computing it. With a prefetcher, thread 0 takes the staged batch (already
+// shuffled) before the batch barrier and gives it back once all shards are reduced.
+// A stop asked for by the callback is seen by all threads after the next batch barrier.
+// Distributed, thread 0 sums the reduced gradients over the ranks before the step.
+static int train_worker(void *arg)
+{
+    train_args *ta = (train_args *)arg;
+    train_shared *sh = ta->sh;
+    int t = ta->t;
+    int nbr_thrd = sh->nbr_threads;
+    nn_model *model = sh->model;
+    nn_model_intern *intern = sh->intern[t];
+    IND_TYP nbr_data = sh->index_sly->len;
+    vec *lbl = vec_new(model->ouput_size);
+
+    // only read sh->stop right after a barrier: thread 0 may set it before the others leave a batch
+    bool stop = false;
+    for (int epoch = sh->first_epoch; epoch < sh->nbr_epochs && !stop; epoch++)
+    {
+        if (t == 0 && sh->shuffle && !sh->prefetch && !sh->stop)
+            rnd_shuffle_epoch(sh->ind, nbr_data, sh->rank_seed, epoch);
+        IND_TYP batch = 0;
+        for (IND_TYP i = 0; i < nbr_data; i += sh->batch_size, batch++)
+        {
+            // the last batch takes the remaining data
+            IND_TYP nbr_rows = (i + sh->batch_size <= nbr_data) ? sh->batch_size : nbr_data - i;
+            if (t == 0 && sh->prefetch && !sh->stop)
+                sh->batch = nn_prefetch_acquire(sh->prefetch);
+            nn_par_barrier_wait(&sh->barrier);
+            stop = sh->stop;
+            if (stop)
+                break;
+            if (t == 0 && i == 0)
+                sh->nbr_epochs_run++;
+
+            NN_PROF_START(t_rst);
+            nn_model_reset_gradients(intern);
+            NN_PROF_STOP(intern->prof, t_rst, -1, NN_PROF_RESET, 0, nn_model_nbr_param(model) * sizeof(FLT_TYP));
+            IND_TYP r0 = nbr_rows * t / nbr_thrd;
+            IND_TYP r1 = nbr_rows * (t + 1) / nbr_thrd;
+            if (r1 > r0)
+            {
+                nn_model_dropping_out(model, intern, r1 - r0, sh->seed + (uint64_t)epoch * nbr_data + i + r0);
+                if (sh->prefetch)
+                {
+                    const nn_prefetch_batch *bt = sh->batch;
+                    IND_TYP out_sz = model->ouput_size;
+                    NN_PROF_START(t_gth);
+                    memcpy(payload_at(&intern->a_inp_bt, 0), bt->x + r0 * model->input_size,
+                           (r1 - r0) * model->input_size * sizeof(FLT_TYP));
+                    NN_PROF_STOP(intern->prof, t_gth, -1, NN_PROF_GATHER, 0,
+                                 2 * (r1 - r0) * model->input_size * sizeof(FLT_TYP));
+                    nn_model_forward_batch(model, intern, r1 - r0, true);
+                    nn_model_loss_drv_staged(model, intern, bt->trg + r0 * out_sz,
+                                             (bt->weight) ? bt->weight + r0 : NULL, r1 - r0, sh->loss, lbl);
+                }
+                else
+                {
+                    const IND_TYP *ind = sh->ind + i + r0;
+                    nn_model_gather_batch(intern, sh->data_x, sh->x_sly, sh->index_sly, ind, r1 - r0);
+                    nn_model_forward_batch(model, intern, r1 - r0, true);
+                    nn_model_loss_drv_batch(model, intern, sh->data_trg, sh->trg_sly, sh->data_weight,
+                                            sh->index_sly, ind, r1 - r0, sh->loss, lbl);
+                }
+                nn_model_backward_batch(model, intern, r1 - r0);
+            }
+
+            for (int stride = 1; stride < nbr_thrd; stride *= 2)
+            {
+                nn_par_barrier_wait(&sh->barrier);
+                if (t % (2 * stride) == 0 && t + stride < nbr_thrd)
+                {
+                    NN_PROF_START(t_red);
+                    nn_model_add_gradients(intern, sh->intern[t + stride]);
+                    NN_PROF_STOP(intern->prof, t_red, -1, NN_PROF_REDUCE, nn_model_nbr_param(model),
+                                 3 * nn_model_nbr_param(model) * sizeof(FLT_TYP));
+                }
+            }
+            if (t == 0 && sh->prefetch)
+                nn_prefetch_release(sh->prefetch);
+            if (t == 0 && sh->params->dist)
+            {
+                NN_PROF_START(t_ar);
+                if (nn_dist_allreduce(sh->params->dist, payload_at(&model->intern.grad, 0), model->intern.grad.size) != 0)
+                {
+                    log_msg(LOG_ERR, "nn_model_train: the gradients can't be summed over the ranks; training stopped.");
+                    sh->stop = true;
+                }
+                NN_PROF_STOP(intern->prof, t_ar, -1, NN_PROF_ALLREDUCE, nn_model_nbr_param(model),
+                             2 * nn_model_nbr_param(model) * sizeof(FLT_TYP));
+            }
+            if (t == 0 && !sh->stop)
+            {
+                NN_PROF_START(t_opt);
+                nn_optim_update_model(sh->optimizer, model);
+                // parameters read and written, gradients read; the optimizer state is not counted
+                NN_PROF_STOP(intern->prof, t_opt, -1, NN_PROF_OPTIM, 0, 3 * nn_model_nbr_param(model) * sizeof(FLT_TYP));
+                sh->nbr_samples += nbr_rows;
+                sh->nbr_batches++;
+                bool last = (i + nbr_rows == nbr_data);
+                if (last || (sh->params->callback_every > 0 && sh->nbr_batches % sh->params->callback_every == 0))
+                    call_back(sh, epoch, batch + 1, last);
+            }
+        }
+    }
+
+    vec_del(lbl);
+    return 0;
+}
+
+// Hogwild: thread t trains on the mini-batches t, t + T, t + 2T, ... of each epoch and
+// applies the (SGD) step with its own gradients straight to the shared weights; the
+// weights are read and written without any locks. Threads only meet at epoch ends.
+static int train_async_worker(void *arg)
 {
-    for (IND_TYP i = 0; i < size - 1; i++)
+    train_args *ta = (train_args *)arg;
+    train_shared *sh = ta->sh;
+    int t = ta->t;
+    nn_model *model = sh->model;
+    nn_model_intern *intern = sh->intern[t];
+    IND_TYP nbr_data = sh->index_sly->len;
+    vec *lbl = vec_new(model->ouput_size);
+    // the model as seen by the optimizer: shared weights, own gradients
+    nn_model view = *model;
+
+    for (int epoch = sh->first_epoch; epoch < sh->nbr_epochs; epoch++)
     {
-        IND_TYP j = rnd() % (size - i) + i;
-        assert(j >= 0 && j < size);
-        if (j != i)
+        if (t == 0 && sh->shuffle && !sh->stop)
+            rnd_shuffle_epoch(sh->ind, nbr_data, sh->rank_seed, epoch);
+        nn_par_barrier_wait(&sh->barrier);
+        if (sh->stop)
+            break;
+        for (IND_TYP i = t * sh->batch_size; i < nbr_data; i += sh->nbr_threads * sh->batch_size)
         {
-            IND_TYP tmp = ind[i];
-            ind[i] = ind[j];
-            ind[j] = tmp;
+            IND_TYP nbr_rows = (i + sh->batch_size <= nbr_data) ? sh->batch_size : nbr_data - i;
+            nn_model_dropping_out(model, intern, nbr_rows, sh->seed + (uint64_t)epoch * nbr_data + i);
+            NN_PROF_START(t_rst);
+            nn_model_reset_gradients(intern);
+            NN_PROF_STOP(intern->prof, t_rst, -1, NN_PROF_RESET, 0, nn_model_nbr_param(model) * sizeof(FLT_TYP));
+            nn_model_gather_batch(intern, sh->data_x, sh->x_sly, sh->index_sly, sh->ind + i, nbr_rows);
+            nn_model_forward_batch(model, intern, nbr_rows, true);
+            nn_model_loss_drv_batch(model, intern, sh->data_trg, sh->trg_sly, sh->data_weight,
+                                    sh->index_sly, sh->ind + i, nbr_rows, sh->loss, lbl);
+            nn_model_backward_batch(model, intern, nbr_rows);
+            view.intern = *intern;
+            NN_PROF_START(t_opt);
+            nn_optim_update_model(sh->optimizer, &view);
+            NN_PROF_STOP(intern->prof, t_opt, -1, NN_PROF_OPTIM, 0, 3 * nn_model_nbr_param(model) * sizeof(FLT_TYP));
+        }
+        nn_par_barrier_wait(&sh->barrier);
+        if (t == 0)
+        {
+            sh->nbr_epochs_run++;
+            sh->nbr_samples += nbr_data;
+            sh->nbr_batches += (nbr_data + sh->batch_size - 1) / sh->batch_size;
+            call_back(sh, epoch, (nbr_data + sh->batch_size - 1) / sh->batch_size, true);
         }
     }
+
+    vec_del(lbl);
+    return 0;
+}
+
+// Makes the replicas (intern[0] is the model's own), the barrier and, if prof, the counters
+// of nbr_threads training threads; false (logged, nothing kept) if the barrier can't be made.
+static bool train_threads_begin(train_shared *sh, int nbr_threads, bool async, bool prof)
+{
+    nn_model *model = sh->model;
+    if (nn_par_barrier_init(&sh->barrier, nbr_threads) != 0)
+    {
+        log_msg(LOG_WRN, "nn_model_train: cannot initialize the barrier of %d threads.", nbr_threads);
+        return false;
+    }
+    IND_TYP shard_cap = (async) ? sh->batch_size : (sh->batch_size + nbr_threads - 1) / nbr_threads;
+    nn_model_intern **intern = (nn_model_intern **)calloc(nbr_threads, sizeof(nn_model_intern *));
+    assert(intern);
+    intern[0] = &model->intern;
+    for (int t = 1; t < nbr_threads; t++)
+    {
+        intern[t] = (nn_model_intern *)calloc(1, sizeof(nn_model_intern));
+        assert(intern[t]);
+        nn_model_intern_construct(intern[t], model->nbr_layers, model->input_size);
+        for (int l = 0; l < model->nbr_layers; l++)
+            nn_model_intern_add(intern[t], model->layer + l, (l != 0) ? model->layer[l - 1].out_sz : model->input_size);
+    }
+    if (nn_model_is_packed(model))
+    {
+        // packed replicas: the gradient reduction is a single buffer add
+        IND_TYP *w_off = (IND_TYP *)calloc(2 * model->nbr_layers, sizeof(IND_TYP));
+        assert(w_off);
+        IND_TYP *b_off = w_off + model->nbr_layers;
+        IND_TYP size = nn_model_param_layout(model, w_off, b_off);
+        for (int t = 1; t < nbr_threads; t++)
+            nn_model_intern_pack(intern[t], size, w_off, b_off);
+        free(w_off);
+    }
+    for (int t = 0; t < nbr_threads; t++)
+        nn_model_intern_reserve_batch(intern[t], shard_cap);
+    if (prof)
+    {
+        sh->thr_prof = (nn_prof *)calloc(nbr_threads, sizeof(nn_prof));
+        assert(sh->thr_prof);
+        for (int t = 0; t < nbr_threads; t++)
+        {
+            nn_prof_construct(sh->thr_prof + t, model->nbr_layers);
+            intern[t]->prof = sh->thr_prof + t;
+        }
+    }
+    sh->nbr_threads = nbr_threads;
+    sh->intern = intern;
+    return true;
+}
+
+static void train_threads_end(train_shared *sh)
+{
+    nn_par_barrier_destroy(&sh->barrier);
+    if (sh->thr_prof)
+    {
+        for (int t = 0; t < sh->nbr_threads; t++)
+            nn_prof_destruct(sh->thr_prof + t);
+        free(sh->thr_prof);
+        sh->thr_prof = NULL;
+        sh->intern[0]->prof = NULL;
+    }
+    for (int t = 1; t < sh->nbr_threads; t++)
+    {
+        nn_model_intern_destruct(sh->intern[t]);
+        free(sh->intern[t]);
+    }
+    free(sh->intern);
+    sh->intern = NULL;
+}
+
+// all ranks must train alike; they take on the seed and the weights of rank 0;
+// false (logged) if they don't fit or a rank fails
+static bool dist_begin(nn_model *model, nn_dist *dist, IND_TYP nbr_data, IND_TYP batch_size,
+                       int first_epoch, int nbr_epochs, uint64_t *train_seed)
+{
+    struct
+    {
+        int64_t nbr_data, batch_size, nbr_param;
+        int32_t first_epoch, nbr_epochs;
+        uint64_t seed;
+    } own, root;
+    memset(&own, 0, sizeof(own));
+    own.nbr_data = nbr_data;
+    own.batch_size = batch_size;
+    own.nbr_param = model->param.size;
+    own.first_epoch = first_epoch;
+    own.nbr_epochs = nbr_epochs;
+    if (dist->rank == 0 && !*train_seed)
+        *train_seed = UINT_RND_GEN() | 1;
+    own.seed = *train_seed;
+    root = own;
+    if (nn_dist_broadcast(dist, &root, sizeof(root), 0) != 0)
+        return false;
+    FLT_TYP mismatch = own.nbr_data != root.nbr_data || own.batch_size != root.batch_size ||
+                       own.nbr_param != root.nbr_param || own.first_epoch != root.first_epoch ||
+                       own.nbr_epochs != root.nbr_epochs;
+    if (nn_dist_allreduce(dist, &mismatch, 1) != 0)
+        return false;
+    if (mismatch > 0)
+    {
+        log_msg(LOG_ERR, "nn_model_train: rank %d: the ranks differ in the model, the nbr of rows, the batch size or the epochs!",
+                dist->rank);
+        return false;
+    }
+    *train_seed = root.seed;
+    return nn_dist_broadcast(dist, payload_at(&model->param, 0), model->param.size * sizeof(FLT_TYP), 0) == 0;
 }
 
 nn_model *nn_model_train(nn_model *model,
@@ -286,6 +914,22 @@ nn_model *nn_model_train(nn_model *model,
                            bool shuffle,
                            nn_optim *optimizer,
                            const nn_loss loss)
+{
+    return nn_model_train_with(model, data_x, x_sly, data_trg, trg_sly, data_weight, index_sly,
+                               batch_size, nbr_epochs, shuffle, optimizer, loss, NULL);
+}
+
+nn_model *nn_model_train_with(nn_model *model,
+                                const data_points *data_x, slice x_sly,
+                                const data_points *data_trg, slice trg_sly,
+                                const vec *data_weight,
+                                slice index_sly,
+                                IND_TYP batch_size,
+                                int nbr_epochs,
+                                bool shuffle,
+                                nn_optim *optimizer,
+                                const nn_loss loss,
+                                const nn_model_train_params *params)
 {
     assert(model);
     assert(data_points_is_valid(data_x));
@@ -295,9 +939,20 @@ nn_model *nn_model_train(nn_model *model,
     assert(slice_is_valid(&index_sly));
     assert(batch_size >= 0 && nbr_epochs > 0);
 
+    // the compound literal must outlive the if
+    const nn_model_train_params dflt_params = nn_model_train_params_DEFAULT;
+    if (!params)
+        params = &dflt_params;
+    // the mapping is read-only
+    if (nn_model_is_mapped(model))
+        nn_model_pack(model);
+
     slice_regulate(&x_sly, data_x->width);
     slice_regulate(&trg_sly, data_trg->width);
     slice_regulate(&index_sly, data_x->nbr_points);
+    // no-ops unless the data points are file mappings
+    data_points_advise(data_x, (shuffle) ? NN_MAP_RANDOM : NN_MAP_SEQUENTIAL);
+    data_points_advise(data_trg, (shuffle) ? NN_MAP_RANDOM : NN_MAP_SEQUENTIAL);
 
     assert(model->input_size == x_sly.len);
     assert(model->ouput_size == trg_sly.len);
@@ -306,7 +961,9 @@ nn_model *nn_model_train(nn_model *model,
     if (batch_size == 0)
         batch_size = index_sly.len;
 
-    if (model->nbr_layers == 0 || index_sly.len == 0 || nbr_epochs <= 0 || batch_size <= 0)
+    if (model->nbr_layers == 0 || index_sly.len == 0 || nbr_epochs <= 0 || batch_size <= 0 ||
+        params->first_epoch < 0 || params->first_epoch >= nbr_epochs ||
+        (params->checkpoint && params->checkpoint_every <= 0))
     {
         log_msg(LOG_WRN, "nn_model_train: the model can't be trained with the given params!");
         return model;
@@ -317,78 +974,178 @@ nn_model *nn_model_train(nn_model *model,
         return model;
     }
 
-    vec *buff_1 = vec_new(model->max_width);
-    vec *buff_2 = vec_new(model->max_width);
-    vec *output = vec_new(model->ouput_size);
-    vec *loss_drv = vec_new(model->ouput_size);
-    vec feat = vec_NULL, lbl = vec_NULL;
     IND_TYP nbr_data = index_sly.len;
-    IND_TYP nbr_batch = nbr_data / batch_size;
-    IND_TYP nbr_rem_data = nbr_data - nbr_batch * batch_size;
+    if (batch_size > nbr_data)
+        batch_size = nbr_data;
+    bool async = params->async;
+    if (async && optimizer->class.update_model != nn_optim_cls_SGD.update_model)
+    {
+        log_msg(LOG_WRN, "nn_model_train: async mode needs the SGD optimizer; training synchronously.");
+        async = false;
+    }
+    nn_dist *dist = params->dist;
+    uint64_t train_seed = params->seed;
+    if (dist)
+    {
+        if (async)
+        {
+            log_msg(LOG_WRN, "nn_model_train: async mode can't be distributed; training synchronously.");
+            async = false;
+        }
+        // the gradients (and weights) are passed as one buffer
+        if (!nn_model_is_packed(model))
+            nn_model_pack(model);
+        if (!dist_begin(model, dist, nbr_data, batch_size, params->first_epoch, nbr_epochs, &train_seed))
+        {
+            log_msg(LOG_ERR, "nn_model_train: the ranks can't begin; nothing trained.");
+            return model;
+        }
+    }
+    IND_TYP nbr_batch = (nbr_data + batch_size - 1) / batch_size;
+    int nbr_threads = nn_par_nbr_threads(params->nbr_threads, (async) ? nbr_batch : batch_size);
 
     IND_TYP *ind = (IND_TYP *)calloc(nbr_data, sizeof(IND_TYP));
     assert(ind);
     init_ind(ind, nbr_data);
 
-    log_msg(LOG_INF, "nn_model_train: training began.");
-    for (IND_TYP epoch = 0; epoch < nbr_epochs; epoch++)
+    train_shared sh = {.model = model, .data_x = data_x, .x_sly = &x_sly,
+                       .data_trg = data_trg, .trg_sly = &trg_sly,
+                       .data_weight = data_weight, .index_sly = &index_sly,
+                       .batch_size = batch_size, .first_epoch = params->first_epoch,
+                       .nbr_epochs = nbr_epochs, .shuffle = shuffle, .train_seed = train_seed,
+                       .optimizer = optimizer, .loss = &loss, .ind = ind, .params = params};
+    // checkpoints are resumed with their seed, so they need one
+    if (!sh.train_seed && params->checkpoint)
+        sh.train_seed = UINT_RND_GEN() | 1;
+    // each rank its own data order and dropout masks; rank 0 as if not distributed
+    sh.rank_seed = (dist && dist->rank > 0) ? rnd_mix64(sh.train_seed + dist->rank) | 1 : sh.train_seed;
+    sh.seed = (sh.rank_seed) ? rnd_mix64(sh.rank_seed) : UINT_RND_GEN();
+    bool prof = false;
+#ifdef NN_PROF
+    if (params->prof && params->prof->nbr_layers != model->nbr_layers)
+        log_msg(LOG_WRN, "nn_model_train: params->prof has another nbr of layers than the model; not profiled.");
+    else
+        prof = params->prof != NULL;
+#else
+    if (params->prof)
+        log_msg(LOG_WRN, "nn_model_train: built without NN_PROF; params->prof stays unchanged.");
+#endif
+    // started after the seed is drawn: from here on only the producer draws random numbers
+    nn_prefetch prefetch;
+    if (params->prefetch && !async)
+        sh.prefetch = nn_prefetch_start(&prefetch, data_x, x_sly, data_trg, trg_sly, data_weight,
+                                        index_sly, batch_size, sh.first_epoch, nbr_epochs, shuffle, sh.rank_seed);
+    train_args *args = (train_args *)calloc(nbr_threads, sizeof(train_args));
+    assert(args);
+
+    // nothing runs unless all threads start (the workers meet at barriers for nbr_threads);
+    // else fewer threads, with replicas, shards and barrier to match
+    int res = -1;
+    double t0 = 0;
+    while (res < 0)
     {
-        if (shuffle)
-            shuffle_ind(ind, nbr_data, UINT_RND_GEN);
-        IND_TYP i = 0;
-        for (IND_TYP batch = 0; batch < nbr_batch; batch++)
+        if (!train_threads_begin(&sh, nbr_threads, async, prof))
         {
-
-            nn_model_dropping_out(model);
-            nn_model_reset_gradients(&model->intern);
-            for (IND_TYP b_i = 0; b_i < batch_size; b_i++, i++)
-            {
-                IND_TYP k = slice_index(&index_sly, ind[i]);
-                data_points_at(data_x, &feat, k, &x_sly);
-                nn_model_apply(model, &feat, output, true);
-                data_points_at(data_trg, &lbl, k, &trg_sly);
-                loss.deriv(loss_drv, &lbl, output);
-                if (data_weight)
-                    vec_scale(loss_drv, *vec_at(data_weight, k));
-                nn_model_backprop(model, loss_drv, buff_1, buff_2);
-            }
-            nn_optim_update_model(optimizer, model);
+            if (nbr_threads == 1)
+                break;
+            nbr_threads = 1;
+            continue;
         }
-        if (nbr_rem_data > 0)
+        for (int t = 0; t < nbr_threads; t++)
+            args[t] = (train_args){.sh = &sh, .t = t};
+        log_msg(LOG_INF, "nn_model_train: training began (%d threads%s).", nbr_threads, (async) ? ", async" : "");
+        t0 = wall_time();
+        sh.t_start = t0;
+        res = nn_par_run(nbr_threads, (async) ? train_async_worker : train_worker, args, sizeof(train_args));
+        if (res < 0)
         {
-            nn_model_dropping_out(model);
-            nn_model_reset_gradients(&model->intern);
-            for (; i < nbr_data; i++)
-            {
-                IND_TYP k = slice_index(&index_sly, ind[i]);
-                data_points_at(data_x, &feat, k, &x_sly);
-                nn_model_apply(model, &feat, output, true);
-                data_points_at(data_trg, &lbl, k, &trg_sly);
-                loss.deriv(loss_drv, &lbl, output);
-                if (data_weight)
-                    vec_scale(loss_drv, *vec_at(data_weight, k));
-                nn_model_backprop(model, loss_drv, buff_1, buff_2);
-            }
-            nn_optim_update_model(optimizer, model);
+            train_threads_end(&sh);
+            log_msg(LOG_WRN, "nn_model_train: cannot start %d threads; retrying with %d.", nbr_threads, nbr_threads / 2);
+            nbr_threads /= 2;
         }
-        log_msg(LOG_DBG, "nn_model_train: epoch  %d/%d finished.", epoch + 1, nbr_epochs);
     }
+    if (res < 0)
+    {
+        log_msg(LOG_ERR, "nn_model_train: cannot initialize the thread barrier; nothing trained.");
+        if (sh.prefetch)
+            nn_prefetch_stop(sh.prefetch);
+        free(args);
+        free(ind);
+        return model;
+    }
+    double dt = wall_time() - t0;
     log_msg(LOG_INF, "nn_model_train: training ended.");
+    if (sh.prefetch)
+        nn_prefetch_stop(sh.prefetch);
+    // the callbacks (e.g. nn_early_stop restoring its best weights) may have set the replicas apart
+    if (dist && !dist->failed)
+        nn_dist_broadcast(dist, payload_at(&model->param, 0), model->param.size * sizeof(FLT_TYP), 0);
+
+    if (params->stats)
+    {
+        nn_model_train_stats *stats = params->stats;
+        stats->nbr_samples = sh.nbr_samples;
+        stats->nbr_epochs = sh.nbr_epochs_run;
+        stats->stopped = sh.stop;
+        stats->wall_time = dt;
+        stats->samples_per_sec = (dt > 0) ? stats->nbr_samples / dt : 0;
+        stats->final_loss = 0;
+        if (params->stats_final_loss)
+            stats->final_loss = nn_model_eval_par(model, data_x, x_sly, data_trg, trg_sly, data_weight,
+                                                  index_sly, loss, false, nbr_threads);
+    }
 
+    train_threads_end(&sh);
+    free(args);
     free(ind);
-    vec_del(loss_drv);
-    vec_del(output);
-    vec_del(buff_2);
-    vec_del(buff_1);
-    vec_destruct(&feat);
-    vec_destruct(&lbl);
     return model;
 }
 
+static void *eval_ctx_construct(const void *model, IND_TYP batch_cap)
+{
+    nn_infer_ctx *ctx = (nn_infer_ctx *)malloc(sizeof(nn_infer_ctx));
+    assert(ctx);
+    if (!nn_infer_ctx_construct(ctx, (const nn_model *)model, batch_cap))
+    {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void eval_ctx_destruct(void *ctx)
+{
+    nn_infer_ctx_destruct((nn_infer_ctx *)ctx);
+    free(ctx);
+}
+
+static FLT_TYP *eval_ctx_input(void *ctx)
+{
+    return nn_infer_ctx_input((nn_infer_ctx *)ctx);
+}
+
+static const FLT_TYP *eval_infer_batch(const void *model, void *ctx, IND_TYP nbr_rows)
+{
+    return nn_model_infer_batch((const nn_model *)model, (nn_infer_ctx *)ctx, nbr_rows);
+}
+
+static const nn_eval_class eval_cls = {.construct = eval_ctx_construct, .destruct = eval_ctx_destruct,
+                                       .input = eval_ctx_input, .infer_batch = eval_infer_batch};
+
 FLT_TYP nn_model_eval(const nn_model *model, const data_points *data_x, slice x_sly,
                       const data_points *data_trg, slice trg_sly,
                       const vec *data_weight, slice index_sly,
                       const nn_loss loss, bool classification)
+{
+    return nn_model_eval_par(model, data_x, x_sly, data_trg, trg_sly, data_weight, index_sly,
+                             loss, classification, 1);
+}
+
+FLT_TYP nn_model_eval_par(const nn_model *model, const data_points *data_x, slice x_sly,
+                          const data_points *data_trg, slice trg_sly,
+                          const vec *data_weight, slice index_sly,
+                          const nn_loss loss, bool classification,
+                          int nbr_threads)
 {
     assert(model);
     assert(data_points_is_valid(data_x));
@@ -405,37 +1162,14 @@ FLT_TYP nn_model_eval(const nn_model *model, const data_points *data_x, slice x_
     assert(model->ouput_size == trg_sly.len);
     assert(!data_weight || data_weight->d == index_sly.len);
 
-    FLT_TYP loss_value = 0;
-    FLT_TYP trg_nrm = 0;
-    vec inp = vec_NULL, trg = vec_NULL;
-    vec *out = vec_new(trg_sly.len);
-    vec *buf = vec_new(trg_sly.len);
-    for (int i = 0; i < index_sly.len; i++)
-    {
-        IND_TYP k = slice_index(&index_sly, i);
-        data_points_at(data_x, &inp, k, &x_sly);
-        nn_model_apply(model, &inp, out, false);
-        data_points_at(data_trg, &trg, k, &trg_sly);
-        FLT_TYP w = 1;
-        if (data_weight)
-            w = *vec_at(data_weight, k);
-        if (!classification)
-        {
-            trg_nrm += w * vec_norm_2(&trg);
-            loss_value += w * loss.func(&trg, out, buf);
-        }
-        else
-        {
-            trg_nrm += w;
-            IND_TYP im = vec_argmax(out);
-            loss_value += w * (1 - *vec_at(&trg, im));
-        }
+    if (model->nbr_layers == 0 || index_sly.len == 0)
+    {
+        log_msg(LOG_WRN, "nn_model_eval: the model can't be evaluated with the given params!");
+        return 0;
     }
-    vec_del(buf);
-    vec_del(out);
-    vec_destruct(&inp);
-    vec_destruct(&trg);
-    return loss_value / trg_nrm;
+
+    return nn_eval_loss(&eval_cls, model, model->input_size, model->ouput_size, data_x, x_sly,
+                        data_trg, trg_sly, data_weight, index_sly, loss, classification, nbr_threads);
 }
 
 char *nn_model_to_str(const nn_model *model, char *string)
@@ -471,6 +1205,41 @@ void nn_model_print(const nn_model *model)
     }
 }
 
+FLT_TYP *nn_model_get_param(const nn_model *model, FLT_TYP *param)
+{
+    assert(model);
+    assert(param || model->nbr_layers == 0);
+    FLT_TYP *p = param;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        IND_TYP w_sz = model->weight[l].d1 * model->weight[l].d2;
+        memcpy(p, mat_at(model->weight + l, 0, 0), w_sz * sizeof(FLT_TYP));
+        p += w_sz;
+        memcpy(p, vec_at(model->bias + l, 0), model->bias[l].d * sizeof(FLT_TYP));
+        p += model->bias[l].d;
+    }
+    return param;
+}
+
+nn_model *nn_model_set_param(nn_model *model, const FLT_TYP *param)
+{
+    assert(model);
+    assert(param || model->nbr_layers == 0);
+    // the mapping is read-only
+    if (nn_model_is_mapped(model))
+        nn_model_pack(model);
+    const FLT_TYP *p = param;
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        IND_TYP w_sz = model->weight[l].d1 * model->weight[l].d2;
+        memcpy(mat_at(model->weight + l, 0, 0), p, w_sz * sizeof(FLT_TYP));
+        p += w_sz;
+        memcpy(vec_at(model->bias + l, 0), p, model->bias[l].d * sizeof(FLT_TYP));
+        p += model->bias[l].d;
+    }
+    return model;
+}
+
 size_t nn_model_nbr_param(const nn_model *model)
 {
     assert(model);
@@ -484,6 +1253,170 @@ size_t nn_model_nbr_param(const nn_model *model)
     return nbr_param;
 }
 
+// parameters per chunk of nn_model_merge; a chunk lies in one tensor
+#define NN_MODEL_MERGE_CHUNK 16384
+// elements summed in registers / L1 before they are stored
+#define NN_MODEL_MERGE_BLOCK 256
+
+typedef struct merge_chunk
+{
+    int tensor; // 2 * layer (weight) or 2 * layer + 1 (bias)
+    IND_TYP off, len;
+} merge_chunk;
+
+typedef struct merge_args
+{
+    nn_model *result;
+    const nn_model *const *model_arr;
+    const FLT_TYP *weight; // normalized
+    int nbr_models;
+    const merge_chunk *chunk;
+    IND_TYP nbr_chunks;
+    atomic_llong *next_chunk;
+} merge_args;
+
+static inline FLT_TYP *tensor_at(const nn_model *model, int tensor)
+{
+    return (tensor % 2 == 0) ? mat_at(model->weight + tensor / 2, 0, 0) : vec_at(model->bias + tensor / 2, 0);
+}
+
+// out[i] = sum_k weight[k] * src[k][i] block by block, so out may be one of the src
+static void merge_sum(FLT_TYP *out, const FLT_TYP *const *src, const FLT_TYP *weight, int nbr_models, IND_TYP len)
+{
+    FLT_TYP acc[NN_MODEL_MERGE_BLOCK];
+    for (IND_TYP i0 = 0; i0 < len; i0 += NN_MODEL_MERGE_BLOCK)
+    {
+        IND_TYP nb = (len - i0 < NN_MODEL_MERGE_BLOCK) ? len - i0 : NN_MODEL_MERGE_BLOCK;
+        const FLT_TYP *restrict s = src[0] + i0;
+        FLT_TYP w = weight[0];
+        for (IND_TYP j = 0; j < nb; j++)
+            acc[j] = w * s[j];
+        for (int k = 1; k < nbr_models; k++)
+        {
+            s = src[k] + i0;
+            w = weight[k];
+            for (IND_TYP j = 0; j < nb; j++)
+                acc[j] += w * s[j];
+        }
+        memcpy(out + i0, acc, nb * sizeof(FLT_TYP));
+    }
+}
+
+static int merge_worker(void *arg)
+{
+    merge_args *ma = (merge_args *)arg;
+    const FLT_TYP **src = (const FLT_TYP **)malloc(ma->nbr_models * sizeof(FLT_TYP *));
+    assert(src);
+    for (IND_TYP c; (c = atomic_fetch_add(ma->next_chunk, 1)) < ma->nbr_chunks;)
+    {
+        const merge_chunk *ch = ma->chunk + c;
+        for (int k = 0; k < ma->nbr_models; k++)
+            src[k] = tensor_at(ma->model_arr[k], ch->tensor) + ch->off;
+        merge_sum(tensor_at(ma->result, ch->tensor) + ch->off, src, ma->weight, ma->nbr_models, ch->len);
+    }
+    free(src);
+    return 0;
+}
+
+// what differs between the structures of a and b, NULL if they can be merged
+static const char *merge_mismatch(const nn_model *a, const nn_model *b)
+{
+    if (a->input_size != b->input_size || a->nbr_layers != b->nbr_layers)
+        return "different sizes";
+    for (int l = 0; l < a->nbr_layers; l++)
+    {
+        if (a->weight[l].d1 != b->weight[l].d1 || a->weight[l].d2 != b->weight[l].d2 ||
+            a->bias[l].d != b->bias[l].d)
+            return "different layer sizes";
+        if (nn_activ_to_enum(&a->layer[l].activ) != nn_activ_to_enum(&b->layer[l].activ))
+            return "different activations";
+        if (a->bias[l].step != 1 || b->bias[l].step != 1)
+            return "strided bias";
+    }
+    return NULL;
+}
+
+int nn_model_merge(nn_model *result, const nn_model *const model_arr[], const FLT_TYP weight_arr[],
+                   int nbr_models, int nbr_threads)
+{
+    assert(result);
+    assert(model_arr);
+    if (nbr_models <= 0)
+    {
+        log_msg(LOG_ERR, "nn_model_merge: no models to merge!");
+        return -1;
+    }
+    const nn_model *ref = model_arr[0];
+    const char *err = NULL;
+    for (int k = 0; k < nbr_models && !err; k++)
+    {
+        assert(model_arr[k]);
+        err = merge_mismatch(ref, model_arr[k]);
+    }
+    if (!err && !nn_model_is_null(result))
+        err = merge_mismatch(ref, result);
+    double w_sum = 0;
+    for (int k = 0; k < nbr_models && weight_arr; k++)
+        w_sum += weight_arr[k];
+    if (!err && weight_arr && !(w_sum > 0 && w_sum < INFINITY))
+        err = "the sum of the weights is not positive";
+    if (err)
+    {
+        log_msg(LOG_ERR, "nn_model_merge: %s!", err);
+        return -1;
+    }
+
+    if (nn_model_is_null(result))
+    {
+        // a copy of the first model, overwritten below
+        uint8_t *bytes = (uint8_t *)malloc(nn_model_serial_size(ref));
+        assert(bytes);
+        nn_model_serialize(ref, bytes);
+        nn_model_deserialize(result, bytes);
+        free(bytes);
+    }
+    // the mapping is read-only
+    if (nn_model_is_mapped(result))
+        nn_model_pack(result);
+
+    FLT_TYP *weight = (FLT_TYP *)malloc(nbr_models * sizeof(FLT_TYP));
+    assert(weight);
+    for (int k = 0; k < nbr_models; k++)
+        weight[k] = (weight_arr) ? (FLT_TYP)(weight_arr[k] / w_sum) : (FLT_TYP)1 / nbr_models;
+
+    IND_TYP nbr_chunks = 0;
+    for (int l = 0; l < ref->nbr_layers; l++)
+        nbr_chunks += (ref->weight[l].d1 * ref->weight[l].d2 + NN_MODEL_MERGE_CHUNK - 1) / NN_MODEL_MERGE_CHUNK +
+                      (ref->bias[l].d + NN_MODEL_MERGE_CHUNK - 1) / NN_MODEL_MERGE_CHUNK;
+    merge_chunk *chunk = (merge_chunk *)malloc((nbr_chunks + 1) * sizeof(merge_chunk));
+    assert(chunk);
+    IND_TYP c = 0;
+    for (int tensor = 0; tensor < 2 * ref->nbr_layers; tensor++)
+    {
+        int l = tensor / 2;
+        IND_TYP len = (tensor % 2 == 0) ? ref->weight[l].d1 * ref->weight[l].d2 : ref->bias[l].d;
+        for (IND_TYP off = 0; off < len; off += NN_MODEL_MERGE_CHUNK)
+            chunk[c++] = (merge_chunk){.tensor = tensor, .off = off,
+                                       .len = (len - off < NN_MODEL_MERGE_CHUNK) ? len - off : NN_MODEL_MERGE_CHUNK};
+    }
+    assert(c == nbr_chunks);
+
+    nbr_threads = nn_par_nbr_threads(nbr_threads, nbr_chunks);
+    merge_args *args = (merge_args *)calloc(nbr_threads, sizeof(merge_args));
+    assert(args);
+    atomic_llong next_chunk = 0;
+    for (int t = 0; t < nbr_threads; t++)
+        args[t] = (merge_args){.result = result, .model_arr = model_arr, .weight = weight,
+                               .nbr_models = nbr_models, .chunk = chunk, .nbr_chunks = nbr_chunks,
+                               .next_chunk = &next_chunk};
+    nn_par_run_tasks(nbr_threads, merge_worker, args, sizeof(merge_args));
+
+    free(args);
+    free(chunk);
+    free(weight);
+    return 0;
+}
+
 static inline uint8_t *wrt2byt(const void *obj, size_t sz, uint8_t *bytes)
 {
     assert(obj);
@@ -551,7 +1484,6 @@ const uint8_t *nn_model_deserialize(nn_model *model, const uint8_t *byte_arr)
     nn_model_construct(model, cap, inp_sz);
     byte_arr = rd_byt(&model->nbr_layers, sizeof(model->nbr_layers), byte_arr);
     byte_arr = rd_byt(&model->max_width, sizeof(model->max_width), byte_arr);
-    nn_model_intern_construct(&model->intern, cap, inp_sz);
     for (IND_TYP l = 0; l < model->nbr_layers; l++)
     {
         byte_arr = nn_layer_deserialize(model->layer + l, byte_arr);
@@ -560,58 +1492,431 @@ const uint8_t *nn_model_deserialize(nn_model *model, const uint8_t *byte_arr)
         IND_TYP ly_inp_sz = (l != 0) ? model->layer[l - 1].out_sz : inp_sz;
         nn_model_intern_add(&model->intern, model->layer + l, ly_inp_sz);
     }
+    if (model->nbr_layers > 0)
+        model->ouput_size = model->layer[model->nbr_layers - 1].out_sz;
     return byte_arr;
 }
 
-void nn_model_save(const nn_model *model, const char *file_path)
+// model file format; all fields in the byte order of the writer, checked by byte_order
+#define NN_MODEL_FILE_MAGIC "NNMODEL"
+#define NN_MODEL_FILE_VERSION 1
+#define NN_MODEL_FILE_BYTE_ORDER 0x01020304u
+
+typedef struct nn_model_file_header
 {
-    FILE *file = fopen(file_path, "wb");
-    if (!file)
+    char magic[8];
+    uint32_t version;
+    uint32_t flt_size;   // sizeof(FLT_TYP) of the writer
+    uint32_t byte_order; // NN_MODEL_FILE_BYTE_ORDER
+    int32_t layer_capacity;
+    int32_t nbr_layers;
+    uint32_t reserved;
+    uint64_t input_size;
+    uint64_t param_off;  // file offset of the parameters; multiple of NN_MODEL_PARAM_ALIGN
+    uint64_t param_size; // nbr of FLT_TYP values
+    uint64_t file_size;
+} nn_model_file_header;
+
+typedef struct nn_model_file_layer
+{
+    uint64_t out_sz;
+    uint64_t inp_sz;
+    uint64_t w_off; // in FLT_TYP values from param_off; the weight is out_sz x inp_sz row-major
+    uint64_t b_off;
+    double dropout;
+    int32_t activ; // enum nn_activ_enum
+    uint32_t reserved;
+} nn_model_file_layer;
+
+static size_t file_param_off(int nbr_layers)
+{
+    size_t off = sizeof(nn_model_file_header) + nbr_layers * sizeof(nn_model_file_layer);
+    return (off + NN_MODEL_PARAM_ALIGN - 1) / NN_MODEL_PARAM_ALIGN * NN_MODEL_PARAM_ALIGN;
+}
+
+// header and layer records (nbr_layers) of the file of model
+static void file_layout(const nn_model *model, nn_model_file_header *hdr, nn_model_file_layer *rec)
+{
+    IND_TYP *w_off = (IND_TYP *)calloc(2 * model->nbr_layers + 1, sizeof(IND_TYP));
+    assert(w_off);
+    IND_TYP *b_off = w_off + model->nbr_layers;
+    IND_TYP size = nn_model_param_layout(model, w_off, b_off);
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, NN_MODEL_FILE_MAGIC, sizeof(NN_MODEL_FILE_MAGIC));
+    hdr->version = NN_MODEL_FILE_VERSION;
+    hdr->flt_size = sizeof(FLT_TYP);
+    hdr->byte_order = NN_MODEL_FILE_BYTE_ORDER;
+    hdr->layer_capacity = model->layer_capacity;
+    hdr->nbr_layers = model->nbr_layers;
+    hdr->input_size = model->input_size;
+    hdr->param_off = file_param_off(model->nbr_layers);
+    hdr->param_size = size;
+    hdr->file_size = hdr->param_off + size * sizeof(FLT_TYP);
+    for (int l = 0; l < model->nbr_layers; l++)
     {
-        perror("nn_model_save: can't open the file!");
-        exit(-2);
+        memset(rec + l, 0, sizeof(*rec));
+        rec[l].out_sz = model->weight[l].d1;
+        rec[l].inp_sz = model->weight[l].d2;
+        rec[l].w_off = w_off[l];
+        rec[l].b_off = b_off[l];
+        rec[l].dropout = model->layer[l].dropout;
+        rec[l].activ = nn_activ_to_enum(&model->layer[l].activ);
     }
-    size_t size = nn_model_serial_size(model);
-    uint8_t *byte_arr = malloc(size);
-    assert(byte_arr);
-    const uint8_t *ptr = nn_model_serialize(model, byte_arr);
-    size_t wr_sz = fwrite(byte_arr, 1, size, file);
-    if (wr_sz != size)
+    free(w_off);
+}
+
+// returns what is wrong with the header, NULL if it can be read
+static const char *check_file_header(const nn_model_file_header *hdr, size_t file_size)
+{
+    if (memcmp(hdr->magic, NN_MODEL_FILE_MAGIC, sizeof(NN_MODEL_FILE_MAGIC)) != 0)
+        return "not a model file";
+    if (hdr->version != NN_MODEL_FILE_VERSION)
+        return "unsupported version";
+    if (hdr->byte_order != NN_MODEL_FILE_BYTE_ORDER)
+        return "written with another byte order";
+    if (hdr->flt_size != sizeof(FLT_TYP))
+        return "written with another FLT_TYP";
+    if (hdr->nbr_layers < 0 || hdr->layer_capacity <= 0 || hdr->layer_capacity < hdr->nbr_layers ||
+        hdr->input_size == 0)
+        return "invalid model sizes";
+    if (hdr->param_off != file_param_off(hdr->nbr_layers) || hdr->param_off > file_size ||
+        hdr->param_size > (file_size - hdr->param_off) / sizeof(FLT_TYP) ||
+        hdr->file_size != hdr->param_off + hdr->param_size * sizeof(FLT_TYP) ||
+        hdr->file_size > file_size)
+        return "truncated or inconsistent file";
+    return NULL;
+}
+
+static const char *check_file_layers(const nn_model_file_header *hdr, const nn_model_file_layer *rec)
+{
+    const uint64_t align = NN_MODEL_PARAM_ALIGN / sizeof(FLT_TYP);
+    uint64_t inp_sz = hdr->input_size;
+    for (int l = 0; l < hdr->nbr_layers; l++)
     {
-        perror("nn_model_save: can't write (completely) to the file!");
+        const nn_model_file_layer *r = rec + l;
+        if (r->inp_sz != inp_sz || r->out_sz == 0 || r->out_sz > hdr->param_size ||
+            r->inp_sz > hdr->param_size / r->out_sz)
+            return "invalid layer sizes";
+        if (r->w_off % align || r->b_off % align ||
+            r->w_off > hdr->param_size - r->out_sz * r->inp_sz ||
+            r->b_off > hdr->param_size - r->out_sz)
+            return "invalid tensor offsets";
+        if (r->activ < ACTIV_NON || r->activ > ACTIV_UNKNOWN || !(r->dropout >= 0 && r->dropout < 1))
+            return "invalid layer";
+        inp_sz = r->out_sz;
+    }
+    return NULL;
+}
+
+// constructs model with the layers of rec around param: weight and bias are views into it;
+// pack_grad packs the gradients in the same layout as nn_model_pack does
+static nn_model *model_from_file(nn_model *model, const nn_model_file_header *hdr,
+                                 const nn_model_file_layer *rec, payload param, bool pack_grad)
+{
+    nn_model_construct(model, hdr->layer_capacity, (IND_TYP)hdr->input_size);
+    model->param = param;
+    for (int l = 0; l < hdr->nbr_layers; l++)
+    {
+        const nn_model_file_layer *r = rec + l;
+        nn_layer_init(model->layer + l, (IND_TYP)r->out_sz,
+                      nn_activ_from_enum((enum nn_activ_enum)r->activ), (FLT_TYP)r->dropout);
+        mat_construct_prealloc(model->weight + l, &model->param, (IND_TYP)r->w_off,
+                               (IND_TYP)r->out_sz, (IND_TYP)r->inp_sz);
+        vec_construct_prealloc(model->bias + l, &model->param, (IND_TYP)r->b_off, (IND_TYP)r->out_sz, 1);
+        nn_model_intern_add(&model->intern, model->layer + l, (IND_TYP)r->inp_sz);
+        model->nbr_layers++;
+        model->ouput_size = model->layer[l].out_sz;
+        if (model->layer[l].out_sz > model->max_width)
+            model->max_width = model->layer[l].out_sz;
+    }
+    if (pack_grad && hdr->nbr_layers > 0)
+    {
+        IND_TYP *w_off = (IND_TYP *)calloc(2 * hdr->nbr_layers, sizeof(IND_TYP));
+        assert(w_off);
+        IND_TYP *b_off = w_off + hdr->nbr_layers;
+        for (int l = 0; l < hdr->nbr_layers; l++)
+        {
+            w_off[l] = (IND_TYP)rec[l].w_off;
+            b_off[l] = (IND_TYP)rec[l].b_off;
+        }
+        nn_model_intern_pack(&model->intern, (IND_TYP)hdr->param_size, w_off, b_off);
+        free(w_off);
+    }
+    return model;
+}
+
+// writes all of iov, resuming after partial writes
+static bool writev_all(int fd, struct iovec *iov, int cnt)
+{
+    long iov_max = sysconf(_SC_IOV_MAX);
+    if (iov_max <= 0)
+        iov_max = 16; // _XOPEN_IOV_MAX
+    while (cnt > 0)
+    {
+        int n = (cnt < iov_max) ? cnt : (int)iov_max;
+        ssize_t wr = writev(fd, iov, n);
+        if (wr < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        for (; n > 0 && (size_t)wr >= iov->iov_len; n--, cnt--, iov++)
+            wr -= iov->iov_len;
+        if (cnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + wr;
+            iov->iov_len -= wr;
+        }
+    }
+    return true;
+}
+
+int nn_model_save(const nn_model *model, const char *file_path)
+{
+    assert(model);
+    assert(file_path);
+    static const uint8_t zeros[NN_MODEL_PARAM_ALIGN] = {0};
+
+    // written next to the destination and renamed over it once complete, so readers
+    // (and processes having the old file mapped) never see a partial file
+    nn_file_replace rep;
+    if (nn_file_replace_open(&rep, file_path) < 0)
+        return -1;
+
+    nn_model_file_header hdr;
+    nn_model_file_layer *rec = (nn_model_file_layer *)calloc(model->nbr_layers + 1, sizeof(nn_model_file_layer));
+    assert(rec);
+    file_layout(model, &hdr, rec);
+
+    // header, records and the tensors straight from their buffers, zero padded to their offsets
+    struct iovec *iov = (struct iovec *)calloc(4 * model->nbr_layers + 3, sizeof(struct iovec));
+    assert(iov);
+    int cnt = 0;
+    iov[cnt++] = (struct iovec){.iov_base = &hdr, .iov_len = sizeof(hdr)};
+    iov[cnt++] = (struct iovec){.iov_base = rec, .iov_len = model->nbr_layers * sizeof(*rec)};
+    size_t pos = sizeof(hdr) + model->nbr_layers * sizeof(*rec);
+    for (int l = 0; l <= model->nbr_layers; l++)
+    {
+        for (int t = 0; t < 2; t++)
+        {
+            size_t off = (l == model->nbr_layers) ? hdr.file_size
+                         : hdr.param_off + ((t == 0) ? rec[l].w_off : rec[l].b_off) * sizeof(FLT_TYP);
+            assert(off >= pos && off - pos <= sizeof(zeros));
+            if (off > pos)
+                iov[cnt++] = (struct iovec){.iov_base = (void *)zeros, .iov_len = off - pos};
+            if (l == model->nbr_layers)
+                break;
+            assert(t == 0 || model->bias[l].step == 1);
+            size_t sz = (t == 0) ? rec[l].out_sz * rec[l].inp_sz : rec[l].out_sz;
+            void *ptr = (t == 0) ? (void *)mat_at(model->weight + l, 0, 0) : (void *)vec_at(model->bias + l, 0);
+            iov[cnt++] = (struct iovec){.iov_base = ptr, .iov_len = sz * sizeof(FLT_TYP)};
+            pos = off + sz * sizeof(FLT_TYP);
+        }
+    }
+    int res = nn_file_replace_close(&rep, file_path, writev_all(rep.fd, iov, cnt));
+    free(iov);
+    free(rec);
+    return res;
+}
+
+// former format: the byte stream of nn_model_serialize, only checked for its size
+static nn_model *load_serialized(nn_model *model, FILE *file, const char *file_path, size_t file_size)
+{
+    // the size at the head of the stream counts itself
+    size_t size = 0;
+    if (fread(&size, sizeof(size), 1, file) != 1 || size < sizeof(size) + sizeof(model->layer_capacity) +
+        sizeof(model->input_size) + sizeof(model->nbr_layers) + sizeof(model->max_width) || size > file_size)
+    {
+        log_msg(LOG_ERR, "nn_model_load: %s: not a model file!", file_path);
         fclose(file);
-        free(byte_arr);
-        exit(-3);
+        return NULL;
     }
+    uint8_t *byte_arr = malloc(size);
+    assert(byte_arr);
+    memcpy(byte_arr, &size, sizeof(size));
+    size_t sz = sizeof(size) + fread(byte_arr + sizeof(size), 1, size - sizeof(size), file);
     fclose(file);
+    bool ok = sz == size && size == (size_t)(nn_model_deserialize(model, byte_arr) - byte_arr);
     free(byte_arr);
-    assert(size == ((size_t)(ptr - byte_arr)));
+    if (!ok)
+    {
+        log_msg(LOG_ERR, "nn_model_load: %s: truncated or inconsistent file!", file_path);
+        nn_model_destruct(model);
+        return NULL;
+    }
+    return model;
 }
 
 nn_model *nn_model_load(nn_model *model, const char *file_path)
 {
+    assert(model);
+    assert(nn_model_is_null(model));
     FILE *file = fopen(file_path, "rb");
     if (!file)
     {
-        perror("nn_model_load: can't open the file!");
-        exit(-2);
+        log_msg(LOG_ERR, "nn_model_load: can't open %s!", file_path);
+        return NULL;
     }
-    size_t size = 0;
-    fread(&size, sizeof(size), 1, file);
-    uint8_t *byte_arr = malloc(size);
-    assert(byte_arr);
-    size_t sz = fread(byte_arr, 1, size, file);
-    if (sz != size)
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+    nn_model_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        memcmp(hdr.magic, NN_MODEL_FILE_MAGIC, sizeof(NN_MODEL_FILE_MAGIC)) != 0)
     {
-        perror("nn_model_load: can't read (completely) from the file!");
-        fclose(file);
-        free(byte_arr);
-        exit(-3);
+        rewind(file);
+        return load_serialized(model, file, file_path, (file_size > 0) ? (size_t)file_size : 0);
+    }
+    const char *err = check_file_header(&hdr, (file_size > 0) ? (size_t)file_size : 0);
+    nn_model_file_layer *rec = NULL;
+    if (!err)
+    {
+        rec = (nn_model_file_layer *)calloc(hdr.nbr_layers + 1, sizeof(nn_model_file_layer));
+        assert(rec);
+        if (fread(rec, sizeof(*rec), hdr.nbr_layers, file) != (size_t)hdr.nbr_layers)
+            err = "truncated file";
+    }
+    if (!err)
+        err = check_file_layers(&hdr, rec);
+    payload param = payload_NULL;
+    if (!err && hdr.nbr_layers > 0)
+    {
+        // the parameters are read straight into the packed buffer
+        payload_construct(&param, hdr.param_size);
+        assert(payload_is_valid(&param));
+        fseek(file, hdr.param_off, SEEK_SET);
+        if (fread(payload_at(&param, 0), sizeof(FLT_TYP), hdr.param_size, file) != hdr.param_size)
+        {
+            err = "truncated file";
+            payload_release(&param);
+        }
     }
     fclose(file);
-    const uint8_t *ptr = nn_model_deserialize(model, byte_arr);
-    assert(size == ((size_t)(ptr - byte_arr)));
-    free(byte_arr);
+    if (err)
+    {
+        log_msg(LOG_ERR, "nn_model_load: %s: %s!", file_path, err);
+        free(rec);
+        return NULL;
+    }
+    model_from_file(model, &hdr, rec, param, true);
+    free(rec);
+    return model;
+}
+
+nn_model *nn_model_mmap(nn_model *model, const char *file_path)
+{
+    assert(model);
+    assert(nn_model_is_null(model));
+    nn_mapping map = nn_mapping_NULL;
+    if (!nn_mapping_open(&map, file_path))
+        return NULL;
+    nn_model_file_header hdr;
+    const nn_model_file_layer *rec = NULL;
+    const char *err = "not a model file";
+    if (map.size >= sizeof(hdr))
+    {
+        memcpy(&hdr, map.addr, sizeof(hdr));
+        err = check_file_header(&hdr, map.size);
+    }
+    if (!err && hdr.nbr_layers == 0)
+        err = "no layers";
+    if (!err)
+    {
+        // 8 byte aligned: the mapping is page aligned and the header 64 bytes
+        rec = (const nn_model_file_layer *)((const uint8_t *)map.addr + sizeof(hdr));
+        err = check_file_layers(&hdr, rec);
+    }
+    if (err)
+    {
+        log_msg(LOG_ERR, "nn_model_mmap: %s: %s!", file_path, err);
+        nn_mapping_close(&map);
+        return NULL;
+    }
+    payload param = payload_NULL;
+    param.arr = (FLT_TYP *)((uint8_t *)map.addr + hdr.param_off);
+    param.size = hdr.param_size;
+    param.ref_count = 1;
+    // the gradients stay unpacked: an inference-only model never touches them
+    model_from_file(model, &hdr, rec, param, false);
+    model->map = map;
+    return model;
+}
+
+size_t nn_model_file_size(const nn_model *model)
+{
+    assert(model);
+    IND_TYP *w_off = (IND_TYP *)calloc(2 * model->nbr_layers + 1, sizeof(IND_TYP));
+    assert(w_off);
+    IND_TYP size = nn_model_param_layout(model, w_off, w_off + model->nbr_layers);
+    free(w_off);
+    return file_param_off(model->nbr_layers) + size * sizeof(FLT_TYP);
+}
+
+uint8_t *nn_model_file_serialize(const nn_model *model, uint8_t *byte_arr)
+{
+    assert(model);
+    assert(byte_arr);
+    nn_model_file_header hdr;
+    nn_model_file_layer *rec = (nn_model_file_layer *)calloc(model->nbr_layers + 1, sizeof(nn_model_file_layer));
+    assert(rec);
+    file_layout(model, &hdr, rec);
+    // the padding is zero, as in the file
+    memset(byte_arr, 0, hdr.file_size);
+    memcpy(byte_arr, &hdr, sizeof(hdr));
+    memcpy(byte_arr + sizeof(hdr), rec, model->nbr_layers * sizeof(*rec));
+    FLT_TYP *param = (FLT_TYP *)(byte_arr + hdr.param_off);
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        assert(model->bias[l].step == 1);
+        memcpy(param + rec[l].w_off, mat_at(model->weight + l, 0, 0), rec[l].out_sz * rec[l].inp_sz * sizeof(FLT_TYP));
+        memcpy(param + rec[l].b_off, vec_at(model->bias + l, 0), rec[l].out_sz * sizeof(FLT_TYP));
+    }
+    uint8_t *end = byte_arr + hdr.file_size;
+    free(rec);
+    return end;
+}
+
+nn_model *nn_model_file_deserialize(nn_model *model, const uint8_t *byte_arr, size_t size)
+{
+    assert(model);
+    assert(nn_model_is_null(model));
+    assert(byte_arr);
+    nn_model_file_header hdr;
+    nn_model_file_layer *rec = NULL;
+    const char *err = "not a model file";
+    if (size >= sizeof(hdr))
+    {
+        memcpy(&hdr, byte_arr, sizeof(hdr));
+        err = check_file_header(&hdr, size);
+    }
+    if (!err && hdr.file_size != size)
+        err = "inconsistent size";
+    if (!err)
+    {
+        // the records fit: param_off follows them
+        rec = (nn_model_file_layer *)calloc(hdr.nbr_layers + 1, sizeof(nn_model_file_layer));
+        assert(rec);
+        memcpy(rec, byte_arr + sizeof(hdr), hdr.nbr_layers * sizeof(*rec));
+        err = check_file_layers(&hdr, rec);
+    }
+    if (err)
+    {
+        log_msg(LOG_ERR, "nn_model_file_deserialize: %s!", err);
+        free(rec);
+        return NULL;
+    }
+    payload param = payload_NULL;
+    if (hdr.nbr_layers > 0)
+    {
+        payload_construct(&param, hdr.param_size);
+        assert(payload_is_valid(&param));
+        memcpy(payload_at(&param, 0), byte_arr + hdr.param_off, hdr.param_size * sizeof(FLT_TYP));
+    }
+    model_from_file(model, &hdr, rec, param, true);
+    free(rec);
     return model;
 }
 
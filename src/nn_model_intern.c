@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "nn_dense.h"
+
 nn_model_intern *nn_model_intern_construct(nn_model_intern *intern, int layer_capacity, IND_TYP inp_size)
 {
     assert(intern);
@@ -13,28 +15,134 @@ nn_model_intern *nn_model_intern_construct(nn_model_intern *intern, int layer_ca
     assert(intern->d_w);
     intern->d_b = (vec *)calloc(layer_capacity, sizeof(vec));
     assert(intern->d_b);
-    intern->a_mask = (vec *)calloc(layer_capacity, sizeof(vec));
+    intern->a_mask = (uint64_t **)calloc(layer_capacity, sizeof(uint64_t *));
     assert(intern->a_mask);
     intern->s = (vec *)calloc(layer_capacity, sizeof(vec));
     assert(intern->s);
     intern->a = (vec *)calloc(layer_capacity, sizeof(vec));
     assert(intern->a);
+    intern->s_bt = (payload *)calloc(layer_capacity, sizeof(payload));
+    assert(intern->s_bt);
+    intern->a_bt = (payload *)calloc(layer_capacity, sizeof(payload));
+    assert(intern->a_bt);
+    intern->batch_cap = 0;
+    intern->a_inp_bt = payload_NULL;
+    intern->err_bt = payload_NULL;
+    intern->dlt_bt = payload_NULL;
+    intern->grad = payload_NULL;
+    intern->prof = NULL;
     intern->nbr_layers = 0;
     intern->a_inp = vec_NULL;
     vec_construct(&intern->a_inp, inp_size);
     return intern;
 }
 
+static void release_batch(nn_model_intern *intern)
+{
+    if (intern->batch_cap == 0)
+        return;
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        payload_release(intern->s_bt + l);
+        payload_release(intern->a_bt + l);
+    }
+    payload_release(&intern->a_inp_bt);
+    payload_release(&intern->err_bt);
+    payload_release(&intern->dlt_bt);
+    intern->batch_cap = 0;
+}
+
+void nn_model_mat_pack(mat *m, payload *pyl, IND_TYP off)
+{
+    assert(m && pyl);
+    assert(off + m->d1 * m->d2 <= (IND_TYP)pyl->size);
+    memcpy(payload_at(pyl, off), mat_at(m, 0, 0), m->d1 * m->d2 * sizeof(FLT_TYP));
+    mat_construct_prealloc(m, pyl, off, m->d1, m->d2);
+}
+
+void nn_model_vec_pack(vec *v, payload *pyl, IND_TYP off)
+{
+    assert(v && pyl);
+    assert(v->step == 1);
+    assert(off + v->d <= (IND_TYP)pyl->size);
+    memcpy(payload_at(pyl, off), vec_at(v, 0), v->d * sizeof(FLT_TYP));
+    vec_construct_prealloc(v, pyl, off, v->d, 1);
+}
+
+void nn_model_mat_unpack(mat *m)
+{
+    assert(m);
+    mat own = mat_NULL;
+    mat_construct(&own, m->d1, m->d2);
+    memcpy(mat_at(&own, 0, 0), mat_at(m, 0, 0), m->d1 * m->d2 * sizeof(FLT_TYP));
+    mat_destruct(m);
+    *m = own;
+}
+
+void nn_model_vec_unpack(vec *v)
+{
+    assert(v);
+    assert(v->step == 1);
+    vec own = vec_NULL;
+    vec_construct(&own, v->d);
+    memcpy(vec_at(&own, 0), vec_at(v, 0), v->d * sizeof(FLT_TYP));
+    vec_destruct(v);
+    *v = own;
+}
+
+bool nn_model_intern_is_packed(const nn_model_intern *intern)
+{
+    assert(intern);
+    return payload_is_valid(&intern->grad);
+}
+
+static void unpack_grad(nn_model_intern *intern)
+{
+    if (!nn_model_intern_is_packed(intern))
+        return;
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        nn_model_mat_unpack(intern->d_w + l);
+        nn_model_vec_unpack(intern->d_b + l);
+    }
+    payload_release(&intern->grad);
+    intern->grad = payload_NULL;
+}
+
+nn_model_intern *nn_model_intern_pack(nn_model_intern *intern, IND_TYP grad_size,
+                                      const IND_TYP *w_off, const IND_TYP *b_off)
+{
+    assert(intern);
+    assert(grad_size > 0);
+    assert(w_off && b_off);
+    unpack_grad(intern);
+    payload_construct(&intern->grad, grad_size);
+    assert(payload_is_valid(&intern->grad));
+    memset(payload_at(&intern->grad, 0), 0, grad_size * sizeof(FLT_TYP));
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        nn_model_mat_pack(intern->d_w + l, &intern->grad, w_off[l]);
+        nn_model_vec_pack(intern->d_b + l, &intern->grad, b_off[l]);
+    }
+    return intern;
+}
+
 void nn_model_intern_destruct(nn_model_intern *intern)
 {
+    release_batch(intern);
     for (int l = 0; l < intern->nbr_layers; l++)
     {
         mat_destruct(intern->d_w + l);
         vec_destruct(intern->d_b + l);
-        vec_destruct(intern->a_mask + l);
+        free(intern->a_mask[l]);
         vec_destruct(intern->s + l);
         vec_destruct(intern->a + l);
     }
+    // after the views
+    if (nn_model_intern_is_packed(intern))
+        payload_release(&intern->grad);
+    free(intern->s_bt);
+    free(intern->a_bt);
     free(intern->d_w);
     free(intern->d_b);
     free(intern->a_mask);
@@ -48,9 +156,12 @@ nn_model_intern *nn_model_intern_add(nn_model_intern *intern, const nn_layer *la
 {
     assert(intern);
     assert(layer);
+    release_batch(intern);
+    unpack_grad(intern);
     mat_construct(intern->d_w + intern->nbr_layers, layer->out_sz, inp_size);
     vec_construct(intern->d_b + intern->nbr_layers, layer->out_sz);
-    vec_construct(intern->a_mask + intern->nbr_layers, inp_size);
+    intern->a_mask[intern->nbr_layers] = (uint64_t *)calloc(NN_DENSE_MASK_WORDS(inp_size), sizeof(uint64_t));
+    assert(intern->a_mask[intern->nbr_layers]);
     vec_construct(intern->s + intern->nbr_layers, layer->out_sz);
     vec_construct(intern->a + intern->nbr_layers, layer->out_sz);
     intern->nbr_layers++;
@@ -61,17 +172,60 @@ nn_model_intern *nn_model_intern_remove(nn_model_intern *intern, int layer_index
 {
     assert(intern);
     assert(layer_index >= 0 && layer_index < intern->nbr_layers);
+    release_batch(intern);
+    unpack_grad(intern);
     mat_destruct(intern->d_w + layer_index);
     vec_destruct(intern->d_b + layer_index);
-    vec_destruct(intern->a_mask + layer_index);
+    free(intern->a_mask[layer_index]);
     vec_destruct(intern->s + layer_index);
     vec_destruct(intern->a + layer_index);
+    intern->nbr_layers--;
     int nsz_mv = intern->nbr_layers - layer_index;
     memmove(intern->d_w + layer_index, intern->d_w + layer_index + 1, nsz_mv * sizeof(mat));
     memmove(intern->d_b + layer_index, intern->d_b + layer_index + 1, nsz_mv * sizeof(vec));
-    memmove(intern->a_mask + layer_index, intern->a_mask + layer_index + 1, nsz_mv * sizeof(vec));
+    memmove(intern->a_mask + layer_index, intern->a_mask + layer_index + 1, nsz_mv * sizeof(uint64_t *));
     memmove(intern->s + layer_index, intern->s + layer_index + 1, nsz_mv * sizeof(vec));
     memmove(intern->a + layer_index, intern->a + layer_index + 1, nsz_mv * sizeof(vec));
+    memmove(intern->s_bt + layer_index, intern->s_bt + layer_index + 1, nsz_mv * sizeof(payload));
+    memmove(intern->a_bt + layer_index, intern->a_bt + layer_index + 1, nsz_mv * sizeof(payload));
+    return intern;
+}
+
+nn_model_intern *nn_model_intern_reserve_batch(nn_model_intern *intern, IND_TYP batch_size)
+{
+    assert(intern);
+    assert(batch_size > 0);
+    if (batch_size <= intern->batch_cap)
+        return intern;
+    release_batch(intern);
+    IND_TYP max_width = intern->a_inp.d;
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        IND_TYP out_sz = intern->s[l].d;
+        IND_TYP inp_sz = (l != 0) ? intern->s[l - 1].d : intern->a_inp.d;
+        if (out_sz > max_width)
+            max_width = out_sz;
+        uint64_t *mask = (uint64_t *)realloc(intern->a_mask[l],
+                                             batch_size * NN_DENSE_MASK_WORDS(inp_sz) * sizeof(uint64_t));
+        assert(mask);
+        intern->a_mask[l] = mask;
+        intern->s_bt[l] = payload_NULL;
+        payload_construct(intern->s_bt + l, batch_size * out_sz);
+        assert(payload_is_valid(intern->s_bt + l));
+        intern->a_bt[l] = payload_NULL;
+        payload_construct(intern->a_bt + l, batch_size * out_sz);
+        assert(payload_is_valid(intern->a_bt + l));
+    }
+    intern->a_inp_bt = payload_NULL;
+    payload_construct(&intern->a_inp_bt, batch_size * intern->a_inp.d);
+    assert(payload_is_valid(&intern->a_inp_bt));
+    intern->err_bt = payload_NULL;
+    payload_construct(&intern->err_bt, batch_size * max_width);
+    assert(payload_is_valid(&intern->err_bt));
+    intern->dlt_bt = payload_NULL;
+    payload_construct(&intern->dlt_bt, batch_size * max_width);
+    assert(payload_is_valid(&intern->dlt_bt));
+    intern->batch_cap = batch_size;
     return intern;
 }
 
@@ -106,9 +260,35 @@ static inline IND_TYP *shuffle_choose_n(IND_TYP *ind, IND_TYP size, IND_TYP n, u
 void nn_model_reset_gradients(nn_model_intern *intern)
 {
     assert(intern);
+    if (nn_model_intern_is_packed(intern))
+    {
+        memset(payload_at(&intern->grad, 0), 0, intern->grad.size * sizeof(FLT_TYP));
+        return;
+    }
     for (int l = 0; l < intern->nbr_layers; l++)
     {
         mat_fill_zero(intern->d_w + l);
         vec_fill_zero(intern->d_b + l);
     }
 }
+
+void nn_model_add_gradients(nn_model_intern *intern, const nn_model_intern *src)
+{
+    assert(intern);
+    assert(src);
+    assert(intern->nbr_layers == src->nbr_layers);
+    if (nn_model_intern_is_packed(intern) && nn_model_intern_is_packed(src) &&
+        intern->grad.size == src->grad.size)
+    {
+        FLT_TYP *restrict g = payload_at(&intern->grad, 0);
+        const FLT_TYP *restrict g_src = src->grad.arr;
+        for (size_t i = 0; i < intern->grad.size; i++)
+            g[i] += g_src[i];
+        return;
+    }
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        mat_update(intern->d_w + l, 1, src->d_w + l);
+        vec_update(intern->d_b + l, 1, src->d_b + l);
+    }
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "nn_model.h"
+#include "log.h"
 
 nn_optim *nn_optim_construct(nn_optim *optimizer, const nn_optim_class *optim_class, const nn_model *model)
 {
@@ -38,3 +39,33 @@ nn_model *nn_optim_update_model(nn_optim *optimizer, nn_model *model)
     assert(model);
     return optimizer->class.update_model(optimizer, model);
 }
+
+size_t nn_optim_serial_size(const nn_optim *optimizer)
+{
+    assert(optimizer);
+    if (optimizer->class.serial_size)
+        return optimizer->class.serial_size(optimizer);
+    return 0;
+}
+
+uint8_t *nn_optim_serialize(const nn_optim *optimizer, uint8_t *byte_arr)
+{
+    assert(optimizer);
+    if (optimizer->class.serialize)
+        return optimizer->class.serialize(optimizer, byte_arr);
+    return byte_arr;
+}
+
+const uint8_t *nn_optim_deserialize(nn_optim *optimizer, const uint8_t *byte_arr, size_t size)
+{
+    assert(optimizer);
+    assert(byte_arr || size == 0);
+    const uint8_t *end = NULL;
+    if (optimizer->class.deserialize)
+        end = optimizer->class.deserialize(optimizer, byte_arr, size);
+    else if (size == 0)
+        end = byte_arr;
+    if (!end)
+        log_msg(LOG_ERR, "nn_optim_deserialize: the state does not fit the optimizer!");
+    return end;
+}
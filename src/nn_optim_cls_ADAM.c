@@ -7,6 +7,12 @@
 
 #include "nn_model.h"
 
+#ifdef FLD_FLT64
+#define SQRT sqrt
+#else
+#define SQRT sqrtf
+#endif
+
 typedef struct nn_optim_cls_ADAM_intern
 {
     int nbr_layers;
@@ -14,7 +20,9 @@ typedef struct nn_optim_cls_ADAM_intern
     vec *m_b;
     mat *v_w;
     vec *v_b;
-    payload pyl_0, pyl_1;
+    // moments in the packed layout of the model, if it was packed at construction;
+    // m_w, m_b (v_w, v_b) are views into them
+    payload m, v;
     size_t t;
     FLT_TYP beta1t, beta2t;
 } nn_optim_cls_ADAM_intern;
@@ -35,14 +43,10 @@ static nn_optim_cls_ADAM_intern *intern_construct(nn_optim_cls_ADAM_intern *inte
     intern->v_b = (vec *)calloc(intern->nbr_layers, sizeof(vec));
     assert(intern->v_b);
 
-    IND_TYP max_sz = 0;
-
     for (int l = 0; l < intern->nbr_layers; l++)
     {
         IND_TYP inp_sz = (l > 0) ? model->layer[l - 1].out_sz : model->input_size;
         IND_TYP out_sz = model->layer[l].out_sz;
-        if (out_sz * inp_sz > max_sz)
-            max_sz = out_sz * inp_sz;
         mat_construct(intern->m_w + l, out_sz, inp_sz);
         mat_fill_zero(intern->m_w + l);
         mat_construct(intern->v_w + l, out_sz, inp_sz);
@@ -52,10 +56,29 @@ static nn_optim_cls_ADAM_intern *intern_construct(nn_optim_cls_ADAM_intern *inte
         vec_construct(intern->v_b + l, out_sz);
         vec_fill_zero(intern->v_b + l);
     }
-    payload_construct(&intern->pyl_0, max_sz);
-    assert(payload_is_valid(&intern->pyl_0));
-    payload_construct(&intern->pyl_1, max_sz);
-    assert(payload_is_valid(&intern->pyl_1));
+    intern->m = payload_NULL;
+    intern->v = payload_NULL;
+    if (nn_model_is_packed(model))
+    {
+        IND_TYP *w_off = (IND_TYP *)calloc(2 * intern->nbr_layers, sizeof(IND_TYP));
+        assert(w_off);
+        IND_TYP *b_off = w_off + intern->nbr_layers;
+        IND_TYP size = nn_model_param_layout(model, w_off, b_off);
+        payload_construct(&intern->m, size);
+        assert(payload_is_valid(&intern->m));
+        memset(payload_at(&intern->m, 0), 0, size * sizeof(FLT_TYP));
+        payload_construct(&intern->v, size);
+        assert(payload_is_valid(&intern->v));
+        memset(payload_at(&intern->v, 0), 0, size * sizeof(FLT_TYP));
+        for (int l = 0; l < intern->nbr_layers; l++)
+        {
+            nn_model_mat_pack(intern->m_w + l, &intern->m, w_off[l]);
+            nn_model_vec_pack(intern->m_b + l, &intern->m, b_off[l]);
+            nn_model_mat_pack(intern->v_w + l, &intern->v, w_off[l]);
+            nn_model_vec_pack(intern->v_b + l, &intern->v, b_off[l]);
+        }
+        free(w_off);
+    }
     nn_optim_cls_ADAM_params *params = (nn_optim_cls_ADAM_params *)optimizer->params;
     intern->t = params->t0;
     intern->beta1t = (FLT_TYP)pow(params->beta1, intern->t);
@@ -73,12 +96,15 @@ static void intern_destruct(nn_optim_cls_ADAM_intern *intern)
         vec_destruct(intern->m_b + l);
         vec_destruct(intern->v_b + l);
     }
+    if (payload_is_valid(&intern->m))
+    {
+        payload_release(&intern->m);
+        payload_release(&intern->v);
+    }
     free(intern->m_w);
     free(intern->m_b);
     free(intern->v_w);
     free(intern->v_b);
-    payload_release(&intern->pyl_0);
-    payload_release(&intern->pyl_1);
     memset(intern, 0, sizeof(nn_optim_cls_ADAM_intern));
 }
 
@@ -138,6 +164,23 @@ static nn_optim *nn_optim_cls_ADAM_set_params(nn_optim *optimizer, const void *i
     return optimizer;
 }
 
+// one pass over n parameters: m and v are updated and the step applied to w
+// while the gradient g is in registers
+static void adam_step(FLT_TYP *restrict w, FLT_TYP *restrict m, FLT_TYP *restrict v,
+                      const FLT_TYP *restrict g, IND_TYP n,
+                      FLT_TYP c1, FLT_TYP d1, FLT_TYP c2, FLT_TYP d2, FLT_TYP alpha, FLT_TYP eps)
+{
+    for (IND_TYP i = 0; i < n; i++)
+    {
+        FLT_TYP g_i = g[i];
+        FLT_TYP m_i = c1 * m[i] + d1 * g_i;
+        FLT_TYP v_i = c2 * v[i] + d2 * g_i * g_i;
+        m[i] = m_i;
+        v[i] = v_i;
+        w[i] -= alpha * m_i / (SQRT(v_i) + eps);
+    }
+}
+
 static nn_model *nn_optim_cls_ADAM_update_model(nn_optim *optimizer, nn_model *model)
 {
     assert(optimizer);
@@ -153,50 +196,135 @@ static nn_model *nn_optim_cls_ADAM_update_model(nn_optim *optimizer, nn_model *m
     FLT_TYP d1 = (1 - params->beta1) / (1 - intern->beta1t);
     FLT_TYP c2 = params->beta2 * omb2 / (1 - intern->beta2t);
     FLT_TYP d2 = (1 - params->beta2) / (1 - intern->beta2t);
-    mat tmp_w = mat_NULL;
-    mat tmp_dw = mat_NULL;
-    vec tmp_b = vec_NULL;
-    vec tmp_db = vec_NULL;
-    mat_construct_prealloc(&tmp_w, &intern->pyl_0, 0, 1, 1);
-    vec_construct_prealloc(&tmp_b, &intern->pyl_1, 0, 1, 1);
-    mat_construct_prealloc(&tmp_dw, &intern->pyl_1, 0, 1, 1);
-    vec_construct_prealloc(&tmp_db, &intern->pyl_0, 0, 1, 1);
+    if (payload_is_valid(&intern->m) && nn_model_is_packed(model) &&
+        nn_model_intern_is_packed(&model->intern) &&
+        intern->m.size == model->param.size && model->param.size == model->intern.grad.size)
+    {
+        // the whole model in one sweep
+        adam_step(payload_at(&model->param, 0), payload_at(&intern->m, 0), payload_at(&intern->v, 0),
+                  model->intern.grad.arr, model->param.size,
+                  c1, d1, c2, d2, params->alpha, params->eps);
+        return model;
+    }
     for (int l = 0; l < model->nbr_layers; l++)
     {
-        mat_scale(intern->m_w + l, c1);
-        mat_update(intern->m_w + l, d1, model->intern.d_w + l);
-        vec_scale(intern->m_b + l, c1);
-        vec_update(intern->m_b + l, d1, model->intern.d_b + l);
-
-        mat_reform(&tmp_w, 0, model->intern.d_w[l].d1, model->intern.d_w[l].d2);
-        mat_square(&tmp_w, model->intern.d_w + l);
-        mat_scale(intern->v_w + l, c2);
-        mat_update(intern->v_w + l, d2, &tmp_w);
-        vec_reform(&tmp_b, 0, model->intern.d_b[l].d, 1);
-        vec_square(&tmp_b, model->intern.d_b + l);
-        vec_scale(intern->v_b + l, c2);
-        vec_update(intern->v_b + l, d2, &tmp_b);
-
-        mat_sqrt(&tmp_w, intern->v_w + l);
-        mat_f_addto(&tmp_w, params->eps);
-        mat_reform(&tmp_dw, 0, model->intern.d_w[l].d1, model->intern.d_w[l].d2);
-        mat_div(&tmp_dw, intern->m_w + l, &tmp_w);
-        mat_update(model->weight + l, -params->alpha, &tmp_dw);
-
-        vec_sqrt(&tmp_b, intern->v_b + l);
-        vec_f_addto(&tmp_b, params->eps);
-        vec_reform(&tmp_db, 0, model->intern.d_b[l].d, 1);
-        vec_div(&tmp_db, intern->m_b + l, &tmp_b);
-        vec_update(model->bias + l, -params->alpha, &tmp_db);
+        const mat *d_w = model->intern.d_w + l;
+        const vec *d_b = model->intern.d_b + l;
+        adam_step(mat_at(model->weight + l, 0, 0), mat_at(intern->m_w + l, 0, 0),
+                  mat_at(intern->v_w + l, 0, 0), mat_at(d_w, 0, 0), d_w->d1 * d_w->d2,
+                  c1, d1, c2, d2, params->alpha, params->eps);
+        adam_step(vec_at(model->bias + l, 0), vec_at(intern->m_b + l, 0),
+                  vec_at(intern->v_b + l, 0), vec_at(d_b, 0), d_b->d,
+                  c1, d1, c2, d2, params->alpha, params->eps);
     }
-    vec_destruct(&tmp_b);
-    vec_destruct(&tmp_db);
-    mat_destruct(&tmp_w);
-    mat_destruct(&tmp_dw);
     return model;
 }
 
+// a tag, the params, the step count and powers of the betas, then per layer its sizes
+// and the moments m_w, v_w, m_b, v_b
+static const char adam_tag[4] = {'A', 'D', 'A', 'M'};
+
+typedef struct adam_serial_head
+{
+    nn_optim_cls_ADAM_params params;
+    uint64_t t;
+    FLT_TYP beta1t, beta2t;
+    int32_t nbr_layers;
+} adam_serial_head;
+
+static size_t nn_optim_cls_ADAM_serial_size(const nn_optim *optimizer)
+{
+    assert(optimizer);
+    const nn_optim_cls_ADAM_intern *intern = (const nn_optim_cls_ADAM_intern *)optimizer->intern;
+    size_t size = sizeof(adam_tag) + sizeof(adam_serial_head);
+    for (int l = 0; l < intern->nbr_layers; l++)
+        size += 2 * sizeof(uint64_t) +
+                2 * (intern->m_w[l].d1 * intern->m_w[l].d2 + intern->m_b[l].d) * sizeof(FLT_TYP);
+    return size;
+}
+
+static uint8_t *nn_optim_cls_ADAM_serialize(const nn_optim *optimizer, uint8_t *byte_arr)
+{
+    assert(optimizer);
+    assert(byte_arr);
+    const nn_optim_cls_ADAM_intern *intern = (const nn_optim_cls_ADAM_intern *)optimizer->intern;
+    adam_serial_head head;
+    memset(&head, 0, sizeof(head));
+    head.params = *(const nn_optim_cls_ADAM_params *)optimizer->params;
+    head.t = intern->t;
+    head.beta1t = intern->beta1t;
+    head.beta2t = intern->beta2t;
+    head.nbr_layers = intern->nbr_layers;
+    memcpy(byte_arr, adam_tag, sizeof(adam_tag));
+    byte_arr += sizeof(adam_tag);
+    memcpy(byte_arr, &head, sizeof(head));
+    byte_arr += sizeof(head);
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        uint64_t sz[2] = {intern->m_w[l].d1, intern->m_w[l].d2};
+        memcpy(byte_arr, sz, sizeof(sz));
+        byte_arr += sizeof(sz);
+        size_t w_bytes = sz[0] * sz[1] * sizeof(FLT_TYP), b_bytes = sz[0] * sizeof(FLT_TYP);
+        memcpy(byte_arr, mat_at(intern->m_w + l, 0, 0), w_bytes);
+        byte_arr += w_bytes;
+        memcpy(byte_arr, mat_at(intern->v_w + l, 0, 0), w_bytes);
+        byte_arr += w_bytes;
+        memcpy(byte_arr, vec_at(intern->m_b + l, 0), b_bytes);
+        byte_arr += b_bytes;
+        memcpy(byte_arr, vec_at(intern->v_b + l, 0), b_bytes);
+        byte_arr += b_bytes;
+    }
+    return byte_arr;
+}
+
+static const uint8_t *nn_optim_cls_ADAM_deserialize(nn_optim *optimizer, const uint8_t *byte_arr, size_t size)
+{
+    assert(optimizer);
+    nn_optim_cls_ADAM_intern *intern = (nn_optim_cls_ADAM_intern *)optimizer->intern;
+    // the layer sizes must be those of the constructed moments, so the sizes match
+    if (size != nn_optim_cls_ADAM_serial_size(optimizer) || memcmp(byte_arr, adam_tag, sizeof(adam_tag)) != 0)
+        return NULL;
+    const uint8_t *ptr = byte_arr + sizeof(adam_tag);
+    adam_serial_head head;
+    memcpy(&head, ptr, sizeof(head));
+    ptr += sizeof(head);
+    if (head.nbr_layers != intern->nbr_layers)
+        return NULL;
+    const uint8_t *lay = ptr;
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        uint64_t sz[2];
+        memcpy(sz, lay, sizeof(sz));
+        if (sz[0] != (uint64_t)intern->m_w[l].d1 || sz[1] != (uint64_t)intern->m_w[l].d2)
+            return NULL;
+        lay += sizeof(sz) + 2 * (sz[0] * sz[1] + sz[0]) * sizeof(FLT_TYP);
+    }
+
+    *(nn_optim_cls_ADAM_params *)optimizer->params = head.params;
+    intern->t = head.t;
+    intern->beta1t = head.beta1t;
+    intern->beta2t = head.beta2t;
+    for (int l = 0; l < intern->nbr_layers; l++)
+    {
+        ptr += 2 * sizeof(uint64_t);
+        size_t w_bytes = intern->m_w[l].d1 * intern->m_w[l].d2 * sizeof(FLT_TYP);
+        size_t b_bytes = intern->m_b[l].d * sizeof(FLT_TYP);
+        memcpy(mat_at(intern->m_w + l, 0, 0), ptr, w_bytes);
+        ptr += w_bytes;
+        memcpy(mat_at(intern->v_w + l, 0, 0), ptr, w_bytes);
+        ptr += w_bytes;
+        memcpy(vec_at(intern->m_b + l, 0), ptr, b_bytes);
+        ptr += b_bytes;
+        memcpy(vec_at(intern->v_b + l, 0), ptr, b_bytes);
+        ptr += b_bytes;
+    }
+    return ptr;
+}
+
 const nn_optim_class nn_optim_cls_ADAM = {.construct = nn_optim_cls_ADAM_construct,
                                           .destruct = nn_optim_cls_ADAM_destruct,
                                           .set_params = nn_optim_cls_ADAM_set_params,
-                                          .update_model = nn_optim_cls_ADAM_update_model};
+                                          .update_model = nn_optim_cls_ADAM_update_model,
+                                          .serial_size = nn_optim_cls_ADAM_serial_size,
+                                          .serialize = nn_optim_cls_ADAM_serialize,
+                                          .deserialize = nn_optim_cls_ADAM_deserialize};
@@ -1,6 +1,7 @@
 #include "nn_optim_cls_SGD.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "nn_model.h"
@@ -41,6 +42,16 @@ static nn_model *nn_optim_cls_SGD_update_model(nn_optim *optimizer, nn_model *mo
     assert(model);
     nn_optim_cls_SGD_params *params = (nn_optim_cls_SGD_params *)optimizer->params;
     FLT_TYP alpha = -params->learning_rate;
+    if (nn_model_is_packed(model) && nn_model_intern_is_packed(&model->intern) &&
+        model->param.size == model->intern.grad.size)
+    {
+        // one sweep over all parameters; the zero padding stays zero
+        FLT_TYP *restrict w = payload_at(&model->param, 0);
+        const FLT_TYP *restrict g = model->intern.grad.arr;
+        for (size_t i = 0; i < model->param.size; i++)
+            w[i] += alpha * g[i];
+        return model;
+    }
     for (int l = 0; l < model->nbr_layers; l++)
     {
         mat_update(model->weight + l, alpha, model->intern.d_w + l);
@@ -49,7 +60,37 @@ static nn_model *nn_optim_cls_SGD_update_model(nn_optim *optimizer, nn_model *mo
     return model;
 }
 
+// a tag and the params; SGD has no state
+static const char sgd_tag[4] = {'S', 'G', 'D', 0};
+
+static size_t nn_optim_cls_SGD_serial_size(const nn_optim *optimizer)
+{
+    (void)optimizer;
+    return sizeof(sgd_tag) + sizeof(nn_optim_cls_SGD_params);
+}
+
+static uint8_t *nn_optim_cls_SGD_serialize(const nn_optim *optimizer, uint8_t *byte_arr)
+{
+    assert(optimizer);
+    assert(byte_arr);
+    memcpy(byte_arr, sgd_tag, sizeof(sgd_tag));
+    memcpy(byte_arr + sizeof(sgd_tag), optimizer->params, sizeof(nn_optim_cls_SGD_params));
+    return byte_arr + nn_optim_cls_SGD_serial_size(optimizer);
+}
+
+static const uint8_t *nn_optim_cls_SGD_deserialize(nn_optim *optimizer, const uint8_t *byte_arr, size_t size)
+{
+    assert(optimizer);
+    if (size != nn_optim_cls_SGD_serial_size(optimizer) || memcmp(byte_arr, sgd_tag, sizeof(sgd_tag)) != 0)
+        return NULL;
+    memcpy(optimizer->params, byte_arr + sizeof(sgd_tag), sizeof(nn_optim_cls_SGD_params));
+    return byte_arr + size;
+}
+
 const nn_optim_class nn_optim_cls_SGD = {.construct = nn_optim_cls_SGD_construct,
                                          .destruct = nn_optim_cls_SGD_destruct,
                                          .set_params = nn_optim_cls_SGD_set_params,
-                                         .update_model = nn_optim_cls_SGD_update_model};
+                                         .update_model = nn_optim_cls_SGD_update_model,
+                                         .serial_size = nn_optim_cls_SGD_serial_size,
+                                         .serialize = nn_optim_cls_SGD_serialize,
+                                         .deserialize = nn_optim_cls_SGD_deserialize};
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "nn_par.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "log.h"
+
+int nn_par_nbr_cores(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0 && n <= INT_MAX) ? (int)n : 1;
+}
+
+int nn_par_nbr_threads(int nbr_threads, IND_TYP nbr_tasks)
+{
+    if (nbr_threads <= 0)
+        nbr_threads = nn_par_nbr_cores();
+    if ((IND_TYP)nbr_threads > nbr_tasks)
+        nbr_threads = (nbr_tasks > 0) ? (int)nbr_tasks : 1;
+    return nbr_threads;
+}
+
+// The threads wait at the gate until all are created: they run their task only if all were
+// (state > 0), none does if one could not be (state < 0).
+typedef struct par_gate
+{
+    mtx_t mtx;
+    cnd_t cnd;
+    int state;
+} par_gate;
+
+typedef struct par_task
+{
+    par_gate *gate;
+    nn_par_func func;
+    void *arg;
+} par_task;
+
+static int gated_task(void *arg)
+{
+    par_task *task = (par_task *)arg;
+    par_gate *gate = task->gate;
+    mtx_lock(&gate->mtx);
+    while (gate->state == 0)
+        cnd_wait(&gate->cnd, &gate->mtx);
+    int state = gate->state;
+    mtx_unlock(&gate->mtx);
+    return (state > 0) ? task->func(task->arg) : 0;
+}
+
+static void open_gate(par_gate *gate, int state)
+{
+    mtx_lock(&gate->mtx);
+    gate->state = state;
+    cnd_broadcast(&gate->cnd);
+    mtx_unlock(&gate->mtx);
+}
+
+int nn_par_run(int nbr_threads, nn_par_func func, void *args, size_t arg_size)
+{
+    assert(func);
+    assert(nbr_threads > 0);
+
+    char *arg = (char *)args;
+    if (nbr_threads == 1)
+        return func(arg) != 0;
+
+    par_gate gate = {.state = 0};
+    if (mtx_init(&gate.mtx, mtx_plain) != thrd_success)
+    {
+        log_msg(LOG_WRN, "nn_par_run: cannot initialize the start gate.");
+        return -1;
+    }
+    if (cnd_init(&gate.cnd) != thrd_success)
+    {
+        log_msg(LOG_WRN, "nn_par_run: cannot initialize the start gate.");
+        mtx_destroy(&gate.mtx);
+        return -1;
+    }
+    thrd_t *thrd = (thrd_t *)calloc(nbr_threads, sizeof(thrd_t));
+    assert(thrd);
+    par_task *task = (par_task *)calloc(nbr_threads, sizeof(par_task));
+    assert(task);
+    int nbr_started = 1;
+    for (int t = 1; t < nbr_threads; t++, nbr_started++)
+    {
+        task[t] = (par_task){.gate = &gate, .func = func, .arg = arg + t * arg_size};
+        if (thrd_create(thrd + t, gated_task, task + t) != thrd_success)
+        {
+            log_msg(LOG_WRN, "nn_par_run: cannot create thread %d of %d; nothing run.", t, nbr_threads);
+            break;
+        }
+    }
+    int nbr_fails = 0;
+    open_gate(&gate, (nbr_started == nbr_threads) ? 1 : -1);
+    if (nbr_started == nbr_threads)
+        nbr_fails += func(arg) != 0;
+    for (int t = 1; t < nbr_started; t++)
+    {
+        int res = 0;
+        thrd_join(thrd[t], &res);
+        nbr_fails += res != 0;
+    }
+    free(task);
+    free(thrd);
+    cnd_destroy(&gate.cnd);
+    mtx_destroy(&gate.mtx);
+    return (nbr_started == nbr_threads) ? nbr_fails : -1;
+}
+
+int nn_par_run_tasks(int nbr_threads, nn_par_func func, void *args, size_t arg_size)
+{
+    int nbr_fails = nn_par_run(nbr_threads, func, args, arg_size);
+    if (nbr_fails >= 0)
+        return nbr_fails;
+    log_msg(LOG_WRN, "nn_par_run_tasks: running the %d tasks on the calling thread.", nbr_threads);
+    nbr_fails = 0;
+    for (int t = 0; t < nbr_threads; t++)
+        nbr_fails += func((char *)args + t * arg_size) != 0;
+    return nbr_fails;
+}
+
+int nn_par_barrier_init(nn_par_barrier *barrier, int nbr_threads)
+{
+    assert(barrier);
+    assert(nbr_threads > 0);
+    barrier->nbr_threads = nbr_threads;
+    barrier->count = 0;
+    barrier->generation = 0;
+    if (mtx_init(&barrier->mtx, mtx_plain) != thrd_success)
+        return -1;
+    if (cnd_init(&barrier->cnd) != thrd_success)
+    {
+        mtx_destroy(&barrier->mtx);
+        return -1;
+    }
+    return 0;
+}
+
+void nn_par_barrier_destroy(nn_par_barrier *barrier)
+{
+    assert(barrier);
+    cnd_destroy(&barrier->cnd);
+    mtx_destroy(&barrier->mtx);
+}
+
+void nn_par_barrier_wait(nn_par_barrier *barrier)
+{
+    assert(barrier);
+    if (barrier->nbr_threads == 1)
+        return;
+    mtx_lock(&barrier->mtx);
+    unsigned long gen = barrier->generation;
+    if (++barrier->count == barrier->nbr_threads)
+    {
+        barrier->count = 0;
+        barrier->generation++;
+        cnd_broadcast(&barrier->cnd);
+    }
+    else
+    {
+        while (gen == barrier->generation)
+            cnd_wait(&barrier->cnd, &barrier->mtx);
+    }
+    mtx_unlock(&barrier->mtx);
+}
@@ -0,0 +1,159 @@
+#include "nn_prefetch.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "rnd.h"
+#include "log.h"
+
+enum
+{
+    SLOT_FREE,
+    SLOT_FILLED,
+    SLOT_IN_USE
+};
+
+static void fill_slot(nn_prefetch *pf, int slot, IND_TYP i, IND_TYP nbr_rows)
+{
+    IND_TYP x_len = pf->x_sly.len;
+    IND_TYP trg_len = pf->trg_sly.len;
+    for (IND_TYP r = 0; r < nbr_rows; r++)
+    {
+        IND_TYP k = slice_index(&pf->index_sly, pf->ind[i + r]);
+        data_points_copy_at(pf->data_x, pf->x[slot] + r * x_len, k, &pf->x_sly);
+        data_points_copy_at(pf->data_trg, pf->trg[slot] + r * trg_len, k, &pf->trg_sly);
+        if (pf->data_weight)
+            pf->weight[slot][r] = *vec_at(pf->data_weight, k);
+    }
+    pf->batch[slot] = (nn_prefetch_batch){.nbr_rows = nbr_rows, .x = pf->x[slot], .trg = pf->trg[slot],
+                                          .weight = (pf->data_weight) ? pf->weight[slot] : NULL};
+}
+
+static int producer(void *arg)
+{
+    nn_prefetch *pf = (nn_prefetch *)arg;
+    IND_TYP nbr_data = pf->index_sly.len;
+    long seq = 0;
+    for (int epoch = pf->first_epoch; epoch < pf->nbr_epochs; epoch++)
+    {
+        // the consumer never reads ind
+        if (pf->shuffle)
+            rnd_shuffle_epoch(pf->ind, nbr_data, pf->seed, epoch);
+        for (IND_TYP i = 0; i < nbr_data; i += pf->batch_size, seq++)
+        {
+            int slot = seq & 1;
+            mtx_lock(&pf->mtx);
+            while (pf->state[slot] != SLOT_FREE && !pf->stop)
+                cnd_wait(&pf->cnd, &pf->mtx);
+            bool stop = pf->stop;
+            mtx_unlock(&pf->mtx);
+            if (stop)
+                return 0;
+
+            fill_slot(pf, slot, i, (i + pf->batch_size <= nbr_data) ? pf->batch_size : nbr_data - i);
+
+            mtx_lock(&pf->mtx);
+            pf->state[slot] = SLOT_FILLED;
+            cnd_broadcast(&pf->cnd);
+            mtx_unlock(&pf->mtx);
+        }
+    }
+    return 0;
+}
+
+nn_prefetch *nn_prefetch_start(nn_prefetch *pf,
+                               const data_points *data_x, slice x_sly,
+                               const data_points *data_trg, slice trg_sly,
+                               const vec *data_weight,
+                               slice index_sly,
+                               IND_TYP batch_size,
+                               int first_epoch,
+                               int nbr_epochs,
+                               bool shuffle,
+                               uint64_t seed)
+{
+    assert(pf);
+    assert(data_points_is_valid(data_x));
+    assert(data_points_is_valid(data_trg));
+    assert(slice_is_regulated(&x_sly) && slice_is_regulated(&trg_sly) && slice_is_regulated(&index_sly));
+    assert(batch_size > 0);
+
+    *pf = (nn_prefetch){.data_x = data_x, .x_sly = x_sly, .data_trg = data_trg, .trg_sly = trg_sly,
+                        .data_weight = data_weight, .index_sly = index_sly, .batch_size = batch_size,
+                        .first_epoch = first_epoch, .nbr_epochs = nbr_epochs, .shuffle = shuffle, .seed = seed};
+    pf->ind = (IND_TYP *)malloc(index_sly.len * sizeof(IND_TYP));
+    assert(pf->ind);
+    for (IND_TYP i = 0; i < index_sly.len; i++)
+        pf->ind[i] = i;
+    for (int s = 0; s < 2; s++)
+    {
+        pf->x[s] = (FLT_TYP *)malloc(batch_size * x_sly.len * sizeof(FLT_TYP));
+        assert(pf->x[s]);
+        pf->trg[s] = (FLT_TYP *)malloc(batch_size * trg_sly.len * sizeof(FLT_TYP));
+        assert(pf->trg[s]);
+        pf->weight[s] = (FLT_TYP *)malloc(batch_size * sizeof(FLT_TYP));
+        assert(pf->weight[s]);
+    }
+    bool mtx_ok = mtx_init(&pf->mtx, mtx_plain) == thrd_success;
+    bool cnd_ok = mtx_ok && cnd_init(&pf->cnd) == thrd_success;
+    if (!cnd_ok || thrd_create(&pf->thrd, producer, pf) != thrd_success)
+    {
+        log_msg(LOG_ERR, "nn_prefetch_start: cannot start the producer thread!");
+        if (cnd_ok)
+            cnd_destroy(&pf->cnd);
+        if (mtx_ok)
+            mtx_destroy(&pf->mtx);
+        for (int s = 0; s < 2; s++)
+        {
+            free(pf->x[s]);
+            free(pf->trg[s]);
+            free(pf->weight[s]);
+        }
+        free(pf->ind);
+        return NULL;
+    }
+    return pf;
+}
+
+const nn_prefetch_batch *nn_prefetch_acquire(nn_prefetch *pf)
+{
+    assert(pf);
+    int slot = pf->nbr_acquired & 1;
+    mtx_lock(&pf->mtx);
+    while (pf->state[slot] != SLOT_FILLED)
+        cnd_wait(&pf->cnd, &pf->mtx);
+    pf->state[slot] = SLOT_IN_USE;
+    mtx_unlock(&pf->mtx);
+    return pf->batch + slot;
+}
+
+void nn_prefetch_release(nn_prefetch *pf)
+{
+    assert(pf);
+    int slot = pf->nbr_acquired & 1;
+    mtx_lock(&pf->mtx);
+    assert(pf->state[slot] == SLOT_IN_USE);
+    pf->state[slot] = SLOT_FREE;
+    pf->nbr_acquired++;
+    cnd_broadcast(&pf->cnd);
+    mtx_unlock(&pf->mtx);
+}
+
+void nn_prefetch_stop(nn_prefetch *pf)
+{
+    assert(pf);
+    mtx_lock(&pf->mtx);
+    pf->stop = true;
+    cnd_broadcast(&pf->cnd);
+    mtx_unlock(&pf->mtx);
+    thrd_join(pf->thrd, NULL);
+    cnd_destroy(&pf->cnd);
+    mtx_destroy(&pf->mtx);
+    for (int s = 0; s < 2; s++)
+    {
+        free(pf->x[s]);
+        free(pf->trg[s]);
+        free(pf->weight[s]);
+    }
+    free(pf->ind);
+}
@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "nn_prof.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+static const char *const phase_str[NN_PROF_NBR_PHASES] = {
+    "gather", "dropout", "reset", "forward", "activ", "loss", "backward", "reduce", "allreduce", "optim"};
+
+nn_prof *nn_prof_construct(nn_prof *prof, int nbr_layers)
+{
+    assert(prof);
+    assert(nbr_layers >= 0);
+    *prof = nn_prof_NULL;
+    prof->nbr_layers = nbr_layers;
+    if (nbr_layers > 0)
+    {
+        prof->layer = (nn_prof_counter *)calloc((size_t)nbr_layers * NN_PROF_NBR_PHASES, sizeof(nn_prof_counter));
+        assert(prof->layer);
+    }
+    return prof;
+}
+
+void nn_prof_destruct(nn_prof *prof)
+{
+    assert(prof);
+    free(prof->layer);
+    *prof = nn_prof_NULL;
+}
+
+void nn_prof_reset(nn_prof *prof)
+{
+    assert(prof);
+    memset(prof->total, 0, sizeof(prof->total));
+    if (prof->layer)
+        memset(prof->layer, 0, (size_t)prof->nbr_layers * NN_PROF_NBR_PHASES * sizeof(nn_prof_counter));
+}
+
+uint64_t nn_prof_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline void counter_add(nn_prof_counter *c, uint64_t ns, uint64_t calls, double flop, double bytes)
+{
+    c->ns += ns;
+    c->calls += calls;
+    c->flop += flop;
+    c->bytes += bytes;
+}
+
+void nn_prof_add(nn_prof *prof, int layer, enum nn_prof_phase phase, uint64_t ns, double flop, double bytes)
+{
+    assert(prof);
+    assert(phase >= 0 && phase < NN_PROF_NBR_PHASES);
+    counter_add(prof->total + phase, ns, 1, flop, bytes);
+    if (layer >= 0 && layer < prof->nbr_layers)
+        counter_add(prof->layer + layer * NN_PROF_NBR_PHASES + phase, ns, 1, flop, bytes);
+}
+
+void nn_prof_merge(nn_prof *dst, const nn_prof *src)
+{
+    assert(dst && src);
+    assert(dst->nbr_layers == src->nbr_layers);
+    for (int p = 0; p < NN_PROF_NBR_PHASES; p++)
+        counter_add(dst->total + p, src->total[p].ns, src->total[p].calls, src->total[p].flop, src->total[p].bytes);
+    for (int i = 0; i < src->nbr_layers * NN_PROF_NBR_PHASES; i++)
+        counter_add(dst->layer + i, src->layer[i].ns, src->layer[i].calls, src->layer[i].flop, src->layer[i].bytes);
+}
+
+const char *nn_prof_phase_str(enum nn_prof_phase phase)
+{
+    return (phase >= 0 && phase < NN_PROF_NBR_PHASES) ? phase_str[phase] : "?";
+}
+
+static int counter_to_str(const nn_prof_counter *c, const char *name, char *s, size_t size)
+{
+    double sec = c->ns * 1e-9;
+    return snprintf(s, size, "%-12s %12.6f s %10lu calls %10.3f GFLOP/s %10.3f GB/s\n", name, sec,
+                    (unsigned long)c->calls, (sec > 0) ? c->flop / sec * 1e-9 : 0.0,
+                    (sec > 0) ? c->bytes / sec * 1e-9 : 0.0);
+}
+
+char *nn_prof_to_str(const nn_prof *prof, char *string, size_t size)
+{
+    assert(prof);
+    assert(string && size > 0);
+    size_t n = 0;
+    string[0] = 0;
+    for (int p = 0; p < NN_PROF_NBR_PHASES && n < size; p++)
+        if (prof->total[p].calls)
+            n += counter_to_str(prof->total + p, phase_str[p], string + n, size - n);
+    for (int l = 0; l < prof->nbr_layers && n < size; l++)
+    {
+        for (int p = 0; p < NN_PROF_NBR_PHASES && n < size; p++)
+        {
+            const nn_prof_counter *c = prof->layer + l * NN_PROF_NBR_PHASES + p;
+            if (!c->calls)
+                continue;
+            char name[32];
+            snprintf(name, sizeof(name), "%3d %s", l, phase_str[p]);
+            n += counter_to_str(c, name, string + n, size - n);
+        }
+    }
+    return string;
+}
+
+void nn_prof_print(const nn_prof *prof)
+{
+    char str_buff[8192];
+    fputs(nn_prof_to_str(prof, str_buff, sizeof(str_buff)), stdout);
+}
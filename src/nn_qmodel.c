@@ -0,0 +1,486 @@
+#include "nn_qmodel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include "nn_dense.h"
+#include "nn_infer_ctx.h"
+#include "nn_eval.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NN_QMODEL_X86 1
+#include <immintrin.h>
+#endif
+
+// rows per chunk of nn_qmodel_compare
+#define NN_QMODEL_EVAL_CHUNK NN_EVAL_CHUNK
+
+static inline IND_TYP pad_row(IND_TYP n)
+{
+    return (n + NN_QMODEL_ROW_ALIGN - 1) / NN_QMODEL_ROW_ALIGN * NN_QMODEL_ROW_ALIGN;
+}
+
+// res[k] = q[k * stride ...] . w for k < nbr (<= 4); n is a multiple of NN_QMODEL_ROW_ALIGN;
+// w_sum is the sum of w[0 .. n)
+typedef void (*qdot_func)(int32_t *res, int nbr, const int8_t *q, IND_TYP stride,
+                          const int8_t *w, int32_t w_sum, IND_TYP n);
+
+static void qdot_c(int32_t *res, int nbr, const int8_t *q, IND_TYP stride,
+                   const int8_t *w, int32_t w_sum, IND_TYP n)
+{
+    (void)w_sum;
+    int32_t acc[4] = {0, 0, 0, 0};
+    for (IND_TYP i = 0; i < n; i++)
+    {
+        int32_t w_i = w[i];
+        for (int k = 0; k < nbr; k++)
+            acc[k] += (int32_t)q[k * stride + i] * w_i;
+    }
+    for (int k = 0; k < nbr; k++)
+        res[k] = acc[k];
+}
+
+#ifdef NN_QMODEL_X86
+__attribute__((target("avx2"))) static inline int32_t hsum_epi32(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+// AVX2 has no exact 8 bit product (vpmaddubsw saturates): both sides are widened to int16
+// for vpmaddwd, 16 products per instruction
+__attribute__((target("avx2"))) static void qdot_avx2(int32_t *res, int nbr, const int8_t *q, IND_TYP stride,
+                                                      const int8_t *w, int32_t w_sum, IND_TYP n)
+{
+    (void)w_sum;
+    __m256i acc[4];
+    for (int k = 0; k < nbr; k++)
+        acc[k] = _mm256_setzero_si256();
+    for (IND_TYP i = 0; i < n; i += 16)
+    {
+        __m256i w16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i)));
+        for (int k = 0; k < nbr; k++)
+        {
+            __m256i q16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(q + k * stride + i)));
+            acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(q16, w16));
+        }
+    }
+    for (int k = 0; k < nbr; k++)
+        res[k] = hsum_epi32(acc[k]);
+}
+
+// VNNI: vpdpbusd takes u8 x s8, 32 products per instruction. The activations are offset to
+// u8 (q + 128, a flip of the sign bit) and the offset taken off again: q . w = (q + 128) . w - 128 * w_sum.
+#define QDOT_VNNI(name, target_str, dpbusd)                                                          \
+    __attribute__((target(target_str))) static void name(int32_t *res, int nbr, const int8_t *q, \
+                                                         IND_TYP stride, const int8_t *w,          \
+                                                         int32_t w_sum, IND_TYP n)                 \
+    {                                                                                                \
+        const __m256i sign = _mm256_set1_epi8((char)0x80);                                           \
+        __m256i acc[4];                                                                              \
+        for (int k = 0; k < nbr; k++)                                                                \
+            acc[k] = _mm256_setzero_si256();                                                         \
+        for (IND_TYP i = 0; i < n; i += 32)                                                          \
+        {                                                                                            \
+            __m256i w8 = _mm256_load_si256((const __m256i *)(w + i));                                \
+            for (int k = 0; k < nbr; k++)                                                            \
+            {                                                                                        \
+                __m256i u8 = _mm256_load_si256((const __m256i *)(q + k * stride + i));               \
+                acc[k] = dpbusd(acc[k], _mm256_xor_si256(u8, sign), w8);                             \
+            }                                                                                        \
+        }                                                                                            \
+        for (int k = 0; k < nbr; k++)                                                                \
+            res[k] = hsum_epi32(acc[k]) - 128 * w_sum;                                               \
+    }
+
+QDOT_VNNI(qdot_avxvnni, "avx2,avxvnni", _mm256_dpbusd_avx_epi32)
+QDOT_VNNI(qdot_avx512vnni, "avx2,avx512vnni,avx512vl", _mm256_dpbusd_epi32)
+#endif
+
+// the best kernel of the running CPU
+static qdot_func qdot_kernel(void)
+{
+#ifdef NN_QMODEL_X86
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+        return qdot_avx512vnni;
+    if (__builtin_cpu_supports("avxvnni"))
+        return qdot_avxvnni;
+    if (__builtin_cpu_supports("avx2"))
+        return qdot_avx2;
+#endif
+    return qdot_c;
+}
+
+// symmetric int8 quantization of x[n] into q[n_pad] (zero padded); returns the scale
+static float quantize_row(int8_t *q, const FLT_TYP *x, IND_TYP n, IND_TYP n_pad)
+{
+    FLT_TYP mx = 0;
+    for (IND_TYP i = 0; i < n; i++)
+    {
+        FLT_TYP v = fabs(x[i]);
+        if (v > mx)
+            mx = v;
+    }
+    if (mx == 0)
+    {
+        memset(q, 0, n_pad);
+        return 0;
+    }
+    float inv = 127.0f / (float)mx;
+    for (IND_TYP i = 0; i < n; i++)
+        q[i] = (int8_t)lrintf((float)x[i] * inv);
+    memset(q + n, 0, n_pad - n);
+    return (float)mx / 127.0f;
+}
+
+nn_qmodel *nn_model_quantize(nn_qmodel *qmodel, const nn_model *model)
+{
+    assert(qmodel);
+    assert(model);
+    assert(qmodel->nbr_layers == 0 && !qmodel->layer);
+
+    if (model->nbr_layers == 0)
+    {
+        log_msg(LOG_ERR, "nn_model_quantize: the model has no layers!");
+        return NULL;
+    }
+    qmodel->input_size = model->input_size;
+    qmodel->ouput_size = model->ouput_size;
+    qmodel->max_width = model->max_width;
+    qmodel->nbr_layers = model->nbr_layers;
+    qmodel->layer = (nn_qlayer *)calloc(model->nbr_layers, sizeof(nn_qlayer));
+    assert(qmodel->layer);
+    for (int l = 0; l < model->nbr_layers; l++)
+    {
+        nn_qlayer *ql = qmodel->layer + l;
+        const mat *w = model->weight + l;
+        ql->out_sz = w->d1;
+        ql->inp_sz = w->d2;
+        ql->inp_pad = pad_row(w->d2);
+        ql->activ = model->layer[l].activ;
+        ql->w = (int8_t *)aligned_alloc(NN_QMODEL_ROW_ALIGN, ql->out_sz * ql->inp_pad);
+        assert(ql->w);
+        ql->w_scale = (float *)calloc(ql->out_sz, sizeof(float));
+        assert(ql->w_scale);
+        ql->w_sum = (int32_t *)calloc(ql->out_sz, sizeof(int32_t));
+        assert(ql->w_sum);
+        ql->bias = (FLT_TYP *)calloc(ql->out_sz, sizeof(FLT_TYP));
+        assert(ql->bias);
+        for (IND_TYP o = 0; o < ql->out_sz; o++)
+        {
+            int8_t *w_o = ql->w + o * ql->inp_pad;
+            ql->w_scale[o] = quantize_row(w_o, mat_at(w, o, 0), ql->inp_sz, ql->inp_pad);
+            for (IND_TYP i = 0; i < ql->inp_sz; i++)
+                ql->w_sum[o] += w_o[i];
+            ql->bias[o] = *vec_at(model->bias + l, o);
+        }
+    }
+    return qmodel;
+}
+
+void nn_qmodel_destruct(nn_qmodel *qmodel)
+{
+    assert(qmodel);
+    for (int l = 0; l < qmodel->nbr_layers; l++)
+    {
+        free(qmodel->layer[l].w);
+        free(qmodel->layer[l].w_scale);
+        free(qmodel->layer[l].w_sum);
+        free(qmodel->layer[l].bias);
+    }
+    free(qmodel->layer);
+    *qmodel = nn_qmodel_NULL;
+}
+
+size_t nn_qmodel_weight_bytes(const nn_qmodel *qmodel)
+{
+    assert(qmodel);
+    size_t sz = 0;
+    for (int l = 0; l < qmodel->nbr_layers; l++)
+        sz += qmodel->layer[l].out_sz * (qmodel->layer[l].inp_pad + sizeof(float) + sizeof(int32_t));
+    return sz;
+}
+
+nn_qinfer_ctx *nn_qinfer_ctx_construct(nn_qinfer_ctx *ctx, const nn_qmodel *qmodel, IND_TYP batch_cap)
+{
+    assert(ctx);
+    assert(qmodel);
+    assert(batch_cap > 0);
+
+    if (batch_cap <= 0 || qmodel->nbr_layers == 0)
+    {
+        log_msg(LOG_ERR, "nn_qinfer_ctx_construct: cannot construct the ctx with these params!");
+        *ctx = nn_qinfer_ctx_NULL;
+        return NULL;
+    }
+    ctx->input_size = qmodel->input_size;
+    ctx->max_width = qmodel->max_width;
+    ctx->batch_cap = batch_cap;
+    ctx->inp = payload_NULL;
+    payload_construct(&ctx->inp, batch_cap * ctx->input_size);
+    assert(payload_is_valid(&ctx->inp));
+    for (int i = 0; i < 2; i++)
+    {
+        ctx->buf[i] = payload_NULL;
+        payload_construct(ctx->buf + i, batch_cap * ctx->max_width);
+        assert(payload_is_valid(ctx->buf + i));
+    }
+    IND_TYP q_width = pad_row((ctx->input_size > ctx->max_width) ? ctx->input_size : ctx->max_width);
+    ctx->q = (int8_t *)aligned_alloc(NN_QMODEL_ROW_ALIGN, batch_cap * q_width);
+    assert(ctx->q);
+    ctx->q_scale = (float *)calloc(batch_cap, sizeof(float));
+    assert(ctx->q_scale);
+    return ctx;
+}
+
+void nn_qinfer_ctx_destruct(nn_qinfer_ctx *ctx)
+{
+    assert(ctx);
+    if (ctx->batch_cap > 0)
+    {
+        payload_release(&ctx->inp);
+        payload_release(ctx->buf);
+        payload_release(ctx->buf + 1);
+        free(ctx->q);
+        free(ctx->q_scale);
+    }
+    *ctx = nn_qinfer_ctx_NULL;
+}
+
+FLT_TYP *nn_qinfer_ctx_input(nn_qinfer_ctx *ctx)
+{
+    assert(ctx && ctx->batch_cap > 0);
+    return payload_at(&ctx->inp, 0);
+}
+
+// s[nbr_rows x out_sz] = dequantized (q . w^T) + bias
+static void qlayer_forward(FLT_TYP *s, const nn_qlayer *ql, const int8_t *q, const float *q_scale,
+                           IND_TYP nbr_rows)
+{
+    IND_TYP out_sz = ql->out_sz;
+    IND_TYP stride = ql->inp_pad;
+    qdot_func qdot = qdot_kernel();
+    int32_t res[4];
+    for (IND_TYP r = 0; r < nbr_rows; r += 4)
+    {
+        int nbr = (r + 4 <= nbr_rows) ? 4 : (int)(nbr_rows - r);
+        const int8_t *q0 = q + r * stride;
+        for (IND_TYP o = 0; o < out_sz; o++)
+        {
+            qdot(res, nbr, q0, stride, ql->w + o * stride, ql->w_sum[o], stride);
+            for (int k = 0; k < nbr; k++)
+                s[(r + k) * out_sz + o] = (FLT_TYP)res[k] * (ql->w_scale[o] * q_scale[r + k]) + ql->bias[o];
+        }
+    }
+}
+
+const FLT_TYP *nn_qmodel_infer_batch(const nn_qmodel *qmodel, nn_qinfer_ctx *ctx, IND_TYP nbr_rows)
+{
+    assert(qmodel);
+    assert(ctx);
+    assert(qmodel->nbr_layers > 0);
+    assert(ctx->input_size == qmodel->input_size && ctx->max_width >= qmodel->max_width);
+    assert(nbr_rows > 0 && nbr_rows <= ctx->batch_cap);
+
+    const FLT_TYP *a_in = payload_at(&ctx->inp, 0);
+    vec a = vec_NULL;
+    for (int l = 0; l < qmodel->nbr_layers; l++)
+    {
+        const nn_qlayer *ql = qmodel->layer + l;
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+            ctx->q_scale[r] = quantize_row(ctx->q + r * ql->inp_pad, a_in + r * ql->inp_sz,
+                                           ql->inp_sz, ql->inp_pad);
+        payload *out_pyl = ctx->buf + (l & 1);
+        FLT_TYP *out = payload_at(out_pyl, 0);
+        qlayer_forward(out, ql, ctx->q, ctx->q_scale, nbr_rows);
+        enum nn_activ_enum act = nn_activ_to_enum(&ql->activ);
+        if (nn_dense_is_fusable(act))
+        {
+            nn_dense_activate(out, out, nbr_rows * ql->out_sz, act);
+        }
+        else
+        {
+            vec_construct_prealloc(&a, out_pyl, 0, nbr_rows * ql->out_sz, 1);
+            ql->activ.func(&a, &a);
+        }
+        a_in = out;
+    }
+    vec_destruct(&a);
+    return a_in;
+}
+
+vec *nn_qmodel_infer(const nn_qmodel *qmodel, nn_qinfer_ctx *ctx, const vec *input, vec *output)
+{
+    assert(qmodel);
+    assert(ctx);
+    assert(vec_is_valid(input));
+    assert(vec_is_valid(output));
+    assert(input->d == qmodel->input_size);
+    assert(output->d == qmodel->ouput_size);
+
+    FLT_TYP *inp = nn_qinfer_ctx_input(ctx);
+    for (IND_TYP i = 0; i < input->d; i++)
+        inp[i] = *vec_at(input, i);
+    const FLT_TYP *out = nn_qmodel_infer_batch(qmodel, ctx, 1);
+    for (IND_TYP i = 0; i < output->d; i++)
+        *vec_at(output, i) = out[i];
+    return output;
+}
+
+static void *qeval_ctx_construct(const void *qmodel, IND_TYP batch_cap)
+{
+    nn_qinfer_ctx *ctx = (nn_qinfer_ctx *)malloc(sizeof(nn_qinfer_ctx));
+    assert(ctx);
+    if (!nn_qinfer_ctx_construct(ctx, (const nn_qmodel *)qmodel, batch_cap))
+    {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void qeval_ctx_destruct(void *ctx)
+{
+    nn_qinfer_ctx_destruct((nn_qinfer_ctx *)ctx);
+    free(ctx);
+}
+
+static FLT_TYP *qeval_ctx_input(void *ctx)
+{
+    return nn_qinfer_ctx_input((nn_qinfer_ctx *)ctx);
+}
+
+static const FLT_TYP *qeval_infer_batch(const void *qmodel, void *ctx, IND_TYP nbr_rows)
+{
+    return nn_qmodel_infer_batch((const nn_qmodel *)qmodel, (nn_qinfer_ctx *)ctx, nbr_rows);
+}
+
+static const nn_eval_class qeval_cls = {.construct = qeval_ctx_construct, .destruct = qeval_ctx_destruct,
+                                        .input = qeval_ctx_input, .infer_batch = qeval_infer_batch};
+
+FLT_TYP nn_qmodel_eval(const nn_qmodel *qmodel,
+                       const data_points *data_x, slice x_sly,
+                       const data_points *data_trg, slice trg_sly,
+                       const vec *data_weight,
+                       slice index_sly,
+                       const nn_loss loss,
+                       bool classification)
+{
+    assert(qmodel);
+    assert(data_x);
+    assert(data_trg);
+
+    slice_regulate(&x_sly, data_x->width);
+    slice_regulate(&trg_sly, data_trg->width);
+    slice_regulate(&index_sly, data_x->nbr_points);
+
+    assert(qmodel->input_size == x_sly.len);
+    assert(qmodel->ouput_size == trg_sly.len);
+    assert(!data_weight || data_weight->d == index_sly.len);
+
+    if (qmodel->nbr_layers == 0 || index_sly.len == 0)
+    {
+        log_msg(LOG_WRN, "nn_qmodel_eval: nothing to evaluate!");
+        return 0;
+    }
+    return nn_eval_loss(&qeval_cls, qmodel, qmodel->input_size, qmodel->ouput_size, data_x, x_sly,
+                        data_trg, trg_sly, data_weight, index_sly, loss, classification, 1);
+}
+
+static IND_TYP argmax_row(const FLT_TYP *x, IND_TYP n)
+{
+    IND_TYP im = 0;
+    for (IND_TYP i = 1; i < n; i++)
+        if (x[i] > x[im])
+            im = i;
+    return im;
+}
+
+nn_qmodel_report *nn_qmodel_compare(nn_qmodel_report *report,
+                                    const nn_qmodel *qmodel, const nn_model *model,
+                                    const data_points *data_x, slice x_sly,
+                                    const data_points *data_trg, slice trg_sly,
+                                    slice index_sly,
+                                    const nn_loss loss,
+                                    bool classification)
+{
+    assert(report);
+    assert(qmodel);
+    assert(model);
+    assert(qmodel->input_size == model->input_size && qmodel->ouput_size == model->ouput_size);
+
+    slice_regulate(&x_sly, data_x->width);
+    slice_regulate(&index_sly, data_x->nbr_points);
+
+    memset(report, 0, sizeof(nn_qmodel_report));
+    IND_TYP nbr_data = index_sly.len;
+    if (qmodel->nbr_layers == 0 || nbr_data == 0)
+    {
+        log_msg(LOG_WRN, "nn_qmodel_compare: nothing to compare!");
+        return report;
+    }
+    report->nbr_samples = nbr_data;
+    report->loss_float = nn_model_eval(model, data_x, x_sly, data_trg, trg_sly, NULL, index_sly,
+                                       loss, classification);
+    report->loss_quant = nn_qmodel_eval(qmodel, data_x, x_sly, data_trg, trg_sly, NULL, index_sly,
+                                        loss, classification);
+
+    IND_TYP inp_sz = model->input_size;
+    IND_TYP out_sz = model->ouput_size;
+    nn_infer_ctx ctx = nn_infer_ctx_NULL;
+    nn_infer_ctx_construct(&ctx, model, NN_QMODEL_EVAL_CHUNK);
+    nn_qinfer_ctx qctx = nn_qinfer_ctx_NULL;
+    nn_qinfer_ctx_construct(&qctx, qmodel, NN_QMODEL_EVAL_CHUNK);
+    double sum_diff = 0;
+    IND_TYP nbr_agree = 0;
+    for (IND_TYP i0 = 0; i0 < nbr_data; i0 += NN_QMODEL_EVAL_CHUNK)
+    {
+        IND_TYP nbr_rows = (i0 + NN_QMODEL_EVAL_CHUNK <= nbr_data) ? NN_QMODEL_EVAL_CHUNK : nbr_data - i0;
+        FLT_TYP *inp = nn_infer_ctx_input(&ctx);
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+            data_points_copy_at(data_x, inp + r * inp_sz, slice_index(&index_sly, i0 + r), &x_sly);
+        memcpy(nn_qinfer_ctx_input(&qctx), inp, nbr_rows * inp_sz * sizeof(FLT_TYP));
+        const FLT_TYP *out_f = nn_model_infer_batch(model, &ctx, nbr_rows);
+        const FLT_TYP *out_q = nn_qmodel_infer_batch(qmodel, &qctx, nbr_rows);
+        for (IND_TYP r = 0; r < nbr_rows; r++)
+        {
+            const FLT_TYP *f = out_f + r * out_sz;
+            const FLT_TYP *q = out_q + r * out_sz;
+            for (IND_TYP j = 0; j < out_sz; j++)
+            {
+                FLT_TYP d = fabs(f[j] - q[j]);
+                sum_diff += d;
+                if (d > report->max_abs_diff)
+                    report->max_abs_diff = d;
+            }
+            nbr_agree += argmax_row(f, out_sz) == argmax_row(q, out_sz);
+        }
+    }
+    nn_qinfer_ctx_destruct(&qctx);
+    nn_infer_ctx_destruct(&ctx);
+
+    report->mean_abs_diff = (FLT_TYP)(sum_diff / ((double)nbr_data * out_sz));
+    report->argmax_agreement = (FLT_TYP)nbr_agree / nbr_data;
+    report->float_bytes = nn_model_nbr_param(model) * sizeof(FLT_TYP);
+    size_t bias_bytes = 0;
+    for (int l = 0; l < qmodel->nbr_layers; l++)
+        bias_bytes += qmodel->layer[l].out_sz * sizeof(FLT_TYP);
+    report->quant_bytes = nn_qmodel_weight_bytes(qmodel) + bias_bytes;
+    return report;
+}
+
+void nn_qmodel_report_print(const nn_qmodel_report *report)
+{
+    assert(report);
+    printf("int8 model on %ld samples: loss %g (float %g), output diff max %g mean %g, "
+           "argmax agreement %.4f, %zu bytes (float %zu)\n",
+           (long)report->nbr_samples, (double)report->loss_quant, (double)report->loss_float,
+           (double)report->max_abs_diff, (double)report->mean_abs_diff,
+           (double)report->argmax_agreement, report->quant_bytes, report->float_bytes);
+}
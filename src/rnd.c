@@ -35,3 +35,93 @@ IND_TYP int_rnd(IND_TYP a, IND_TYP b)
     else
         return a + (IND_TYP)(pcg_uint64() % (uint64_t)dif) * drc;
 }
+
+void rnd_shuffle_ind(IND_TYP *ind, IND_TYP size, uint64_t rnd(void))
+{
+    for (IND_TYP i = 0; i < size - 1; i++)
+    {
+        IND_TYP j = rnd() % (size - i) + i;
+        assert(j >= 0 && j < size);
+        if (j != i)
+        {
+            IND_TYP tmp = ind[i];
+            ind[i] = ind[j];
+            ind[j] = tmp;
+        }
+    }
+}
+
+rnd_stream *rnd_stream_init(rnd_stream *st, uint64_t seed)
+{
+    assert(st);
+    st->seed = rnd_mix64(seed);
+    st->ctr = 0;
+    return st;
+}
+
+uint64_t rnd_stream_uint64(rnd_stream *st)
+{
+    assert(st);
+    return rnd_mix64(st->seed + 0x9E3779B97F4A7C15ULL * ++st->ctr);
+}
+
+FLT_TYP rnd_stream_flt(rnd_stream *st)
+{
+#ifdef FLD_FLT64
+    return (FLT_TYP)(rnd_stream_uint64(st) >> 11) * 0x1.0p-53;
+#else
+    return (FLT_TYP)(rnd_stream_uint64(st) >> 40) * 0x1.0p-24f;
+#endif
+}
+
+void rnd_stream_shuffle_ind(rnd_stream *st, IND_TYP *ind, IND_TYP size)
+{
+    assert(st);
+    for (IND_TYP i = 0; i < size - 1; i++)
+    {
+        IND_TYP j = rnd_stream_uint64(st) % (size - i) + i;
+        IND_TYP tmp = ind[i];
+        ind[i] = ind[j];
+        ind[j] = tmp;
+    }
+}
+
+void rnd_shuffle_epoch(IND_TYP *ind, IND_TYP size, uint64_t seed, int epoch)
+{
+    if (!seed)
+    {
+        rnd_shuffle_ind(ind, size, UINT_RND_GEN);
+        return;
+    }
+    for (IND_TYP i = 0; i < size; i++)
+        ind[i] = i;
+    rnd_stream st;
+    rnd_stream_init(&st, seed ^ rnd_mix64((uint64_t)epoch + 1));
+    rnd_stream_shuffle_ind(&st, ind, size);
+}
+
+void rnd_stream_fill_bits(rnd_stream *st, uint64_t *bits, IND_TYP nbr_bits, FLT_TYP p_one)
+{
+    assert(st);
+    assert(bits);
+    assert(nbr_bits >= 0);
+
+    // a 32 bit half h is a one iff h < thr
+    uint64_t thr = (p_one <= 0) ? 0 : (p_one >= 1) ? (1ULL << 32) : (uint64_t)((double)p_one * 0x1.0p32);
+    IND_TYP nbr_words = (nbr_bits + 63) / 64;
+    for (IND_TYP w = 0; w < nbr_words; w++)
+    {
+        uint64_t c0 = st->ctr + 32 * (uint64_t)w;
+        uint64_t word = 0;
+        for (int k = 0; k < 32; k++)
+        {
+            uint64_t h = rnd_mix64(st->seed + 0x9E3779B97F4A7C15ULL * (c0 + k + 1));
+            word |= (uint64_t)((h & 0xFFFFFFFFULL) < thr) << (2 * k);
+            word |= (uint64_t)((h >> 32) < thr) << (2 * k + 1);
+        }
+        bits[w] = word;
+    }
+    if (nbr_bits % 64)
+        bits[nbr_words - 1] &= (1ULL << (nbr_bits % 64)) - 1;
+    st->ctr += 32 * (uint64_t)nbr_words;
+}